@@ -0,0 +1,225 @@
+#ifndef ERBIUM_CPU_DEFINITIONS_H
+#define ERBIUM_CPU_DEFINITIONS_H
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <cstdint>
+
+#define CFG_ENGINE_NCRITERIA 22
+
+namespace erbium {
+namespace cpu {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// SW / HW CONSTRAINTS                                                                            //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// raw criterion value (must be consistent with kernel_<shell>.cpp and engine_pkg.vhd)
+typedef uint16_t  operand_t;
+
+// raw NFA transition (to be stored in ultraRam)
+typedef uint64_t  transition_t;
+
+
+// create binary masks for n-bit wise field
+constexpr transition_t generate_mask(int n)
+{
+    return n <= 1 ? 1 : (1 + (generate_mask(n-1) << 1));
+}
+
+// raw cacheline size (must be consistent with kernel_<shell>.cpp and erbium_wrapper.vhd)
+const unsigned char C_CACHELINE_SIZE = 64; // in bytes
+
+// used for determining zero-padding
+const uint16_t C_EDGES_PER_CACHE_LINE = C_CACHELINE_SIZE / sizeof(transition_t);
+
+// actual size of a criterion value (must be consistent with engine_pkg.vhd)
+const uint16_t CFG_CRITERION_VALUE_WIDTH = 13; // in bits
+
+// actual size of an address pointer (must be consistent with engine_pkg.vhd)
+const uint16_t CFG_TRANSITION_POINTER_WIDTH = 16; // in bits
+
+// maximum number of transitions able to stored in one memory unit
+const uint32_t CFG_MEM_MAX_DEPTH = (1 << (CFG_TRANSITION_POINTER_WIDTH + 1)) - 1;
+
+const transition_t MASK_POINTER  = generate_mask(CFG_TRANSITION_POINTER_WIDTH);
+const transition_t MASK_OPERANDS = generate_mask(CFG_CRITERION_VALUE_WIDTH);
+
+// shift constants to align fields to a transition memory line
+const char SHIFT_OPERAND_A = 0;
+const char SHIFT_OPERAND_B = CFG_CRITERION_VALUE_WIDTH + SHIFT_OPERAND_A;
+const char SHIFT_POINTER   = CFG_CRITERION_VALUE_WIDTH + SHIFT_OPERAND_B;
+const char SHIFT_LAST      = CFG_TRANSITION_POINTER_WIDTH + SHIFT_POINTER;
+
+// upper address bits of the depth-first (single memory) layout, above the last flag
+const uint16_t CFG_TRANSITION_POINTER_HIGH_WIDTH = 21; // in bits
+const transition_t MASK_POINTER_HIGH = generate_mask(CFG_TRANSITION_POINTER_HIGH_WIDTH);
+const char SHIFT_POINTER_HIGH = 1 + SHIFT_LAST;
+
+// self-describing NFA image: a header (engine parameters of each level, offset of each memory and
+// checksum of the payload), then the memories (version 1 has no header)
+const uint64_t C_IMAGE_MAGIC             = 0x000041464e425245; // "ERBNFA"
+const uint32_t C_IMAGE_VERSION_FIXED     = 1;
+const uint32_t C_IMAGE_VERSION_PACKED    = 2;
+const uint32_t C_IMAGE_VERSION_DESCRIBED = 3;
+
+const uint8_t C_IMAGE_LAYOUT_LEVELS      = 0;
+const uint8_t C_IMAGE_LAYOUT_DEPTH_FIRST = 1;
+
+const uint8_t C_IMAGE_FLAG_VALUE_SETS    = 1;
+
+struct image_header_s
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;  // in bytes, cache-line aligned (the payload follows)
+    uint64_t hash;
+    uint64_t checksum;     // FNV-1a of the payload
+    uint16_t n_criteria;
+    uint16_t n_memories;
+    uint8_t  layout;
+    uint8_t  flags;
+    uint8_t  reserved[2];
+};
+struct image_criterion_s
+{
+    uint16_t criterion_id;
+    uint16_t functor;
+    uint32_t weight;
+    uint8_t  structure;
+    uint8_t  function_a;
+    uint8_t  function_b;
+    uint8_t  function_pair;
+    uint8_t  match_mode;
+    uint8_t  wildcard;
+    uint16_t reserved;
+};
+struct image_memory_s
+{
+    uint64_t offset;         // in bytes from the beginning of the image, first transition
+    uint64_t size;           // in bytes, padding included
+    uint32_t n_transitions;
+    uint8_t  operand_width;  // in bits, both operands
+    uint8_t  pointer_width;  // in bits
+    uint8_t  slots_per_word; // transitions per 64-bit word (never split across words)
+    uint8_t  reserved;
+};
+// value sets of the IN-list transitions (C_IMAGE_FLAG_VALUE_SETS): n_sets + 1 uint32_t bounds,
+// then the ascending operand_t members of each set
+struct image_sets_s
+{
+    uint64_t offset;
+    uint64_t size;
+    uint32_t n_sets;
+    uint32_t n_values;
+};
+
+// bundle of the NFA images of several rule types (see erbium -g): a header, one entry per image,
+// then the self-describing images each aligned to a cache line
+const uint64_t C_BUNDLE_MAGIC   = 0x004c444e42425245; // "ERBBNDL"
+const uint32_t C_BUNDLE_VERSION = 1;
+
+struct bundle_header_s
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t n_images;
+};
+struct bundle_entry_s
+{
+    uint16_t rule_type;
+    uint16_t n_criteria;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// 64-bit FNV-1a, the checksum of the image payload
+inline uint64_t image_checksum(const char* data, const size_t& size)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3;
+    return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// CPU DEFINITIONS                                                                                //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum MatchStructureType {STRCT_SIMPLE, STRCT_PAIR};
+enum MatchPairFunction {FNCTR_PAIR_NOP, FNCTR_PAIR_AND, FNCTR_PAIR_OR, FNCTR_PAIR_XOR, FNCTR_PAIR_NAND, FNCTR_PAIR_NOR};
+enum MatchSimpFunction {FNCTR_SIMP_NOP, FNCTR_SIMP_EQU, FNCTR_SIMP_NEQ, FNCTR_SIMP_GRT, FNCTR_SIMP_GEQ, FNCTR_SIMP_LES, FNCTR_SIMP_LEQ, FNCTR_SIMP_IN};
+enum MatchModeType {MODE_STRICT_MATCH, MODE_FULL_ITERATION};
+
+struct edge_s {
+    uint16_t operand_a;
+    uint16_t operand_b;
+    uint32_t pointer : 31; // absolute offset in the depth-first layout
+    uint32_t last : 1;
+};
+
+struct result_s {
+    uint32_t weight;
+    uint16_t pointer;
+};
+
+struct level_s {
+    uint32_t weight;
+    uint64_t base;
+};
+
+// matching configuration of the levels of an image (rule types of a bundle differ)
+struct engine_params_s {
+    uint16_t           n_levels;
+    uint32_t           weights[CFG_ENGINE_NCRITERIA];
+    MatchStructureType structure[CFG_ENGINE_NCRITERIA];
+    MatchSimpFunction  function_a[CFG_ENGINE_NCRITERIA];
+    MatchSimpFunction  function_b[CFG_ENGINE_NCRITERIA];
+    MatchPairFunction  function_pair[CFG_ENGINE_NCRITERIA];
+    MatchModeType      match_mode[CFG_ENGINE_NCRITERIA];
+    bool               wildcard[CFG_ENGINE_NCRITERIA];
+};
+
+// members of the set of reference s (from 1): values[first[s-1]] to values[first[s]-1]
+struct value_sets_s {
+    uint32_t   n_sets;
+    uint32_t*  first;  // n_sets + 1 bounds
+    operand_t* values;
+};
+
+struct nfa_image_s {
+    uint64_t hash;
+    uint32_t version;
+    uint32_t raw_size;
+    bool     depth_first; // all the levels share one memory
+    uint32_t n_origin;    // transitions of the origin, indexed by the value id of the first criterion
+    engine_params_s params;
+    edge_s*  levels[CFG_ENGINE_NCRITERIA];
+    value_sets_s sets;    // of the FNCTR_SIMP_IN levels (empty otherwise)
+};
+
+} // namespace cpu
+} // namespace erbium
+
+#endif // ERBIUM_CPU_DEFINITIONS_H
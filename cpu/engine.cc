@@ -0,0 +1,913 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "engine.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+//#define EXEC_DEBUG true
+//#define DETERMINISTIC true
+
+namespace erbium {
+namespace cpu {
+
+// defaults of the reference rule type (headerless images); self-describing images carry their own
+const uint32_t WEIGHTS[CFG_ENGINE_NCRITERIA] = {
+    0, 0, 0, 512, 524288, 65536, 64, 128, 131072, 16, 16384, 2, 4, 4096, 2048, 32768, 32, 8192, 8,
+    1, 262144, 256
+};
+
+const MatchStructureType STRUCT_TYPE[CFG_ENGINE_NCRITERIA] = {
+    STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE,
+    STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE,
+    STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_PAIR, STRCT_PAIR,
+    STRCT_PAIR
+};
+
+const MatchPairFunction FUNCT_PAIR[CFG_ENGINE_NCRITERIA] = {
+    FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP,
+    FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP,
+    FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP,
+    FNCTR_PAIR_NOP, FNCTR_PAIR_AND, FNCTR_PAIR_AND, FNCTR_PAIR_AND
+};
+
+const MatchSimpFunction FUNCT_A[CFG_ENGINE_NCRITERIA] = {
+    FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU,
+    FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU,
+    FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU,
+    FNCTR_SIMP_EQU, FNCTR_SIMP_GEQ, FNCTR_SIMP_GEQ, FNCTR_SIMP_GEQ
+};
+
+const MatchSimpFunction FUNCT_B[CFG_ENGINE_NCRITERIA] = {
+    FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP,
+    FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP,
+    FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP,
+    FNCTR_SIMP_NOP, FNCTR_SIMP_LEQ, FNCTR_SIMP_LEQ, FNCTR_SIMP_LEQ
+};
+
+// strict-match levels stop at the first specific match (see -d)
+const MatchModeType MATCH_MODE[CFG_ENGINE_NCRITERIA] = {
+    MODE_FULL_ITERATION, MODE_FULL_ITERATION, MODE_FULL_ITERATION, MODE_FULL_ITERATION,
+    MODE_FULL_ITERATION, MODE_FULL_ITERATION, MODE_FULL_ITERATION, MODE_FULL_ITERATION,
+    MODE_FULL_ITERATION, MODE_FULL_ITERATION, MODE_FULL_ITERATION, MODE_FULL_ITERATION,
+    MODE_FULL_ITERATION, MODE_FULL_ITERATION, MODE_FULL_ITERATION, MODE_FULL_ITERATION,
+    MODE_FULL_ITERATION, MODE_FULL_ITERATION, MODE_FULL_ITERATION, MODE_FULL_ITERATION,
+    MODE_FULL_ITERATION, MODE_FULL_ITERATION
+};
+
+const bool WILDCARD_EN[CFG_ENGINE_NCRITERIA] = {
+    false, false, false, true, true, true, true, true, true, true, true, true, true, true, true,
+    true, true, true, true, true, true, true
+};
+
+bool functor(const MatchSimpFunction& G_FUNCTION,
+             const bool& G_WILDCARD,
+             const uint16_t& rule_i,
+             const uint16_t& query_i,
+             bool* wildcard_o)
+{
+    bool sig_result;
+
+    switch(G_FUNCTION)
+    {
+      case FNCTR_SIMP_EQU:
+            sig_result = query_i == rule_i;
+            break;
+      case FNCTR_SIMP_NEQ:
+            sig_result = query_i != rule_i;
+            break;
+      case FNCTR_SIMP_GRT:
+            sig_result = query_i > rule_i;
+            break;
+      case FNCTR_SIMP_GEQ:
+            sig_result = query_i >= rule_i;
+            break;
+      case FNCTR_SIMP_LES:
+            sig_result = query_i < rule_i;
+            break;
+      case FNCTR_SIMP_LEQ:
+            sig_result = query_i <= rule_i;
+            break;
+      default:
+            sig_result = false;
+    }
+
+    if (G_WILDCARD and G_FUNCTION != FNCTR_SIMP_NOP)
+    {
+        *wildcard_o = (rule_i == 0);
+        sig_result = *wildcard_o or sig_result;
+    }
+    else
+    {
+        *wildcard_o = false;
+        sig_result = sig_result;
+    }
+
+    return sig_result;
+}
+
+// binary search of a value in the set of a reference (from 1)
+bool is_member(const value_sets_s& sets, const uint16_t& reference, const uint16_t& value)
+{
+    if (reference > sets.n_sets)
+        return false;
+    const operand_t* first = sets.values + sets.first[reference - 1];
+    const operand_t* last = sets.values + sets.first[reference];
+    return std::binary_search(first, last, value);
+}
+
+bool matcher(const MatchStructureType& G_STRUCTURE,
+             const MatchSimpFunction& G_FUNCTION_A,
+             const MatchSimpFunction& G_FUNCTION_B,
+             const MatchPairFunction& G_FUNCTION_PAIR,
+             const bool& G_WILDCARD,
+             const uint16_t& op_query_i,
+             const uint16_t& opA_rule_i,
+             const uint16_t& opB_rule_i,
+             const value_sets_s& sets,
+             bool* wildcard_o)
+{
+    bool sig_functorA;
+    bool sig_functorB;
+    bool sig_wildcard_a;
+    bool sig_wildcard_b;
+    bool sig_mux_pair;
+
+    sig_functorA = functor(G_FUNCTION_A, G_WILDCARD, opA_rule_i, op_query_i, &sig_wildcard_a);
+
+    bool match_result_o;
+    switch (G_STRUCTURE)
+    {
+      case STRCT_SIMPLE:
+            // IN-list transitions reference a value set (coalesced levels are pairs)
+            if (opB_rule_i != 0 && G_FUNCTION_B == FNCTR_SIMP_IN)
+                sig_functorA = sig_functorA || is_member(sets, opB_rule_i, op_query_i);
+            *wildcard_o = sig_wildcard_a;
+            match_result_o = sig_functorA;
+            break;
+      case STRCT_PAIR:
+            sig_functorB = functor(G_FUNCTION_B, G_WILDCARD, opB_rule_i, op_query_i, &sig_wildcard_b);
+
+            *wildcard_o = sig_wildcard_a or sig_wildcard_b;
+
+            switch (G_FUNCTION_PAIR)
+            {
+              case FNCTR_PAIR_AND:
+                    sig_mux_pair = sig_functorA && sig_functorB;
+                    break;
+              case FNCTR_PAIR_OR:
+                    sig_mux_pair = sig_functorA || sig_functorB;
+                    break;
+              case FNCTR_PAIR_XOR:
+                    sig_mux_pair = sig_functorA ^ sig_functorB;
+                    break;
+              case FNCTR_PAIR_NAND:
+                    sig_mux_pair = !(sig_functorA && sig_functorB);
+                    break;
+              case FNCTR_PAIR_NOR:
+                    sig_mux_pair = !(sig_functorA || sig_functorB);
+                    break;
+              default:
+                    sig_mux_pair = false;
+            }
+            match_result_o = sig_mux_pair;
+            break;
+      default:
+            match_result_o = false;;
+    }
+
+    return match_result_o;
+}
+
+void compute(const nfa_image_s* nfa, const uint16_t* query, const uint16_t level, uint32_t pointer,
+             const uint32_t interim, result_s* result)
+{
+    uint32_t aux_interim;
+    bool wildcard;
+    bool match;
+
+    #ifdef DETERMINISTIC
+    bool has_match = false;
+    uint32_t wildcard_pointer;
+    #endif
+    do
+    {
+        match =  matcher(nfa->params.structure[level], nfa->params.function_a[level],
+            nfa->params.function_b[level], nfa->params.function_pair[level],
+            nfa->params.wildcard[level], *query,
+            nfa->levels[level][pointer].operand_a,
+            nfa->levels[level][pointer].operand_b,
+            nfa->sets,
+            &wildcard);
+
+        if (!match)
+            continue;
+
+        #ifdef DETERMINISTIC
+        if (wildcard)
+        {
+            wildcard_pointer = pointer;
+            has_match = true;
+            match = false;
+            continue;
+        }
+        #endif
+
+        // weight
+        if (wildcard)
+            aux_interim = interim;
+        else
+            aux_interim = interim + nfa->params.weights[level];
+
+        // check pointer or result
+        if (level == nfa->params.n_levels - 1)
+        {
+            if (aux_interim >= result->weight)
+            {
+                //if ((aux_interim == result->weight) && (result->pointer != nfa->levels[level][pointer].pointer))
+                //    std::cout << "Weird\n";
+                result->weight = aux_interim;
+                result->pointer = nfa->levels[level][pointer].pointer;
+                #ifdef EXEC_DEBUG
+                std::cout << " level=" << level << "query=" << *query
+                          << " opA=" << nfa->levels[level][pointer].operand_a
+                          << " opB=" << nfa->levels[level][pointer].operand_b
+                          << " pointer=" << nfa->levels[level][pointer].pointer
+                          << " weight=" << aux_interim << std::endl;
+                #endif
+            }
+        }
+        else
+        {
+            #ifdef EXEC_DEBUG
+            std::cout << " level=" << level << "query=" << *query
+                      << " opA=" << nfa->levels[level][pointer].operand_a
+                      << " opB=" << nfa->levels[level][pointer].operand_b
+                      << " pointer=" << nfa->levels[level][pointer].pointer
+                      << " weight=" << aux_interim << std::endl;
+            #endif
+            compute(nfa, query+1, level+1, nfa->levels[level][pointer].pointer, aux_interim, result);
+        }
+
+        // disjoint transitions (wildcard and value sets first): no other transition can match
+        if (nfa->params.match_mode[level] == MODE_STRICT_MATCH && !wildcard
+            && (nfa->params.function_b[level] != FNCTR_SIMP_IN || nfa->levels[level][pointer].operand_b == 0))
+            break;
+    #ifdef DETERMINISTIC
+    } while(!nfa->levels[level][pointer++].last & !match);
+    if (has_match && level == nfa->params.n_levels - 1)
+    {
+        result->weight = interim;
+        result->pointer = nfa->levels[level][wildcard_pointer].pointer;
+    }
+    else if (has_match)
+        compute(nfa, query+1, level+1, nfa->levels[level][wildcard_pointer].pointer, interim, result);
+    #else
+    } while(!nfa->levels[level][pointer++].last);
+    #endif
+}
+
+void decode_fixed_edge(const uint64_t& raw_edge, edge_s* edge)
+{
+    edge->operand_a = (raw_edge >> SHIFT_OPERAND_A) & MASK_OPERANDS;
+    edge->operand_b = (raw_edge >> SHIFT_OPERAND_B) & MASK_OPERANDS;
+    edge->pointer = ((raw_edge >> SHIFT_POINTER) & MASK_POINTER)
+                  | (((raw_edge >> SHIFT_POINTER_HIGH) & MASK_POINTER_HIGH) << CFG_TRANSITION_POINTER_WIDTH);
+    edge->last = (raw_edge >> SHIFT_LAST) & 1;
+}
+
+// transitions of the origin: its fan-out block starts the memory of the first level
+uint32_t get_origin_size(const edge_s* edges, const uint32_t& n_edges)
+{
+    uint32_t n_origin = 0;
+    while (n_origin < n_edges && !edges[n_origin++].last);
+    return n_origin;
+}
+
+uint32_t read_nfa_edges(std::ifstream* file_nfadata, edge_s** edges)
+{
+    uint32_t num_edges;
+    uint64_t raw_edge = 0;
+    uint16_t padding;
+
+    // past the end of the image (fewer memories than criteria), no transitions
+    file_nfadata->read(reinterpret_cast<char *>(&raw_edge), sizeof(raw_edge));
+    num_edges = (file_nfadata->good()) ? raw_edge : 0;
+    *edges = (edge_s*) malloc(num_edges * sizeof(edge_s));
+    #ifdef EXEC_DEBUG
+    std::cout << " edges=" << num_edges << std::endl;
+    #endif
+    for (uint32_t i=0; i<num_edges; i++)
+    {
+        file_nfadata->read(reinterpret_cast<char *>(&raw_edge), sizeof(raw_edge));
+        decode_fixed_edge(raw_edge, &(*edges)[i]);
+        #ifdef EXEC_DEBUG
+        std::cout << " edge=" << i << " data=" << raw_edge << std::endl;
+        #endif
+    }
+    // Padding
+    padding = (num_edges + 1) % C_EDGES_PER_CACHE_LINE;
+    padding = (padding == 0) ? 0 : C_EDGES_PER_CACHE_LINE - padding;
+    file_nfadata->seekg(padding * sizeof(raw_edge), std::ios::cur);
+    return num_edges;
+}
+
+// parameters of the headerless images: the defaults of the reference rule type; disjoint pair
+// levels (erbium -n) stop at their first specific match
+engine_params_s default_engine_params(const bool& disjoint)
+{
+    engine_params_s params;
+    params.n_levels = CFG_ENGINE_NCRITERIA;
+    for (uint16_t level=0; level<CFG_ENGINE_NCRITERIA; level++)
+    {
+        params.weights[level]       = WEIGHTS[level];
+        params.structure[level]     = STRUCT_TYPE[level];
+        params.function_a[level]    = FUNCT_A[level];
+        params.function_b[level]    = FUNCT_B[level];
+        params.function_pair[level] = FUNCT_PAIR[level];
+        params.match_mode[level]    = MATCH_MODE[level];
+        params.wildcard[level]      = WILDCARD_EN[level];
+    }
+    // the last level is never split (one content per state)
+    for (uint16_t level = 1; disjoint && level < CFG_ENGINE_NCRITERIA - 1; level++)
+    {
+        if (params.structure[level] == STRCT_PAIR)
+            params.match_mode[level] = MODE_STRICT_MATCH;
+    }
+    return params;
+}
+
+// parameters of a described image; the images of a same rule type (shards, hot-swap) must share
+// those of the reference image
+bool configure_engine(const image_criterion_s* criteria, const uint16_t& n_levels,
+                      engine_params_s* params, const engine_params_s* reference)
+{
+    memset(params, 0, sizeof(*params));
+    params->n_levels = n_levels;
+    for (uint16_t level=0; level<n_levels; level++)
+    {
+        const image_criterion_s& criterion = criteria[level];
+        params->weights[level]       = criterion.weight;
+        params->structure[level]     = (MatchStructureType) criterion.structure;
+        params->function_a[level]    = (MatchSimpFunction) criterion.function_a;
+        params->function_b[level]    = (MatchSimpFunction) criterion.function_b;
+        params->function_pair[level] = (MatchPairFunction) criterion.function_pair;
+        params->match_mode[level]    = (MatchModeType) criterion.match_mode;
+        params->wildcard[level]      = criterion.wildcard;
+    }
+    if (reference == NULL)
+        return true;
+
+    if (reference->n_levels != n_levels)
+    {
+        std::cerr << "[!] Image of " << n_levels << " criteria, the engine runs "
+                  << reference->n_levels << " criteria\n";
+        return false;
+    }
+    for (uint16_t level=0; level<n_levels; level++)
+    {
+        if (reference->weights[level] != params->weights[level]
+            || reference->structure[level] != params->structure[level]
+            || reference->function_a[level] != params->function_a[level]
+            || reference->function_b[level] != params->function_b[level]
+            || reference->function_pair[level] != params->function_pair[level]
+            || reference->match_mode[level] != params->match_mode[level]
+            || reference->wildcard[level] != params->wildcard[level])
+        {
+            std::cerr << "[!] Level " << level << " (criterion " << criteria[level].criterion_id
+                      << ") differs from the engine parameters in use\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// validates the header and the checksum, then decodes each memory at the offset of its descriptor
+// (the image is a file or an entry of a bundle, cache-line aligned)
+bool read_described_nfa_image(const char* image, const size_t& size, nfa_image_s* nfa,
+                              const engine_params_s* reference)
+{
+    if (size < sizeof(image_header_s))
+    {
+        std::cerr << "[!] NFA image of " << size << " bytes is shorter than its header\n";
+        return false;
+    }
+    const image_header_s* header = reinterpret_cast<const image_header_s*>(image);
+    if (header->magic != C_IMAGE_MAGIC || header->header_size > size
+        || (header->version != C_IMAGE_VERSION_PACKED && header->version != C_IMAGE_VERSION_DESCRIBED))
+    {
+        std::cerr << "[!] NFA image version " << header->version << " is not supported\n";
+        return false;
+    }
+    const uint16_t n_memories = (nfa->depth_first) ? 1 : header->n_criteria;
+    if (header->n_criteria == 0 || header->n_criteria > CFG_ENGINE_NCRITERIA
+        || header->n_memories != n_memories
+        || header->layout != ((nfa->depth_first) ? C_IMAGE_LAYOUT_DEPTH_FIRST : C_IMAGE_LAYOUT_LEVELS))
+    {
+        std::cerr << "[!] NFA image of " << header->n_criteria << " criteria in "
+                  << ((header->layout == C_IMAGE_LAYOUT_DEPTH_FIRST) ? "depth-first" : "level-major")
+                  << " layout, the engine runs up to " << CFG_ENGINE_NCRITERIA << " criteria in "
+                  << ((nfa->depth_first) ? "depth-first" : "level-major") << " layout\n";
+        return false;
+    }
+    if (header->checksum != image_checksum(image + header->header_size, size - header->header_size))
+    {
+        std::cerr << "[!] NFA image checksum mismatch (corrupted file)\n";
+        return false;
+    }
+
+    const size_t descriptors_size = sizeof(image_header_s)
+        + header->n_criteria * sizeof(image_criterion_s) + n_memories * sizeof(image_memory_s)
+        + ((header->flags & C_IMAGE_FLAG_VALUE_SETS) ? sizeof(image_sets_s) : 0);
+    if (descriptors_size > header->header_size)
+    {
+        std::cerr << "[!] NFA image descriptors exceed its header\n";
+        return false;
+    }
+
+    const image_criterion_s* criteria =
+        reinterpret_cast<const image_criterion_s*>(image + sizeof(image_header_s));
+    const image_memory_s* descriptors =
+        reinterpret_cast<const image_memory_s*>(criteria + header->n_criteria);
+    const image_sets_s* sets_descriptor = (header->flags & C_IMAGE_FLAG_VALUE_SETS)
+        ? reinterpret_cast<const image_sets_s*>(descriptors + header->n_memories) : NULL;
+    if (sets_descriptor != NULL)
+    {
+        // 64-bit sizes: n_sets + 1 bounds wrap around in 32 bits
+        const uint64_t sets_size = ((uint64_t)sets_descriptor->n_sets + 1) * sizeof(uint32_t)
+                                 + (uint64_t)sets_descriptor->n_values * sizeof(operand_t);
+        if (sets_descriptor->offset > size || sets_size > size - sets_descriptor->offset)
+        {
+            std::cerr << "[!] NFA image value sets exceed the image (" << sets_descriptor->n_sets
+                      << " sets of " << sets_descriptor->n_values << " values)\n";
+            return false;
+        }
+        // the bounds must be ascending and end at the members, which the engine searches unchecked
+        const uint32_t* bounds = reinterpret_cast<const uint32_t*>(image + sets_descriptor->offset);
+        bool valid = bounds[0] == 0 && bounds[sets_descriptor->n_sets] == sets_descriptor->n_values;
+        for (uint64_t set = 0; valid && set < sets_descriptor->n_sets; set++)
+            valid = bounds[set] <= bounds[set + 1];
+        if (!valid)
+        {
+            std::cerr << "[!] NFA image value sets have inconsistent bounds\n";
+            return false;
+        }
+    }
+
+    // the memories must lie within the image and hold their transitions, with decodable widths
+    for (uint16_t level=0; level<n_memories; level++)
+    {
+        const image_memory_s& descriptor = descriptors[level];
+        const uint32_t width = 2 * descriptor.operand_width + descriptor.pointer_width + 1;
+        const bool described = header->version == C_IMAGE_VERSION_DESCRIBED;
+        bool valid = described
+            || (descriptor.operand_width > 0 && descriptor.operand_width <= 8 * sizeof(edge_s::operand_a)
+                && descriptor.pointer_width > 0 && descriptor.pointer_width <= 31
+                && descriptor.slots_per_word > 0 && descriptor.slots_per_word * width <= 8 * sizeof(transition_t));
+        const uint64_t n_words = (!valid) ? 0 : (described) ? descriptor.n_transitions
+            : ((uint64_t)descriptor.n_transitions + descriptor.slots_per_word - 1) / descriptor.slots_per_word;
+        valid = valid && descriptor.offset <= size && descriptor.size <= size - descriptor.offset
+                && n_words * sizeof(transition_t) <= descriptor.size;
+        if (!valid)
+        {
+            std::cerr << "[!] NFA image memory " << level << " does not match its descriptor ("
+                      << descriptor.n_transitions << " transitions of " << (uint32_t)descriptor.operand_width
+                      << "/" << (uint32_t)descriptor.pointer_width << "-bit fields, "
+                      << (uint32_t)descriptor.slots_per_word << " per word, in " << descriptor.size
+                      << " bytes at " << descriptor.offset << ")\n";
+            return false;
+        }
+    }
+    if (!configure_engine(criteria, header->n_criteria, &nfa->params, reference))
+        return false;
+    nfa->hash = header->hash;
+    nfa->version = header->version;
+    nfa->raw_size = size - header->header_size;
+
+    for (uint16_t level=0; level<n_memories; level++)
+    {
+        const image_memory_s& descriptor = descriptors[level];
+        const transition_t* words = reinterpret_cast<const transition_t*>(image + descriptor.offset);
+        nfa->levels[level] = (edge_s*) malloc(descriptor.n_transitions * sizeof(edge_s));
+        if (header->version == C_IMAGE_VERSION_DESCRIBED)
+        {
+            for (uint32_t i=0; i<descriptor.n_transitions; i++)
+                decode_fixed_edge(words[i], &nfa->levels[level][i]);
+            continue;
+        }
+
+        // packed memories: each with its own field widths
+        const uint8_t width = 2 * descriptor.operand_width + descriptor.pointer_width + 1;
+        const transition_t mask_operand = generate_mask(descriptor.operand_width);
+        const transition_t mask_pointer = generate_mask(descriptor.pointer_width);
+        for (uint32_t i=0; i<descriptor.n_transitions; i++)
+        {
+            const transition_t packed = words[i / descriptor.slots_per_word]
+                                     >> ((i % descriptor.slots_per_word) * width);
+            nfa->levels[level][i].operand_a = packed & mask_operand;
+            nfa->levels[level][i].operand_b = (packed >> descriptor.operand_width) & mask_operand;
+            nfa->levels[level][i].pointer = (packed >> (2 * descriptor.operand_width)) & mask_pointer;
+            nfa->levels[level][i].last = (packed >> (2 * descriptor.operand_width + descriptor.pointer_width)) & 1;
+        }
+    }
+
+    nfa->n_origin = get_origin_size(nfa->levels[0], descriptors[0].n_transitions);
+
+    // pointers are absolute: every level addresses the same memory
+    for (uint16_t level=n_memories; level<CFG_ENGINE_NCRITERIA; level++)
+        nfa->levels[level] = (nfa->depth_first) ? nfa->levels[0] : NULL;
+
+    if (sets_descriptor != NULL)
+    {
+        const uint32_t* bounds = reinterpret_cast<const uint32_t*>(image + sets_descriptor->offset);
+        nfa->sets.n_sets = sets_descriptor->n_sets;
+        const size_t bounds_size = ((size_t)sets_descriptor->n_sets + 1) * sizeof(uint32_t);
+        const size_t values_size = (size_t)sets_descriptor->n_values * sizeof(operand_t);
+        nfa->sets.first = (uint32_t*) malloc(bounds_size);
+        nfa->sets.values = (operand_t*) malloc(values_size);
+        memcpy(nfa->sets.first, bounds, bounds_size);
+        memcpy(nfa->sets.values, image + sets_descriptor->offset + bounds_size, values_size);
+    }
+    return true;
+}
+
+nfa_image_s* load_nfa_image(const char* fullpath_nfadata, const bool& depth_first,
+                            const engine_params_s* reference, const bool& disjoint)
+{
+    std::ifstream file_nfadata(fullpath_nfadata, std::ios::in | std::ios::binary);
+    if(!file_nfadata.is_open())
+        return NULL;
+
+    nfa_image_s* nfa = new nfa_image_s;
+    nfa->depth_first = depth_first;
+    nfa->version = C_IMAGE_VERSION_FIXED;
+    nfa->sets = value_sets_s{0, NULL, NULL};
+
+    file_nfadata.read(reinterpret_cast<char *>(&nfa->hash), sizeof(nfa->hash));
+
+    if (nfa->hash == C_IMAGE_MAGIC)
+    {
+        file_nfadata.seekg(0, std::ios::end);
+        std::vector<char> image((size_t)file_nfadata.tellg());
+        file_nfadata.seekg(0, std::ios::beg);
+        file_nfadata.read(image.data(), image.size());
+        file_nfadata.close();
+
+        if (!read_described_nfa_image(image.data(), image.size(), nfa, reference))
+        {
+            delete nfa;
+            return NULL;
+        }
+        return nfa;
+    }
+
+    // headerless images run the engine parameters in use
+    if (reference != NULL && reference->n_levels != CFG_ENGINE_NCRITERIA)
+    {
+        std::cerr << "[!] Headerless image of " << CFG_ENGINE_NCRITERIA << " criteria, the engine runs "
+                  << reference->n_levels << " criteria\n";
+        delete nfa;
+        return NULL;
+    }
+    nfa->params = (reference != NULL) ? *reference : default_engine_params(disjoint);
+    if (depth_first)
+    {
+        // pointers are absolute: every level addresses the same memory
+        const uint32_t n_edges = read_nfa_edges(&file_nfadata, &nfa->levels[0]);
+        nfa->n_origin = get_origin_size(nfa->levels[0], n_edges);
+        for (uint16_t level=1; level<CFG_ENGINE_NCRITERIA; level++)
+            nfa->levels[level] = nfa->levels[0];
+    }
+    else
+    {
+        nfa->n_origin = read_nfa_edges(&file_nfadata, &nfa->levels[0]);
+        for (uint16_t level=1; level<CFG_ENGINE_NCRITERIA; level++)
+            read_nfa_edges(&file_nfadata, &nfa->levels[level]);
+    }
+    if (!file_nfadata.good())
+    {
+        std::cerr << "[!] Headerless image shorter than the " << CFG_ENGINE_NCRITERIA
+                  << " memories of the reference type: export a self-describing image"
+                  << " (erbium -v 2 or 3)\n";
+        free_nfa_image(nfa);
+        return NULL;
+    }
+    file_nfadata.seekg(0, std::ios::end);
+    nfa->raw_size = ((uint32_t)file_nfadata.tellg()) - sizeof(nfa->hash);
+    file_nfadata.close();
+
+    return nfa;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// ENGINE                                                                                         //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Engine::Engine(const uint16_t& n_threads, const bool& disjoint) :
+    m_pool(std::max(n_threads, (uint16_t)1)),
+    m_disjoint(disjoint),
+    m_depth_first(false),
+    m_query_offset(0),
+    m_control(m_pool.size()),
+    m_route(UINT16_MAX + 1, -1),
+    m_next(0)
+{
+}
+
+Engine::~Engine()
+{
+    // the query threads outlive the images (m_pool is destroyed last): drain the pending batches
+    for_each_thread([](const uint16_t&) {});
+    for (auto& shard : m_shards)
+        delete shard.handle;
+}
+
+bool Engine::add_shard(nfa_image_s* nfa, const uint16_t& first, const uint16_t& last, const uint16_t& base)
+{
+    if (m_shards.size() > INT16_MAX)
+    {
+        std::cerr << "[!] Too many images for one engine\n";
+        free_nfa_image(nfa);
+        return false;
+    }
+    if (m_shards.empty())
+        m_reference = nfa->params;
+
+    shard_s shard;
+    shard.first = first;
+    shard.last = last;
+    shard.base = base;
+    // one reader slot per query thread, plus the caller one
+    shard.handle = new NfaHandle(nfa, m_pool.size() + 1);
+    for (uint32_t key = first; key <= last; key++)
+        m_route[key] = m_shards.size();
+    m_shards.push_back(shard);
+    return true;
+}
+
+bool Engine::load_image(const std::string& filename, const bool& depth_first)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_shards.empty())
+    {
+        std::cerr << "[!] The engine already runs an NFA\n";
+        return false;
+    }
+    nfa_image_s* nfa = load_nfa_image(filename.c_str(), depth_first, NULL, m_disjoint);
+    if (nfa == NULL)
+        return false;
+    m_depth_first = depth_first;
+    return add_shard(nfa, 0, UINT16_MAX, 0);
+}
+
+// routing table of erbium -k: shard,first_id,last_id,image,image_dfs (paths relative to the table)
+bool Engine::load_shards(const std::string& filename, const bool& depth_first)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ifstream file_routing(filename);
+    if (!file_routing.is_open() || !m_shards.empty())
+        return false;
+
+    const std::string folder = filename.substr(0, filename.find_last_of('/') + 1);
+    m_depth_first = depth_first;
+
+    std::string line;
+    std::getline(file_routing, line); // header
+    while (std::getline(file_routing, line))
+    {
+        std::stringstream fields(line);
+        std::string shard_id, first, last, image, image_dfs;
+        std::getline(fields, shard_id, ',');
+        std::getline(fields, first, ',');
+        std::getline(fields, last, ',');
+        std::getline(fields, image, ',');
+        std::getline(fields, image_dfs, ',');
+
+        nfa_image_s* nfa = load_nfa_image((folder + ((depth_first) ? image_dfs : image)).c_str(),
+                                          depth_first, (m_shards.empty()) ? NULL : &m_reference,
+                                          m_disjoint);
+        if (nfa == NULL)
+        {
+            std::cerr << "[!] Failed to open NFA .bin file of shard " << shard_id << std::endl;
+            return false;
+        }
+        if (!add_shard(nfa, atoi(first.c_str()), atoi(last.c_str()), atoi(first.c_str())))
+            return false;
+    }
+    return !m_shards.empty();
+}
+
+// bundle of erbium -g: one image per rule type, each with its own engine parameters
+bool Engine::load_bundle(const std::string& filename, const bool& depth_first)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ifstream file_bundle(filename, std::ios::in | std::ios::binary);
+    if (!file_bundle.is_open() || !m_shards.empty())
+        return false;
+
+    file_bundle.seekg(0, std::ios::end);
+    std::vector<char> bundle((size_t)file_bundle.tellg());
+    file_bundle.seekg(0, std::ios::beg);
+    file_bundle.read(bundle.data(), bundle.size());
+    file_bundle.close();
+
+    const bundle_header_s* header = reinterpret_cast<const bundle_header_s*>(bundle.data());
+    if (bundle.size() < sizeof(bundle_header_s) || header->magic != C_BUNDLE_MAGIC
+        || header->version != C_BUNDLE_VERSION
+        || bundle.size() < sizeof(bundle_header_s) + header->n_images * sizeof(bundle_entry_s))
+    {
+        std::cerr << "[!] Not a bundle of NFA images (version " << C_BUNDLE_VERSION << ")\n";
+        return false;
+    }
+    m_depth_first = depth_first;
+    m_query_offset = 1;
+
+    const bundle_entry_s* entries = reinterpret_cast<const bundle_entry_s*>(header + 1);
+    for (uint32_t k = 0; k < header->n_images; k++)
+    {
+        const bundle_entry_s& entry = entries[k];
+        nfa_image_s* nfa = new nfa_image_s;
+        nfa->depth_first = depth_first;
+        nfa->sets = value_sets_s{0, NULL, NULL};
+        if (entry.offset + entry.size > bundle.size()
+            || !read_described_nfa_image(bundle.data() + entry.offset, entry.size, nfa, NULL))
+        {
+            std::cerr << "[!] Failed to decode the NFA image of rule type " << entry.rule_type << std::endl;
+            delete nfa;
+            return false;
+        }
+        if (!add_shard(nfa, entry.rule_type, entry.rule_type, 0))
+            return false;
+    }
+    return !m_shards.empty();
+}
+
+bool Engine::update_image(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_shards.size() != 1 || m_query_offset != 0)
+    {
+        std::cerr << "[!] Hot-swap is not supported with sharded or bundled images\n";
+        return false;
+    }
+    nfa_image_s* nfa = load_nfa_image(filename.c_str(), m_depth_first, &m_reference, m_disjoint);
+    if (nfa == NULL)
+    {
+        std::cerr << "[!] Failed to open NFA .bin file " << filename << std::endl;
+        return false;
+    }
+    m_shards[0].handle->publish(nfa);
+    return true;
+}
+
+void Engine::get_image_info(const uint16_t& image, uint64_t* hash, uint32_t* version,
+                            uint32_t* raw_size, uint64_t* swaps)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const nfa_image_s* nfa = m_shards[image].handle->pin(m_control);
+    *hash = nfa->hash;
+    *version = nfa->version;
+    *raw_size = nfa->raw_size;
+    *swaps = m_shards[image].handle->get_version();
+    m_shards[image].handle->unpin(m_control);
+}
+
+void Engine::run(const uint16_t& reader, const operand_t* queries, const uint32_t& n_queries,
+                 result_s* results) const
+{
+    const uint16_t width = get_query_width();
+    for (uint32_t query = 0; query < n_queries; query++)
+    {
+        const operand_t* the_query = &queries[query * width];
+        const operand_t* criteria = the_query + m_query_offset;
+        results[query].weight = 0;
+        results[query].pointer = 0;
+
+        const int16_t shard = m_route[the_query[0]];
+        if (shard < 0)
+            continue;
+        const nfa_image_s* nfa = m_shards[shard].handle->pin(reader);
+        const uint32_t pointer = (uint32_t)criteria[0] - m_shards[shard].base;
+        // values beyond the first level of the image (e.g. unknown to its dictionnary) match nothing
+        if (pointer < nfa->n_origin)
+            compute(nfa,
+                    criteria,
+                    0, // level
+                    pointer,
+                    0, // interim
+                    &results[query]);
+        m_shards[shard].handle->unpin(reader);
+        #ifdef EXEC_DEBUG
+        std::cout << query << " " << results[query].pointer << std::endl;
+        #endif
+    }
+}
+
+std::future<bool> Engine::submit(const span_s<const operand_t>& queries, const span_s<result_s>& results)
+{
+    // the last chunk to finish fulfils the promise
+    struct batch_s {
+        std::promise<bool>    done;
+        std::atomic<uint16_t> pending;
+    };
+    std::shared_ptr<batch_s> batch = std::make_shared<batch_s>();
+    std::future<bool> future = batch->done.get_future();
+
+    if (m_shards.empty() || queries.size != results.size * get_query_width())
+    {
+        std::cerr << "[!] Batch of " << queries.size << " operands for " << results.size
+                  << " results (queries of " << get_query_width() << " operands)\n";
+        batch->done.set_value(false);
+        return future;
+    }
+    if (results.size == 0)
+    {
+        batch->done.set_value(true);
+        return future;
+    }
+
+    // contiguous chunks, one per query thread (static schedule)
+    const uint32_t n_queries = results.size;
+    const uint16_t n_chunks = std::min((uint32_t)m_pool.size(), n_queries);
+    const uint16_t width = get_query_width();
+    batch->pending.store(n_chunks);
+    for (uint16_t chunk = 0; chunk < n_chunks; chunk++)
+    {
+        const uint32_t first = (uint64_t)n_queries * chunk / n_chunks;
+        const uint32_t last = (uint64_t)n_queries * (chunk + 1) / n_chunks;
+        const operand_t* chunk_queries = &queries.data[first * width];
+        result_s* chunk_results = &results.data[first];
+        m_pool.submit(chunk, [this, batch, chunk, chunk_queries, chunk_results, first, last]() {
+            run(chunk, chunk_queries, last - first, chunk_results);
+            if (batch->pending.fetch_sub(1) == 1)
+                batch->done.set_value(true);
+        });
+    }
+    return future;
+}
+
+bool Engine::match_batch(const span_s<const operand_t>& queries, const span_s<result_s>& results)
+{
+    return submit(queries, results).get();
+}
+
+result_s Engine::match(const operand_t* query)
+{
+    result_s result;
+    result.weight = 0;
+    result.pointer = 0;
+    if (m_shards.empty())
+        return result;
+
+    std::promise<void> done;
+    std::future<void> ready = done.get_future();
+    const uint16_t reader = m_next.fetch_add(1) % m_pool.size();
+    m_pool.submit(reader, [this, reader, query, &result, &done]() {
+        run(reader, query, 1, &result);
+        done.set_value();
+    });
+    ready.wait();
+    return result;
+}
+
+void Engine::for_each_thread(const std::function<void(const uint16_t&)>& task)
+{
+    std::vector<std::future<void>> pending;
+    for (uint16_t i = 0; i < m_pool.size(); i++)
+    {
+        std::shared_ptr<std::promise<void>> done = std::make_shared<std::promise<void>>();
+        pending.push_back(done->get_future());
+        m_pool.submit(i, [i, done, &task]() {
+            task(i);
+            done->set_value();
+        });
+    }
+    for (auto& future : pending)
+        future.wait();
+}
+
+} // namespace cpu
+} // namespace erbium
@@ -0,0 +1,118 @@
+#ifndef ERBIUM_CPU_ENGINE_H
+#define ERBIUM_CPU_ENGINE_H
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "definitions.h"
+#include "nfa_handle.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace erbium {
+namespace cpu {
+
+// contiguous view of the queries or the results of a batch (std::span is C++20)
+template <typename T>
+struct span_s
+{
+    T*     data;
+    size_t size;
+};
+
+// queries are routed to the image of their shard: by the value of their first criterion (shards
+// of erbium -k) or by their rule type id (bundles of erbium -g)
+struct shard_s {
+    uint16_t   first; // routing key range
+    uint16_t   last;
+    uint16_t   base;  // value id of the first criterion at the first origin transition
+    NfaHandle* handle;
+};
+
+// Reentrant matching engine: owns its NFA images (one image, the shards of erbium -k or the bundle
+// of erbium -g) and a pool of query threads. Engines share no state, so several of them (different
+// NFAs) live in one process. Queries are get_query_width() operands: the rule type id for bundles,
+// then the value ids of the criteria.
+class Engine
+{
+  public:
+    // disjoint: strict match on the pair levels of headerless images (compiled with erbium -n)
+    Engine(const uint16_t& n_threads, const bool& disjoint = false);
+    ~Engine();
+
+    // one of them, before any query
+    bool load_image(const std::string& filename, const bool& depth_first = false);
+    bool load_shards(const std::string& filename, const bool& depth_first = false);
+    bool load_bundle(const std::string& filename, const bool& depth_first = false);
+
+    // hot-swaps the image of a single-image engine under load (same engine parameters)
+    bool update_image(const std::string& filename);
+
+    // one query, on a query thread (batches amortise the hand-over)
+    result_s match(const operand_t* query);
+    // queries.size is n_queries * get_query_width() operands, results.size is n_queries
+    bool match_batch(const span_s<const operand_t>& queries, const span_s<result_s>& results);
+    // the buffers must outlive the future, which tells whether the batch ran
+    std::future<bool> submit(const span_s<const operand_t>& queries, const span_s<result_s>& results);
+
+    // runs the task once on each query thread and waits (e.g. thread-local hardware counters)
+    void for_each_thread(const std::function<void(const uint16_t&)>& task);
+
+    uint16_t get_query_width() const { return m_query_offset + CFG_ENGINE_NCRITERIA; }
+    uint16_t get_n_threads() const { return m_pool.size(); }
+    uint16_t get_n_images() const { return m_shards.size(); }
+    bool     is_bundle() const { return m_query_offset != 0; }
+    // hash, version and size of the current image of a shard (or rule type)
+    void     get_image_info(const uint16_t& image, uint64_t* hash, uint32_t* version,
+                            uint32_t* raw_size, uint64_t* swaps);
+
+  private:
+    bool add_shard(nfa_image_s* nfa, const uint16_t& first, const uint16_t& last, const uint16_t& base);
+    void run(const uint16_t& reader, const operand_t* queries, const uint32_t& n_queries,
+             result_s* results) const;
+
+    ThreadPool             m_pool;
+    engine_params_s        m_reference;    // of the first image (shards and updates must match)
+    bool                   m_disjoint;
+    bool                   m_depth_first;
+    uint16_t               m_query_offset; // in operands, before the first criterion
+    uint16_t               m_control;      // reader slot of the caller thread (under m_mutex)
+    std::mutex             m_mutex;        // images loading and updates
+    std::vector<shard_s>   m_shards;
+    std::vector<int16_t>   m_route;        // image of each routing key (-1 if none: no match)
+    std::atomic<uint32_t>  m_next;         // round-robin worker of single queries
+};
+
+// decodes an NFA image (versions 1 to 3); images of a rule type other than the first one must share
+// its engine parameters (reference)
+nfa_image_s* load_nfa_image(const char* fullpath_nfadata, const bool& depth_first,
+                            const engine_params_s* reference, const bool& disjoint = false);
+
+} // namespace cpu
+} // namespace erbium
+
+#endif // ERBIUM_CPU_ENGINE_H
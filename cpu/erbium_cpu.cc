@@ -20,312 +20,64 @@
 //  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+#include "engine.h"
+#include "query_encoder.h"
+
+#include <climits>
 #include <cstring>
 #include <string>
 #include <fstream>
 #include <iostream>
 #include <chrono>
-#include <omp.h>
+#include <atomic>
+#include <thread>
+#include <vector>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>     // parameters
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
-//#define EXEC_DEBUG true
-//#define DETERMINISTIC true
-#define CFG_ENGINE_NCRITERIA 22
+using erbium::cpu::operand_t;
+using erbium::cpu::result_s;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// SW / HW CONSTRAINTS                                                                            //
+// LLC MISSES                                                                                     //
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// raw criterion value (must be consistent with kernel_<shell>.cpp and engine_pkg.vhd)
-typedef uint16_t  operand_t;
-
-// raw NFA transition (to be stored in ultraRam)
-typedef uint64_t  transition_t;
-
-
-// create binary masks for n-bit wise field
-constexpr transition_t generate_mask(int n)
+// hardware counter of the calling thread; -1 if perf events are not available
+int open_llc_counter()
 {
-    return n <= 1 ? 1 : (1 + (generate_mask(n-1) << 1));
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_LL
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    const int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd >= 0)
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    return fd;
 }
 
-// raw cacheline size (must be consistent with kernel_<shell>.cpp and erbium_wrapper.vhd)
-const unsigned char C_CACHELINE_SIZE = 64; // in bytes
-
-// used for determining zero-padding
-const uint16_t C_EDGES_PER_CACHE_LINE = C_CACHELINE_SIZE / sizeof(transition_t);
-
-// actual size of a criterion value (must be consistent with engine_pkg.vhd)
-const uint16_t CFG_CRITERION_VALUE_WIDTH = 13; // in bits
-
-// actual size of an address pointer (must be consistent with engine_pkg.vhd)
-const uint16_t CFG_TRANSITION_POINTER_WIDTH = 16; // in bits
-
-// maximum number of transitions able to stored in one memory unit
-const uint32_t CFG_MEM_MAX_DEPTH = (1 << (CFG_TRANSITION_POINTER_WIDTH + 1)) - 1;
-
-const transition_t MASK_POINTER  = generate_mask(CFG_TRANSITION_POINTER_WIDTH);
-const transition_t MASK_OPERANDS = generate_mask(CFG_CRITERION_VALUE_WIDTH);
-
-// shift constants to align fields to a transition memory line
-const char SHIFT_OPERAND_A = 0;
-const char SHIFT_OPERAND_B = CFG_CRITERION_VALUE_WIDTH + SHIFT_OPERAND_A;
-const char SHIFT_POINTER   = CFG_CRITERION_VALUE_WIDTH + SHIFT_OPERAND_B;
-const char SHIFT_LAST      = CFG_TRANSITION_POINTER_WIDTH + SHIFT_POINTER;
-
-////////////////////////////////////////////////////////////////////////////////////////////////////
-// CPU DEFINITIONS                                                                                //
-////////////////////////////////////////////////////////////////////////////////////////////////////
-
-enum MatchStructureType {STRCT_SIMPLE, STRCT_PAIR};
-enum MatchPairFunction {FNCTR_PAIR_NOP, FNCTR_PAIR_AND, FNCTR_PAIR_OR, FNCTR_PAIR_XOR, FNCTR_PAIR_NAND, FNCTR_PAIR_NOR};
-enum MatchSimpFunction {FNCTR_SIMP_NOP, FNCTR_SIMP_EQU, FNCTR_SIMP_NEQ, FNCTR_SIMP_GRT, FNCTR_SIMP_GEQ, FNCTR_SIMP_LES, FNCTR_SIMP_LEQ};
-enum MatchModeType {MODE_STRICT_MATCH, MODE_FULL_ITERATION};
-
-const uint32_t WEIGHTS[CFG_ENGINE_NCRITERIA] = {
-    0, 0, 0, 512, 524288, 65536, 64, 128, 131072, 16, 16384, 2, 4, 4096, 2048, 32768, 32, 8192, 8,
-    1, 262144, 256
-};
-
-const MatchStructureType STRUCT_TYPE[CFG_ENGINE_NCRITERIA] = {
-    STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE,
-    STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE,
-    STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_SIMPLE, STRCT_PAIR, STRCT_PAIR,
-    STRCT_PAIR
-};
-
-const MatchPairFunction FUNCT_PAIR[CFG_ENGINE_NCRITERIA] = {
-    FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP,
-    FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP,
-    FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP, FNCTR_PAIR_NOP,
-    FNCTR_PAIR_NOP, FNCTR_PAIR_AND, FNCTR_PAIR_AND, FNCTR_PAIR_AND
-};
-
-const MatchSimpFunction FUNCT_A[CFG_ENGINE_NCRITERIA] = {
-    FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU,
-    FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU,
-    FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU, FNCTR_SIMP_EQU,
-    FNCTR_SIMP_EQU, FNCTR_SIMP_GEQ, FNCTR_SIMP_GEQ, FNCTR_SIMP_GEQ
-};
-
-const MatchSimpFunction FUNCT_B[CFG_ENGINE_NCRITERIA] = {
-    FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP,
-    FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP,
-    FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP, FNCTR_SIMP_NOP,
-    FNCTR_SIMP_NOP, FNCTR_SIMP_LEQ, FNCTR_SIMP_LEQ, FNCTR_SIMP_LEQ
-};
-
-const bool WILDCARD_EN[CFG_ENGINE_NCRITERIA] = {
-    false, false, false, true, true, true, true, true, true, true, true, true, true, true, true,
-    true, true, true, true, true, true, true
-};
-
-struct edge_s {
-    uint16_t operand_a;
-    uint16_t operand_b;
-    uint16_t pointer;
-    bool last;
-};
-
-struct result_s {
-    uint32_t weight;
-    uint16_t pointer;
-};
-
-struct level_s {
-    uint32_t weight;
-    uint64_t base;
-};
-
-edge_s*   the_memory[CFG_ENGINE_NCRITERIA];
-
-bool functor(const MatchSimpFunction& G_FUNCTION,
-             const bool& G_WILDCARD,
-             const uint16_t& rule_i,
-             const uint16_t& query_i,
-             bool* wildcard_o)
+// sum of the counters of all the query threads; -1 if any of them is not available
+int64_t read_llc_counters(const std::vector<int>& counters)
 {
-    bool sig_result;
-
-    switch(G_FUNCTION)
+    int64_t total = 0;
+    uint64_t count;
+    for (auto& fd : counters)
     {
-      case FNCTR_SIMP_EQU:
-            sig_result = query_i == rule_i;
-            break;
-      case FNCTR_SIMP_NEQ:
-            sig_result = query_i != rule_i;
-            break;
-      case FNCTR_SIMP_GRT:
-            sig_result = query_i > rule_i;
-            break;
-      case FNCTR_SIMP_GEQ:
-            sig_result = query_i >= rule_i;
-            break;
-      case FNCTR_SIMP_LES:
-            sig_result = query_i < rule_i;
-            break;
-      case FNCTR_SIMP_LEQ:
-            sig_result = query_i <= rule_i;
-            break;
-      default:
-            sig_result = false;
-    }
-
-    if (G_WILDCARD and G_FUNCTION != FNCTR_SIMP_NOP)
-    {
-        *wildcard_o = (rule_i == 0);
-        sig_result = *wildcard_o or sig_result;
+        if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+            return -1;
+        total += count;
     }
-    else
-    {
-        *wildcard_o = false;
-        sig_result = sig_result;
-    }
-
-    return sig_result;
-}
-
-bool matcher(const MatchStructureType& G_STRUCTURE,
-             const MatchSimpFunction& G_FUNCTION_A,
-             const MatchSimpFunction& G_FUNCTION_B,
-             const MatchPairFunction& G_FUNCTION_PAIR,
-             const bool& G_WILDCARD,
-             const uint16_t& op_query_i,
-             const uint16_t& opA_rule_i,
-             const uint16_t& opB_rule_i,
-             bool* wildcard_o)
-{
-    bool sig_functorA;
-    bool sig_functorB;
-    bool sig_wildcard_a;
-    bool sig_wildcard_b;
-    bool sig_mux_pair;
-
-    sig_functorA = functor(G_FUNCTION_A, G_WILDCARD, opA_rule_i, op_query_i, &sig_wildcard_a);
-
-    bool match_result_o;
-    switch (G_STRUCTURE)
-    {
-      case STRCT_SIMPLE:
-            *wildcard_o = sig_wildcard_a;
-            match_result_o = sig_functorA;
-            break;
-      case STRCT_PAIR:
-            sig_functorB = functor(G_FUNCTION_B, G_WILDCARD, opB_rule_i, op_query_i, &sig_wildcard_b);
-
-            *wildcard_o = sig_wildcard_a or sig_wildcard_b;
-
-            switch (G_FUNCTION_PAIR)
-            {
-              case FNCTR_PAIR_AND:
-                    sig_mux_pair = sig_functorA && sig_functorB;
-                    break;
-              case FNCTR_PAIR_OR:
-                    sig_mux_pair = sig_functorA || sig_functorB;
-                    break;
-              case FNCTR_PAIR_XOR:
-                    sig_mux_pair = sig_functorA ^ sig_functorB;
-                    break;
-              case FNCTR_PAIR_NAND:
-                    sig_mux_pair = !(sig_functorA && sig_functorB);
-                    break;
-              case FNCTR_PAIR_NOR:
-                    sig_mux_pair = !(sig_functorA || sig_functorB);
-                    break;
-              default:
-                    sig_mux_pair = false;
-            }
-            match_result_o = sig_mux_pair;
-            break;
-      default:
-            match_result_o = false;;
-    }
-
-    return match_result_o;
-}
-
-void compute(const uint16_t* query, const uint16_t level, uint16_t pointer, const uint32_t interim,
-             result_s* result)
-{
-    uint32_t aux_interim;
-    bool wildcard;
-    bool match;
-
-    #ifdef DETERMINISTIC
-    bool has_match = false;
-    uint16_t wildcard_pointer;
-    #endif
-    do
-    {
-        match =  matcher(STRUCT_TYPE[level], FUNCT_A[level], FUNCT_B[level], FUNCT_PAIR[level],
-            WILDCARD_EN[level], *query,
-            the_memory[level][pointer].operand_a,
-            the_memory[level][pointer].operand_b,
-            &wildcard);
-
-        if (!match)
-            continue;
-
-        #ifdef DETERMINISTIC
-        if (wildcard)
-        {
-            wildcard_pointer = pointer;
-            has_match = true;
-            match = false;
-            continue;
-        }
-        #endif
-
-        // weight
-        if (wildcard)
-            aux_interim = interim;
-        else
-            aux_interim = interim + WEIGHTS[level];
-
-        // check pointer or result
-        if (level == CFG_ENGINE_NCRITERIA - 1)
-        {
-            if (aux_interim >= result->weight)
-            {
-                //if ((aux_interim == result->weight) && (result->pointer != the_memory[level][pointer].pointer))
-                //    std::cout << "Weird\n";
-                result->weight = aux_interim;
-                result->pointer = the_memory[level][pointer].pointer;
-                #ifdef EXEC_DEBUG
-                std::cout << " level=" << level << "query=" << *query
-                          << " opA=" << the_memory[level][pointer].operand_a
-                          << " opB=" << the_memory[level][pointer].operand_b
-                          << " pointer=" << the_memory[level][pointer].pointer
-                          << " weight=" << aux_interim << std::endl;
-                #endif
-            }
-        }
-        else
-        {
-            #ifdef EXEC_DEBUG
-            std::cout << " level=" << level << "query=" << *query
-                      << " opA=" << the_memory[level][pointer].operand_a
-                      << " opB=" << the_memory[level][pointer].operand_b
-                      << " pointer=" << the_memory[level][pointer].pointer
-                      << " weight=" << aux_interim << std::endl;
-            #endif
-            compute(query+1, level+1, the_memory[level][pointer].pointer, aux_interim, result);
-        }
-    #ifdef DETERMINISTIC
-    } while(!the_memory[level][pointer++].last & !match);
-    if (has_match && level == CFG_ENGINE_NCRITERIA - 1)
-    {
-        result->weight = interim;
-        result->pointer = the_memory[level][wildcard_pointer].pointer;
-    }
-    else if (has_match)
-        compute(query+1, level+1, the_memory[level][wildcard_pointer].pointer, interim, result);
-    #else
-    } while(!the_memory[level][pointer++].last);
-    #endif
+    return total;
 }
 
 int main(int argc, char** argv)
@@ -340,18 +92,44 @@ int main(int argc, char** argv)
     char* fullpath_nfadata = NULL;
     char* fullpath_results = NULL;
     char* fullpath_benchmark = NULL;
+    char* fullpath_update = NULL;
+    char* fullpath_routing = NULL;
+    char* fullpath_bundle = NULL;
+    char* fullpath_encoder = NULL;
+    char* fullpath_raw = NULL;
+    uint32_t swap_period = 100; // in ms
     uint32_t max_batch_size = 1<<10;
     uint32_t min_batch_size = 1;
     uint32_t iterations = 100;
     uint16_t cores_number = 1;
+    bool depth_first = false;
+    bool disjoint = false;
 
     char opt;
-    while ((opt = getopt(argc, argv, "k:f:hi:m:n:o:r:w:")) != -1) {
+    while ((opt = getopt(argc, argv, "b:d:e:k:f:hi:l:m:n:o:p:q:r:s:u:w:")) != -1) {
         switch (opt) {
+        case 'b':
+            fullpath_bundle = (char*) malloc(strlen(optarg)+1);
+            strcpy(fullpath_bundle, optarg);
+            break;
+        case 'd':
+            disjoint = atoi(optarg) == 1;
+            break;
+        case 'l':
+            depth_first = atoi(optarg) == 1;
+            break;
         case 'n':
             fullpath_nfadata = (char*) malloc(strlen(optarg)+1);
             strcpy(fullpath_nfadata, optarg);
             break;
+        case 'e':
+            fullpath_encoder = (char*) malloc(strlen(optarg)+1);
+            strcpy(fullpath_encoder, optarg);
+            break;
+        case 'q':
+            fullpath_raw = (char*) malloc(strlen(optarg)+1);
+            strcpy(fullpath_raw, optarg);
+            break;
         case 'w':
             fullpath_workload = (char*) malloc(strlen(optarg)+1);
             strcpy(fullpath_workload, optarg);
@@ -376,30 +154,69 @@ int main(int argc, char** argv)
         case 'k':
             cores_number = atoi(optarg);
             break;
+        case 'u':
+            fullpath_update = (char*) malloc(strlen(optarg)+1);
+            strcpy(fullpath_update, optarg);
+            break;
+        case 'p':
+            swap_period = atoi(optarg);
+            break;
+        case 's':
+            fullpath_routing = (char*) malloc(strlen(optarg)+1);
+            strcpy(fullpath_routing, optarg);
+            break;
         case 'h':
         default: /* '?' */
             std::cerr << "Usage: " << argv[0] << "\n"
                       << "\t-n  nfa_data_file\n"
+                      << "\t-s  shards_routing_table (shards.csv of erbium -k, instead of -n)\n"
+                      << "\t-b  nfa_bundle_file (mem_nfa_bundle.bin of erbium -g, instead of -n; workload\n"
+                      << "\t    benchmark_bundle.bin, queries led by their rule type id)\n"
+                      << "\t-l  nfa_layout: 0=level-major 1=depth-first (checked against the image header)\n"
+                      << "\t-d  pair_levels: 0=overlapping 1=disjoint (compiled with erbium -n, headerless images)\n"
                       << "\t-w  fullpath_workload\n"
+                      << "\t-q  raw_queries_file (CSV with a header of criterion codes, or JSON lines; encoded\n"
+                      << "\t    online instead of -w)\n"
+                      << "\t-e  encoder_prefix (of the dictionnary.csv and criteria.csv of erbium, e.g. build/)\n"
                       << "\t-r  result_data_file\n"
                       << "\t-o  benchmark_out_file\n"
                       << "\t-m  max_batch_size\n"
                       << "\t-f  first_batch_size\n"
                       << "\t-i  iterations\n"
                       << "\t-k  cores_number\n"
+                      << "\t-u  nfa_update_file (hot-swapped with nfa_data_file under load)\n"
+                      << "\t-p  swap_period in ms\n"
                       << "\t-h  help\n";
             return EXIT_FAILURE;
         }
     }
 
-    std::cout << "-n nfa_data_file: "      << fullpath_nfadata   << std::endl;
-    std::cout << "-w fullpath_workload: "  << fullpath_workload  << std::endl;
+    if (fullpath_bundle != NULL)
+        std::cout << "-b nfa_bundle_file: "    << fullpath_bundle    << std::endl;
+    else if (fullpath_routing != NULL)
+        std::cout << "-s shards_routing_table: " << fullpath_routing << std::endl;
+    else
+        std::cout << "-n nfa_data_file: "      << fullpath_nfadata   << std::endl;
+    std::cout << "-l nfa_layout: "         << ((depth_first) ? "depth-first" : "level-major") << std::endl;
+    std::cout << "-d pair_levels: "        << ((disjoint) ? "disjoint" : "overlapping") << std::endl;
+    if (fullpath_raw != NULL)
+    {
+        std::cout << "-q raw_queries_file: "   << fullpath_raw       << std::endl;
+        std::cout << "-e encoder_prefix: "     << ((fullpath_encoder != NULL) ? fullpath_encoder : "") << std::endl;
+    }
+    else
+        std::cout << "-w fullpath_workload: "  << fullpath_workload  << std::endl;
     std::cout << "-r result_data_file: "   << fullpath_results   << std::endl;
     std::cout << "-o benchmark_out_file: " << fullpath_benchmark << std::endl;
     std::cout << "-m max_batch_size: "     << max_batch_size     << std::endl;
     std::cout << "-f first_batch_size: "   << min_batch_size     << std::endl;
     std::cout << "-i iterations: "         << iterations         << std::endl;
     std::cout << "-c cores_number: "       << cores_number       << std::endl;
+    if (fullpath_update != NULL)
+    {
+        std::cout << "-u nfa_update_file: "    << fullpath_update    << std::endl;
+        std::cout << "-p swap_period: "        << swap_period        << " ms" << std::endl;
+    }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // NFA SETUP                                                                                  //
@@ -407,55 +224,51 @@ int main(int argc, char** argv)
 
     std::cout << "# NFA SETUP" << std::endl;
 
-    std::ifstream file_nfadata(fullpath_nfadata, std::ios::in | std::ios::binary);
-    if(file_nfadata.is_open())
+    erbium::cpu::Engine the_engine(cores_number, disjoint);
+    if (fullpath_update != NULL && (fullpath_bundle != NULL || fullpath_routing != NULL))
     {
-        uint32_t num_edges;
-        uint64_t raw_edge;
-        uint16_t padding;
-        uint64_t nfa_hash;
-
-        file_nfadata.read(reinterpret_cast<char *>(&nfa_hash), sizeof(nfa_hash));
-
-        for (uint16_t level=0; level<CFG_ENGINE_NCRITERIA; level++)
-        {
-            file_nfadata.read(reinterpret_cast<char *>(&raw_edge), sizeof(raw_edge));
-            num_edges = raw_edge;
-            the_memory[level] = (edge_s*) malloc(num_edges * sizeof(edge_s));
-            #ifdef EXEC_DEBUG
-            std::cout << " level=" << level << " edges=" << num_edges << std::endl;
-            #endif
-            for (uint32_t i=0; i<num_edges; i++)
-            {
-                file_nfadata.read(reinterpret_cast<char *>(&raw_edge), sizeof(raw_edge));
-                the_memory[level][i].operand_a = (raw_edge >> SHIFT_OPERAND_A) & MASK_OPERANDS;
-                the_memory[level][i].operand_b = (raw_edge >> SHIFT_OPERAND_B) & MASK_OPERANDS;
-                the_memory[level][i].pointer = (raw_edge >> SHIFT_POINTER) & MASK_POINTER;
-                the_memory[level][i].last = (raw_edge >> SHIFT_LAST) & 1;
-                #ifdef EXEC_DEBUG
-                std::cout << "level=" << level << " edge=" << i << " data=" << raw_edge << std::endl;
-                #endif
-            }
-            // Padding
-            padding = (num_edges + 1) % C_EDGES_PER_CACHE_LINE;
-            padding = (padding == 0) ? 0 : C_EDGES_PER_CACHE_LINE - padding;
-            file_nfadata.seekg(padding * sizeof(raw_edge), std::ios::cur);
-            #ifdef EXEC_DEBUG
-            std::cout << std::endl;
-            #endif
-        }
-        file_nfadata.seekg(0, std::ios::end);
-        const uint32_t raw_size = ((uint32_t)file_nfadata.tellg()) - sizeof(nfa_hash);
-        printf("> NFA size: %u bytes\n", raw_size);
-        printf("> NFA hash: %lu\n", nfa_hash);
-        file_nfadata.close();
+        std::cerr << "[!] Hot-swap is not supported with sharded or bundled images\n";
+        return EXIT_FAILURE;
     }
-    else
+    if (fullpath_bundle != NULL && !the_engine.load_bundle(fullpath_bundle, depth_first))
+    {
+        std::cerr << "[!] Failed to load the NFA bundle\n";
+        return EXIT_FAILURE;
+    }
+    if (fullpath_bundle == NULL && fullpath_routing != NULL
+        && !the_engine.load_shards(fullpath_routing, depth_first))
+    {
+        std::cerr << "[!] Failed to load the shards routing table\n";
+        return EXIT_FAILURE;
+    }
+    if (fullpath_bundle == NULL && fullpath_routing == NULL
+        && !the_engine.load_image(fullpath_nfadata, depth_first))
     {
         std::cerr << "[!] Failed to open NFA .bin file\n";
         return EXIT_FAILURE;
     }
 
+    uint64_t nfa_hash, nfa_swaps;
+    uint32_t nfa_version, nfa_size;
+    for (uint16_t image = 0; image < the_engine.get_n_images(); image++)
+    {
+        the_engine.get_image_info(image, &nfa_hash, &nfa_version, &nfa_size, &nfa_swaps);
+        printf("> NFA size: %u bytes (image version %u)\n", nfa_size, nfa_version);
+        printf("> NFA hash: %lu\n", nfa_hash);
+    }
+    if (fullpath_bundle != NULL)
+        printf("> Rule types: %u\n", the_engine.get_n_images());
+    else if (the_engine.get_n_images() > 1)
+        printf("> Shards: %u\n", the_engine.get_n_images());
+
+    // one LLC counter per query thread
+    std::vector<int> llc_counters(cores_number, -1);
+    the_engine.for_each_thread([&llc_counters](const uint16_t& thread) {
+        llc_counters[thread] = open_llc_counter();
+    });
+    if (read_llc_counters(llc_counters) < 0)
+        std::cout << "[!] LLC miss counters are not available (perf_event_open)\n";
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // WORKLOAD SETUP                                                                             //
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -465,8 +278,44 @@ int main(int argc, char** argv)
     uint32_t workload_size; // in queries
     uint32_t query_size;    // in bytes with padding
 
-    std::ifstream queries_file(fullpath_workload, std::ios::in | std::ios::binary);
-    if(queries_file.is_open())
+    std::ifstream queries_file((fullpath_raw != NULL) ? fullpath_raw : fullpath_workload,
+                               std::ios::in | std::ios::binary);
+    if (queries_file.is_open() && fullpath_raw != NULL)
+    {
+        if (fullpath_bundle != NULL || fullpath_encoder == NULL)
+        {
+            std::cerr << "[!] Raw queries need the encoder of their rule type (-e), bundles are not supported\n";
+            return EXIT_FAILURE;
+        }
+        erbium::cpu::QueryEncoder the_encoder;
+        if (!the_encoder.load(fullpath_encoder, (nfa_version == erbium::cpu::C_IMAGE_VERSION_PACKED)
+                                                ? USHRT_MAX : erbium::cpu::MASK_OPERANDS))
+            return EXIT_FAILURE;
+
+        queries_file.seekg(0, std::ios::end);
+        std::vector<char> raw_queries((size_t)queries_file.tellg());
+        queries_file.seekg(0, std::ios::beg);
+        queries_file.read(raw_queries.data(), raw_queries.size());
+        queries_file.close();
+
+        std::cout << "# QUERY ENCODING" << std::endl;
+        std::vector<operand_t> encoded;
+        const auto start = std::chrono::high_resolution_clock::now();
+        workload_size = the_encoder.encode(raw_queries.data(), raw_queries.size(), &encoded, cores_number);
+        const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        if (workload_size == 0)
+        {
+            std::cerr << "[!] No query in " << fullpath_raw << std::endl;
+            return EXIT_FAILURE;
+        }
+        printf("> Encoded: %u queries in %.4f s (%.0f queries/s, %.1f MB/s)\n", workload_size,
+            elapsed.count(), workload_size / elapsed.count(), raw_queries.size() / 1e6 / elapsed.count());
+
+        query_size = the_encoder.get_query_stride() * sizeof(operand_t);
+        workload_buff = new char[encoded.size() * sizeof(operand_t)];
+        memcpy(workload_buff, encoded.data(), encoded.size() * sizeof(operand_t));
+    }
+    else if (queries_file.is_open())
     {
         queries_file.seekg(0, std::ios::end);
         const uint32_t raw_size = ((uint32_t)queries_file.tellg()) - 2 * sizeof(query_size);
@@ -482,6 +331,12 @@ int main(int argc, char** argv)
                       << raw_size << " bytes\n";
             return EXIT_FAILURE;
         }
+        if (fullpath_bundle != NULL && query_size < the_engine.get_query_width() * sizeof(operand_t))
+        {
+            std::cerr << "[!] Queries of " << query_size << " bytes hold no rule type id "
+                      << "(expected the benchmark_bundle.bin of erbium -g)\n";
+            return EXIT_FAILURE;
+        }
 
         workload_buff = new char[raw_size];
         queries_file.read(workload_buff, raw_size);
@@ -497,10 +352,41 @@ int main(int argc, char** argv)
     // MULTIPLE BATCH SIZES 2^N                                                                   //
     ////////////////////////////////////////////////////////////////////////////////////////////////
 
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // NFA LOADER (HOT-SWAP)                                                                      //
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+
+    std::atomic<bool>     loader_running(fullpath_update != NULL);
+    std::atomic<uint32_t> n_swaps(0);
+    std::thread the_loader;
+    if (fullpath_update != NULL)
+    {
+        the_loader = std::thread([&]() {
+            const char* images[2] = {fullpath_update, fullpath_nfadata};
+            uint32_t next = 0;
+            while (loader_running.load())
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(swap_period));
+                if (!the_engine.update_image(images[next]))
+                    break;
+                n_swaps++;
+                next = 1 - next;
+            }
+        });
+    }
+
     std::ofstream file_benchmark(fullpath_benchmark);
     std::ofstream file_results(fullpath_results);
-    file_benchmark << "batch_size,total_ns" << std::endl;
+    file_benchmark << "batch_size,total_ns,swaps,llc_misses" << std::endl;
+
+    double   ns_swap = 0, ns_steady = 0;
+    uint64_t queries_swap = 0, queries_steady = 0;
+    uint32_t swaps_before;
+    int64_t  llc_before, llc_misses;
+    int64_t  llc_total = 0;
 
+    // bundle queries are led by their rule type id
+    const uint16_t query_width = the_engine.get_query_width();
     operand_t* the_queries;
     uint32_t* gabarito;
     result_s* results;
@@ -509,7 +395,7 @@ int main(int argc, char** argv)
     std::chrono::duration<double, std::nano> elapsed;
     for (uint32_t bsize = min_batch_size; bsize < max_batch_size; bsize = bsize << 1)
     {
-        the_queries = (operand_t*) malloc(bsize * CFG_ENGINE_NCRITERIA * sizeof(operand_t));
+        the_queries = (operand_t*) malloc(bsize * query_width * sizeof(operand_t));
         results = (result_s*) calloc(bsize, sizeof(*results));
         gabarito = (uint32_t*) calloc(bsize, sizeof(*gabarito));
 
@@ -521,34 +407,39 @@ int main(int argc, char** argv)
         {
             for (uint32_t k = 0; k < bsize; k++)
             {
-                memcpy(&the_queries[k*CFG_ENGINE_NCRITERIA], &(workload_buff[aux * query_size]),
-                    CFG_ENGINE_NCRITERIA * sizeof(operand_t));
+                memcpy(&the_queries[k * query_width], &(workload_buff[aux * query_size]),
+                    query_width * sizeof(operand_t));
                 gabarito[k] = aux;
                 aux = (aux + 1) % workload_size;
             }
-            std::memset(results, 0, bsize * sizeof(*results));
+            const erbium::cpu::span_s<const operand_t> batch_queries = {the_queries, bsize * query_width};
+            const erbium::cpu::span_s<result_s> batch_results = {results, bsize};
 
             ////////////////////////////////////////////////////////////////////////////////////////
             // KERNEL EXECUTION                                                                   //
             ////////////////////////////////////////////////////////////////////////////////////////
 
+            swaps_before = n_swaps.load();
+            llc_before = read_llc_counters(llc_counters);
             start = std::chrono::high_resolution_clock::now();
-            #pragma omp parallel for num_threads(cores_number)
-            for (uint32_t query=0; query < bsize; query++)
-            {
-                compute(&the_queries[query * CFG_ENGINE_NCRITERIA],
-                        0, // level
-                        the_queries[query * CFG_ENGINE_NCRITERIA], // pointer
-                        0, // interim
-                        &results[query]);
-                #ifdef EXEC_DEBUG
-                std::cout << gabarito[query] << " " << results[query].pointer << std::endl;
-                #endif
-            }
+            the_engine.match_batch(batch_queries, batch_results);
             finish = std::chrono::high_resolution_clock::now();
             elapsed = finish - start;
+            llc_misses = (llc_before < 0) ? -1 : read_llc_counters(llc_counters) - llc_before;
+            llc_total = (llc_misses < 0 || llc_total < 0) ? -1 : llc_total + llc_misses;
 
-            file_benchmark << bsize << "," << elapsed.count() << std::endl;
+            const uint32_t swaps = n_swaps.load() - swaps_before;
+            if (swaps == 0)
+            {
+                ns_steady += elapsed.count();
+                queries_steady += bsize;
+            }
+            else
+            {
+                ns_swap += elapsed.count();
+                queries_swap += bsize;
+            }
+            file_benchmark << bsize << "," << elapsed.count() << "," << swaps << "," << llc_misses << std::endl;
         }
 
         ////////////////////////////////////////////////////////////////////////////////////////////
@@ -564,12 +455,41 @@ int main(int argc, char** argv)
         free(results);
         free(gabarito);
     }
+    loader_running.store(false);
+    if (the_loader.joinable())
+        the_loader.join();
+
+    if (fullpath_update != NULL)
+    {
+        std::cout << "# HOT-SWAP" << std::endl;
+        the_engine.get_image_info(0, &nfa_hash, &nfa_version, &nfa_size, &nfa_swaps);
+        printf("> Swaps: %u (final version %lu)\n", n_swaps.load(), nfa_swaps);
+        if (queries_steady != 0)
+            printf("> Steady throughput: %12.0f queries/s\n", queries_steady / ns_steady * 1e9);
+        if (queries_swap != 0)
+            printf("> Swap throughput:   %12.0f queries/s\n", queries_swap / ns_swap * 1e9);
+    }
+
+    std::cout << "# MEMORY LAYOUT" << std::endl;
+    printf("> Layout: %s\n", (depth_first) ? "depth-first" : "level-major");
+    if (queries_steady + queries_swap != 0)
+    {
+        printf("> Throughput: %12.0f queries/s\n",
+            (queries_steady + queries_swap) / (ns_steady + ns_swap) * 1e9);
+        if (llc_total >= 0)
+            printf("> LLC misses: %12.2f per query\n", (double)llc_total / (queries_steady + queries_swap));
+        else
+            printf("> LLC misses: n/a\n");
+    }
+
+    for (auto& fd : llc_counters)
+    {
+        if (fd >= 0)
+            close(fd);
+    }
     delete [] workload_buff;
     file_benchmark.close();
     file_results.close();
 
-    for (uint16_t level=0; level<CFG_ENGINE_NCRITERIA; level++)
-        free(the_memory[level]);
-
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
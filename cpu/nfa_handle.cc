@@ -0,0 +1,109 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "nfa_handle.h"
+
+#include <cstdlib>
+
+namespace erbium {
+namespace cpu {
+
+NfaHandle::NfaHandle(nfa_image_s* image, const uint16_t& max_readers) :
+    m_current(image),
+    m_epoch(1),
+    m_max_readers(max_readers)
+{
+    m_readers = new reader_slot_s[max_readers];
+    for (uint16_t i = 0; i < max_readers; i++)
+        m_readers[i].epoch.store(C_EPOCH_IDLE);
+}
+
+NfaHandle::~NfaHandle()
+{
+    // no reader is expected to be pinned at this point
+    for (auto& retired : m_retired)
+        free_nfa_image(retired.second);
+    free_nfa_image(m_current.load());
+    delete [] m_readers;
+}
+
+const nfa_image_s* NfaHandle::pin(const uint16_t& reader)
+{
+    // announce the epoch before reading the image, so a concurrent publish cannot free it
+    m_readers[reader].epoch.store(m_epoch.load());
+    return m_current.load();
+}
+
+void NfaHandle::unpin(const uint16_t& reader)
+{
+    m_readers[reader].epoch.store(C_EPOCH_IDLE, std::memory_order_release);
+}
+
+uint32_t NfaHandle::publish(nfa_image_s* image)
+{
+    nfa_image_s* previous = m_current.exchange(image);
+    // readers pinned up to this epoch may still hold the previous image
+    m_retired.push_back(std::make_pair(m_epoch.fetch_add(1), previous));
+    return reclaim();
+}
+
+uint32_t NfaHandle::reclaim()
+{
+    uint64_t min_epoch = UINT64_MAX;
+    uint64_t aux;
+    for (uint16_t i = 0; i < m_max_readers; i++)
+    {
+        aux = m_readers[i].epoch.load();
+        if (aux != C_EPOCH_IDLE && aux < min_epoch)
+            min_epoch = aux;
+    }
+
+    uint32_t n_freed = 0;
+    for (auto it = m_retired.begin(); it != m_retired.end(); )
+    {
+        if (it->first < min_epoch)
+        {
+            free_nfa_image(it->second);
+            it = m_retired.erase(it);
+            n_freed++;
+        }
+        else
+            ++it;
+    }
+    return n_freed;
+}
+
+void free_nfa_image(nfa_image_s* nfa)
+{
+    for (uint16_t level=0; level<nfa->params.n_levels; level++)
+    {
+        free(nfa->levels[level]);
+        if (nfa->depth_first)
+            break;
+    }
+    free(nfa->sets.first);
+    free(nfa->sets.values);
+    delete nfa;
+}
+
+} // namespace cpu
+} // namespace erbium
@@ -0,0 +1,73 @@
+#ifndef ERBIUM_CPU_NFA_HANDLE_H
+#define ERBIUM_CPU_NFA_HANDLE_H
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "definitions.h"
+
+#include <atomic>
+#include <vector>
+
+namespace erbium {
+namespace cpu {
+
+// Query threads pin the current image inside an epoch read section; a loader thread publishes a
+// new image atomically and retired images are freed once no reader is pinned to an older epoch.
+class NfaHandle
+{
+  public:
+    NfaHandle(nfa_image_s* image, const uint16_t& max_readers);
+    ~NfaHandle();
+
+    // reader side (one slot per query thread)
+    const nfa_image_s* pin(const uint16_t& reader);
+    void unpin(const uint16_t& reader);
+
+    // writer side (single loader thread); returns the number of images freed
+    uint32_t publish(nfa_image_s* image);
+    uint32_t reclaim();
+
+    uint64_t get_version() const { return m_epoch.load() - 1; }
+
+  private:
+    static const uint64_t C_EPOCH_IDLE = 0;
+
+    // one slot per cache line to avoid false sharing between query threads
+    struct reader_slot_s {
+        std::atomic<uint64_t> epoch;
+        char padding[C_CACHELINE_SIZE - sizeof(std::atomic<uint64_t>)];
+    };
+
+    std::atomic<nfa_image_s*> m_current;
+    std::atomic<uint64_t>     m_epoch;
+    reader_slot_s*            m_readers;
+    uint16_t                  m_max_readers;
+    std::vector<std::pair<uint64_t, nfa_image_s*>> m_retired; // <retire epoch, image>
+};
+
+// frees the memories of an image and the image itself
+void free_nfa_image(nfa_image_s* nfa);
+
+} // namespace cpu
+} // namespace erbium
+
+#endif // ERBIUM_CPU_NFA_HANDLE_H
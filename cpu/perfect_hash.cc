@@ -0,0 +1,122 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "perfect_hash.h"
+
+#include <algorithm>
+
+namespace erbium {
+namespace cpu {
+
+PerfectHash::PerfectHash() :
+    m_displacements(1, 0),
+    m_slots(1),
+    m_mask(0),
+    m_n_buckets(1),
+    m_size(0)
+{
+    m_slots[0].length = C_EMPTY_SLOT;
+}
+
+bool PerfectHash::build(const std::vector<std::string>& keys, const std::vector<uint16_t>& values)
+{
+    // load factor of at most 0.8 and about 4 keys per bucket; the capacity doubles on failure
+    uint64_t capacity = 1;
+    while (capacity < keys.size() + keys.size() / 4)
+        capacity <<= 1;
+    for (uint16_t attempt = 0; attempt < 4; attempt++, capacity <<= 1)
+    {
+        m_mask = capacity - 1;
+        m_n_buckets = std::max((size_t)1, keys.size() / 4);
+        if (place(keys, values))
+            return true;
+    }
+    return false;
+}
+
+bool PerfectHash::place(const std::vector<std::string>& keys, const std::vector<uint16_t>& values)
+{
+    m_keys.clear();
+    m_size = keys.size();
+    m_displacements.assign(m_n_buckets, 0);
+    m_slots.assign(m_mask + 1, slot_s());
+    for (auto& slot : m_slots)
+        slot.length = C_EMPTY_SLOT;
+
+    std::vector<uint64_t> hashes(keys.size());
+    std::vector<std::vector<uint32_t>> buckets(m_n_buckets);
+    for (uint32_t key = 0; key < keys.size(); key++)
+    {
+        hashes[key] = hash_key(keys[key].data(), keys[key].size());
+        buckets[get_bucket(hashes[key])].push_back(key);
+    }
+
+    // largest buckets first, while most of the slots are free
+    std::vector<uint32_t> order(m_n_buckets);
+    for (uint32_t bucket = 0; bucket < m_n_buckets; bucket++)
+        order[bucket] = bucket;
+    std::stable_sort(order.begin(), order.end(), [&buckets](const uint32_t& a, const uint32_t& b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    std::vector<uint32_t> taken;
+    for (auto& bucket : order)
+    {
+        if (buckets[bucket].empty())
+            break;
+
+        uint32_t displacement = 0;
+        for (; displacement <= C_MAX_DISPLACEMENT; displacement++)
+        {
+            taken.clear();
+            for (auto& key : buckets[bucket])
+            {
+                const uint32_t slot = get_slot(hashes[key], displacement);
+                if (m_slots[slot].length != C_EMPTY_SLOT
+                    || std::find(taken.begin(), taken.end(), slot) != taken.end())
+                    break;
+                taken.push_back(slot);
+            }
+            if (taken.size() == buckets[bucket].size())
+                break;
+        }
+        if (displacement > C_MAX_DISPLACEMENT)
+            return false; // or duplicated keys
+
+        m_displacements[bucket] = displacement;
+        for (size_t i = 0; i < taken.size(); i++)
+        {
+            const uint32_t key = buckets[bucket][i];
+            m_slots[taken[i]].offset = m_keys.size();
+            m_slots[taken[i]].length = keys[key].size();
+            m_slots[taken[i]].value = values[key];
+            m_keys += keys[key];
+        }
+    }
+    // an empty table still answers lookups (the key of its only slot never matches)
+    if (m_keys.empty())
+        m_keys.push_back('\0');
+    return true;
+}
+
+} // namespace cpu
+} // namespace erbium
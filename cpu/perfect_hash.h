@@ -0,0 +1,112 @@
+#ifndef ERBIUM_CPU_PERFECT_HASH_H
+#define ERBIUM_CPU_PERFECT_HASH_H
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace erbium {
+namespace cpu {
+
+// Static table of short strings built with hash and displace (CHD): the keys of each bucket are
+// sent to free slots by the displacement of the bucket, so a lookup is one hash, one slot and one
+// key comparison, without probing nor branches on collisions.
+class PerfectHash
+{
+  public:
+    PerfectHash();
+
+    // fails on duplicated keys
+    bool build(const std::vector<std::string>& keys, const std::vector<uint16_t>& values);
+
+    // value of the key, or missing if it is not in the table
+    uint16_t find(const char* key, const size_t& length, const uint16_t& missing) const
+    {
+        const uint64_t hash = hash_key(key, length);
+        const slot_s& slot = m_slots[get_slot(hash, m_displacements[get_bucket(hash)])];
+        return (slot.length == length && memcmp(&m_keys[slot.offset], key, length) == 0)
+               ? slot.value : missing;
+    }
+
+    size_t size() const { return m_size; }
+
+  private:
+    static const uint16_t C_EMPTY_SLOT = UINT16_MAX; // as a key length
+    static const uint32_t C_MAX_DISPLACEMENT = UINT16_MAX;
+
+    struct slot_s {
+        uint32_t offset; // in m_keys
+        uint16_t length;
+        uint16_t value;
+    };
+
+    static uint64_t mix(uint64_t hash)
+    {
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccd;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    // 8 bytes at a time (codes are short)
+    static uint64_t hash_key(const char* key, const size_t& length)
+    {
+        uint64_t hash = 0x9e3779b97f4a7c15 ^ length;
+        uint64_t word;
+        size_t i = 0;
+        for (; i + sizeof(word) <= length; i += sizeof(word))
+        {
+            memcpy(&word, key + i, sizeof(word));
+            hash = mix(hash ^ word);
+        }
+        word = 0;
+        memcpy(&word, key + i, length - i);
+        return mix(hash ^ word);
+    }
+
+    uint32_t get_bucket(const uint64_t& hash) const
+    {
+        return ((hash >> 32) * m_n_buckets) >> 32;
+    }
+
+    uint32_t get_slot(const uint64_t& hash, const uint16_t& displacement) const
+    {
+        return mix(hash + displacement * 0x9e3779b97f4a7c15) & m_mask;
+    }
+
+    bool place(const std::vector<std::string>& keys, const std::vector<uint16_t>& values);
+
+    std::vector<uint16_t> m_displacements; // per bucket
+    std::vector<slot_s>   m_slots;         // power-of-two capacity
+    std::string           m_keys;          // pooled
+    uint64_t              m_mask;
+    uint64_t              m_n_buckets;
+    size_t                m_size;
+};
+
+} // namespace cpu
+} // namespace erbium
+
+#endif // ERBIUM_CPU_PERFECT_HASH_H
@@ -0,0 +1,348 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "query_encoder.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace erbium {
+namespace cpu {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// VALUE PARSERS                                                                                  //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// dates and flight ranges are parsed as in the NFA compiler (RuleParser::parse_value)
+static_assert(parsers::C_DATE_OPERAND_WIDTH == CFG_CRITERION_VALUE_WIDTH,
+              "The date operands must span the criterion value width");
+
+// next non-blank line of a buffer, without its line feed
+inline bool next_line(const char** cursor, const char* end, const char** line, const char** line_end)
+{
+    while (*cursor < end)
+    {
+        *line = *cursor;
+        const char* feed = (const char*) memchr(*line, '\n', end - *line);
+        *line_end = (feed == NULL) ? end : feed;
+        *cursor = (feed == NULL) ? end : feed + 1;
+        if (*line_end > *line && (*line_end)[-1] == '\r')
+            (*line_end)--;
+        if (*line_end > *line)
+            return true;
+    }
+    return false;
+}
+
+// field without its quotes
+inline void trim_quotes(const char** first, const char** last)
+{
+    if (*last - *first >= 2 && **first == '"' && (*last)[-1] == '"')
+    {
+        (*first)++;
+        (*last)--;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// QUERY ENCODER                                                                                  //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+QueryEncoder::QueryEncoder() :
+    m_mask(MASK_OPERANDS),
+    m_stride(0)
+{
+}
+
+bool QueryEncoder::load(const std::string& prefix, const operand_t& operand_mask)
+{
+    std::ifstream file_criteria(prefix + "criteria.csv");
+    std::ifstream file_dictionnary(prefix + "dictionnary.csv");
+    if (!file_criteria.is_open() || !file_dictionnary.is_open())
+    {
+        std::cerr << "[!] Failed to open " << prefix << "criteria.csv or " << prefix << "dictionnary.csv\n";
+        return false;
+    }
+    m_mask = operand_mask;
+    m_levels.clear();
+
+    // level,criterion_id,code,functor,pair,mandatory
+    std::vector<std::string> codes;
+    std::vector<uint16_t> code_levels;
+    std::string line;
+    std::getline(file_criteria, line); // header
+    while (std::getline(file_criteria, line))
+    {
+        std::stringstream fields(line);
+        std::string level, criterion_id, code, functor, pair, mandatory;
+        std::getline(fields, level, ',');
+        std::getline(fields, criterion_id, ',');
+        std::getline(fields, code, ',');
+        std::getline(fields, functor, ',');
+        std::getline(fields, pair, ',');
+        std::getline(fields, mandatory, ',');
+
+        level_s the_level;
+        the_level.code = code;
+        the_level.functor = atoi(functor.c_str());
+        the_level.pair = atoi(pair.c_str()) == 1;
+        the_level.mandatory = atoi(mandatory.c_str()) == 1;
+        const parsers::value_functor_s* value_functor = parsers::find_value_functor(the_level.functor);
+        the_level.parser = (value_functor == NULL) ? NULL : value_functor->parser;
+        the_level.wildcard = 0;
+        m_levels.push_back(the_level);
+        codes.push_back(code);
+        code_levels.push_back(m_levels.size() - 1);
+    }
+    if (m_levels.empty() || !m_codes.build(codes, code_levels))
+    {
+        std::cerr << "[!] No criteria or duplicated criterion codes in " << prefix << "criteria.csv\n";
+        return false;
+    }
+
+    // level,value,id (the contents come after the criteria levels)
+    std::vector<std::vector<std::string>> values(m_levels.size());
+    std::vector<std::vector<uint16_t>> ids(m_levels.size());
+    std::getline(file_dictionnary, line); // header
+    while (std::getline(file_dictionnary, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        const size_t first = line.find(',');
+        const size_t last = line.rfind(',');
+        const uint32_t level = atoi(line.c_str());
+        if (first == std::string::npos || first == last || level >= m_levels.size())
+            continue;
+        values[level].push_back(line.substr(first + 1, last - first - 1));
+        ids[level].push_back(atoi(line.c_str() + last + 1));
+    }
+
+    for (uint16_t level = 0; level < m_levels.size(); level++)
+    {
+        level_s& the_level = m_levels[level];
+        if (!the_level.values.build(values[level], ids[level]))
+        {
+            std::cerr << "[!] Duplicated values of level " << level << " in " << prefix << "dictionnary.csv\n";
+            return false;
+        }
+        // mandatory criteria have no wildcard: unknown values are past the ids (and rejected)
+        const operand_t max_id = (ids[level].empty()) ? 0 : *std::max_element(ids[level].begin(), ids[level].end());
+        the_level.wildcard = the_level.values.find("*", 1, max_id + 1);
+    }
+
+    // cache-line aligned queries, as benchmark.bin
+    const uint32_t per_line = C_CACHELINE_SIZE / sizeof(operand_t);
+    m_stride = (m_levels.size() + per_line - 1) / per_line * per_line;
+    return true;
+}
+
+operand_t QueryEncoder::encode_value(const uint16_t& level, const char* value, const size_t& length) const
+{
+    const level_s& the_level = m_levels[level];
+    if (length == 0 || (length == 1 && value[0] == '*'))
+        return the_level.wildcard & m_mask;
+    if (!the_level.pair)
+        return the_level.values.find(value, length, the_level.wildcard) & m_mask;
+
+    // single dates and flight numbers of the queries are the first operand
+    operand_t operand_a, operand_b;
+    if (the_level.parser == NULL ||
+        the_level.parser(value, length, &operand_a, &operand_b) == parsers::PARSE_MALFORMED)
+        return 0;
+    return operand_a & m_mask;
+}
+
+void QueryEncoder::encode_csv_line(const char* line, const char* end, const std::vector<int16_t>& columns,
+                                   operand_t* query) const
+{
+    const char* field = line;
+    for (size_t column = 0; column < columns.size() && field <= end; column++)
+    {
+        const char* comma = (const char*) memchr(field, ',', end - field);
+        const char* field_end = (comma == NULL) ? end : comma;
+        if (columns[column] >= 0)
+        {
+            const char* first = field;
+            const char* last = field_end;
+            trim_quotes(&first, &last);
+            query[columns[column]] = encode_value(columns[column], first, last - first);
+        }
+        field = field_end + 1;
+    }
+}
+
+void QueryEncoder::encode_json_line(const char* line, const char* end, operand_t* query) const
+{
+    // flat objects of strings and numbers, without escaped quotes
+    const char* cursor = line;
+    while (cursor < end)
+    {
+        const char* key = (const char*) memchr(cursor, '"', end - cursor);
+        const char* key_end = (key == NULL) ? NULL : (const char*) memchr(key + 1, '"', end - key - 1);
+        if (key_end == NULL)
+            return;
+        key++;
+
+        cursor = key_end + 1;
+        while (cursor < end && (*cursor == ':' || *cursor == ' ' || *cursor == '\t'))
+            cursor++;
+        const char* value = cursor;
+        const char* value_end;
+        if (cursor < end && *cursor == '"')
+        {
+            value++;
+            value_end = (const char*) memchr(value, '"', end - value);
+            if (value_end == NULL)
+                return;
+            cursor = value_end + 1;
+        }
+        else
+        {
+            while (cursor < end && *cursor != ',' && *cursor != '}' && *cursor != ' ')
+                cursor++;
+            value_end = cursor;
+            if (value_end - value == 4 && memcmp(value, "null", 4) == 0)
+                value_end = value;
+        }
+
+        const uint16_t level = m_codes.find(key, key_end - key, UINT16_MAX);
+        if (level != UINT16_MAX)
+            query[level] = encode_value(level, value, value_end - value);
+    }
+}
+
+bool QueryEncoder::encode_lines(const char* data, const char* end, const std::vector<int16_t>& columns,
+                                const bool& json, operand_t* queries, std::string* rejected) const
+{
+    const char* cursor = data;
+    const char* line;
+    const char* line_end;
+    for (operand_t* query = queries; next_line(&cursor, end, &line, &line_end); query += m_stride)
+    {
+        // criteria left out are wildcards
+        for (uint16_t level = 0; level < m_levels.size(); level++)
+            query[level] = m_levels[level].wildcard & m_mask;
+        if (json)
+            encode_json_line(line, line_end, query);
+        else
+            encode_csv_line(line, line_end, columns, query);
+
+        for (uint16_t level = 0; level < m_levels.size(); level++)
+        {
+            if (m_levels[level].mandatory && !m_levels[level].pair
+                && query[level] == (m_levels[level].wildcard & m_mask))
+            {
+                *rejected = "[" + std::string(line, line_end) + "] has no known "
+                          + m_levels[level].code + " (mandatory)";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+uint32_t QueryEncoder::encode(const char* data, const size_t& size, std::vector<operand_t>* queries,
+                              const uint16_t& n_threads) const
+{
+    const char* end = data + size;
+    const char* body = data;
+    while (body < end && isspace(*body))
+        body++;
+    const bool json = (body < end && *body == '{');
+
+    // CSV header: level of each column
+    std::vector<int16_t> columns;
+    if (!json)
+    {
+        const char* header;
+        const char* header_end;
+        if (!next_line(&body, end, &header, &header_end))
+            return 0;
+        std::vector<bool> found(m_levels.size(), false);
+        for (const char* field = header; field <= header_end; )
+        {
+            const char* comma = (const char*) memchr(field, ',', header_end - field);
+            const char* first = field;
+            const char* last = (comma == NULL) ? header_end : comma;
+            field = last + 1;
+            trim_quotes(&first, &last);
+            const uint16_t level = m_codes.find(first, last - first, UINT16_MAX);
+            columns.push_back((level == UINT16_MAX) ? -1 : level);
+            if (level != UINT16_MAX)
+                found[level] = true;
+        }
+        for (uint16_t level = 0; level < m_levels.size(); level++)
+        {
+            if (!found[level])
+                printf("[!] No column for criterion %s: wildcard\n", m_levels[level].code.c_str());
+        }
+    }
+
+    // chunks of whole lines (a few per thread): lines are counted, then encoded at their offset
+    const uint32_t n_chunks = std::max(1, 4 * n_threads);
+    std::vector<const char*> bounds(n_chunks + 1, end);
+    bounds[0] = body;
+    for (uint32_t chunk = 1; chunk < n_chunks; chunk++)
+    {
+        const char* cut = std::max(bounds[chunk - 1], body + (end - body) * chunk / n_chunks);
+        const char* feed = (const char*) memchr(cut, '\n', end - cut);
+        bounds[chunk] = (feed == NULL) ? end : feed + 1;
+    }
+
+    std::vector<uint32_t> offsets(n_chunks + 1, 0);
+    #pragma omp parallel for num_threads(n_threads)
+    for (uint32_t chunk = 0; chunk < n_chunks; chunk++)
+    {
+        const char* cursor = bounds[chunk];
+        const char* line;
+        const char* line_end;
+        while (next_line(&cursor, bounds[chunk + 1], &line, &line_end))
+            offsets[chunk + 1]++;
+    }
+    for (uint32_t chunk = 0; chunk < n_chunks; chunk++)
+        offsets[chunk + 1] += offsets[chunk];
+
+    queries->assign((size_t)offsets[n_chunks] * m_stride, 0);
+    std::vector<std::string> rejected(n_chunks);
+    #pragma omp parallel for num_threads(n_threads) schedule(dynamic)
+    for (uint32_t chunk = 0; chunk < n_chunks; chunk++)
+        encode_lines(bounds[chunk], bounds[chunk + 1], columns, json,
+                     queries->data() + (size_t)offsets[chunk] * m_stride, &rejected[chunk]);
+    for (auto& aux : rejected)
+    {
+        if (!aux.empty())
+        {
+            std::cerr << "[!] Query " << aux << ": rejected\n";
+            queries->clear();
+            return 0;
+        }
+    }
+    return offsets[n_chunks];
+}
+
+} // namespace cpu
+} // namespace erbium
@@ -0,0 +1,93 @@
+#ifndef ERBIUM_CPU_QUERY_ENCODER_H
+#define ERBIUM_CPU_QUERY_ENCODER_H
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "definitions.h"
+#include "perfect_hash.h"
+#include "../sw/value_parsers.h"
+
+#include <string>
+#include <vector>
+
+namespace erbium {
+namespace cpu {
+
+// Online counterpart of the workload export of erbium (RuleParser::parse_value): raw criterion
+// values become the operands of the engine, in the order of the NFA levels. Values are looked up in
+// one perfect hash table per level, unknown ones falling to the wildcard id (queries with unknown
+// values of a mandatory criterion are rejected); dates and flight numbers of the pair criteria go
+// through the value parsers of the compiler.
+class QueryEncoder
+{
+  public:
+    QueryEncoder();
+
+    // dictionnary.csv and criteria.csv of erbium, under the path prefix (e.g. "build/" or
+    // "build/bundle_0_"); operands are truncated to the fixed width of the hardware unless for
+    // packed images (USHRT_MAX)
+    bool load(const std::string& prefix, const operand_t& operand_mask = MASK_OPERANDS);
+
+    // encodes a CSV buffer (header of criterion codes, other columns are ignored) or a JSON-lines
+    // one ({"code":"value",...} per line) into the padded layout of benchmark.bin, in parallel
+    // chunks of lines; returns the number of queries, 0 on error (e.g. an unknown value of a
+    // mandatory criterion, which has no wildcard)
+    uint32_t encode(const char* data, const size_t& size, std::vector<operand_t>* queries,
+                    const uint16_t& n_threads) const;
+
+    // operand of a raw value of a level
+    operand_t encode_value(const uint16_t& level, const char* value, const size_t& length) const;
+
+    uint16_t get_n_levels() const { return m_levels.size(); }
+    // in operands (the queries are cache-line aligned)
+    uint32_t get_query_stride() const { return m_stride; }
+
+  private:
+    // criterion of a level
+    struct level_s {
+        std::string code;
+        uint16_t    functor;
+        bool        pair;
+        bool        mandatory;
+        parsers::value_parser_t parser; // of the pair criteria
+        operand_t   wildcard; // of the empty and unknown values (past the ids if mandatory: rejected)
+        PerfectHash values;
+    };
+
+    std::vector<level_s> m_levels;
+    PerfectHash          m_codes;  // level of each criterion code
+    operand_t            m_mask;
+    uint32_t             m_stride;
+
+    // fields of a line to the levels (-1: ignored column)
+    void encode_csv_line(const char* line, const char* end, const std::vector<int16_t>& columns,
+                         operand_t* query) const;
+    void encode_json_line(const char* line, const char* end, operand_t* query) const;
+    // false (with the first rejected line) if a query lacks a known value of a mandatory criterion
+    bool encode_lines(const char* data, const char* end, const std::vector<int16_t>& columns,
+                      const bool& json, operand_t* queries, std::string* rejected) const;
+};
+
+} // namespace cpu
+} // namespace erbium
+
+#endif // ERBIUM_CPU_QUERY_ENCODER_H
@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "thread_pool.h"
+
+namespace erbium {
+namespace cpu {
+
+ThreadPool::ThreadPool(const uint16_t& n_workers)
+{
+    for (uint16_t i = 0; i < n_workers; i++)
+    {
+        m_workers.push_back(std::unique_ptr<worker_s>(new worker_s));
+        m_workers.back()->running = true;
+    }
+    for (auto& worker : m_workers)
+        worker->thread = std::thread(&ThreadPool::work, this, worker.get());
+}
+
+ThreadPool::~ThreadPool()
+{
+    for (auto& worker : m_workers)
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->running = false;
+        worker->ready.notify_one();
+    }
+    for (auto& worker : m_workers)
+        worker->thread.join();
+}
+
+void ThreadPool::submit(const uint16_t& worker, const std::function<void()>& task)
+{
+    worker_s* the_worker = m_workers[worker % m_workers.size()].get();
+    std::lock_guard<std::mutex> lock(the_worker->mutex);
+    the_worker->tasks.push_back(task);
+    the_worker->ready.notify_one();
+}
+
+void ThreadPool::work(worker_s* worker)
+{
+    std::function<void()> task;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(worker->mutex);
+            worker->ready.wait(lock, [worker]() { return !worker->running || !worker->tasks.empty(); });
+            if (worker->tasks.empty())
+                return;
+            task = std::move(worker->tasks.front());
+            worker->tasks.pop_front();
+        }
+        task();
+    }
+}
+
+} // namespace cpu
+} // namespace erbium
@@ -0,0 +1,68 @@
+#ifndef ERBIUM_CPU_THREAD_POOL_H
+#define ERBIUM_CPU_THREAD_POOL_H
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace erbium {
+namespace cpu {
+
+// Fixed set of query threads, each with its own task queue: the caller picks the worker, so the
+// chunks of a batch are spread like a static schedule and a worker index doubles as the reader slot
+// of the NFA handles.
+class ThreadPool
+{
+  public:
+    explicit ThreadPool(const uint16_t& n_workers);
+    ~ThreadPool(); // runs the pending tasks, then joins
+
+    // tasks of a same worker run in submission order
+    void submit(const uint16_t& worker, const std::function<void()>& task);
+
+    uint16_t size() const { return m_workers.size(); }
+
+  private:
+    struct worker_s {
+        std::thread                       thread;
+        std::deque<std::function<void()>> tasks;
+        std::mutex                        mutex;
+        std::condition_variable           ready;
+        bool                              running;
+    };
+
+    void work(worker_s* worker);
+
+    std::vector<std::unique_ptr<worker_s>> m_workers;
+};
+
+} // namespace cpu
+} // namespace erbium
+
+#endif // ERBIUM_CPU_THREAD_POOL_H
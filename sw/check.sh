@@ -0,0 +1,131 @@
+#!/bin/bash
+####################################################################################################
+##  ERBium - Business Rule Engine Hardware Accelerator
+##  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+##  This program is free software: you can redistribute it and/or modify it under the terms of the
+##  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+##  of the License, or (at your option) any later version.
+
+##  This software is provided by the copyright holders and contributors "AS IS" and any express or
+##  implied warranties, including, but not limited to, the implied warranties of merchantability and
+##  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+##  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+##  consequential damages (including, but not limited to, procurement of substitute goods or
+##  services; loss of use, data, or profits; or business interruption) however caused and on any
+##  theory of liability, whether in contract, strict liability, or tort (including negligence or
+##  otherwise) arising in any way out of the use of this software, even if advised of the
+##  possibility of such damage. See the GNU Affero General Public License for more details.
+
+##  You should have received a copy of the GNU Affero General Public License along with this
+##  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+####################################################################################################
+# Regression check of the compiler modes (make check): every image must answer the queries as the
+# plain NFA image does, on the demo rules and on a weighted rule set with pair criteria, whose plain
+# results must also be those of a brute-force search (../data/check_results.csv). Both rule sets
+# are free of ties (no two matching rules of the same weight), so the contents are exact.
+
+ERBIUM=./erbium
+ENGINE=../cpu/erbium_cpu
+DATA=../data
+BUILD=${1:-build-check}
+
+if [ ! -x $ERBIUM ] || [ ! -x $ENGINE ]; then
+    echo "[!] Build $ERBIUM and $ENGINE first"
+    exit 1
+fi
+rm -rf $BUILD
+mkdir -p $BUILD
+
+# compiler options | engine options (images relative to the build folder); the H1 orders (-s 1
+# and 2) are left out, as they may lead with an optional criterion, whose wildcard the first level
+# of the engine (indexed by value id) cannot hold
+MODES=(
+    "-v 3|-n mem_nfa_edges.bin"
+    "-v 2|-n mem_nfa_edges.bin"
+    "-v 3 -f|-n mem_nfa_edges_dfs.bin -l 1"
+    "-v 2 -f|-n mem_nfa_edges_dfs.bin -l 1"
+    "-v 3 -s 5 -i 20|-n mem_nfa_edges.bin"
+    "-v 3 -p|-n mem_nfa_edges.bin"
+    "-v 3 -c|-n mem_nfa_edges.bin"
+    "-v 3 -n|-n mem_nfa_edges.bin"
+    "-v 2 -c -n -f|-n mem_nfa_edges_dfs.bin -l 1"
+    "-v 3 -l 1|-n mem_nfa_edges.bin"
+    "-v 3 -l 2|-n mem_nfa_edges.bin"
+    "-v 3 -l 3|-n mem_nfa_edges.bin"
+    "-v 3 -k 8|-s shards.csv"
+    "-v 3 -b 0|-n mem_dfa_edges.bin"
+    "-v 3 -b 6|-n mem_dfa_edges.bin"
+    "-v 3 -b 40|-n mem_dfa_edges.bin"
+    "-v 3 -m|-n mem_nfa_edges.bin"
+    "-v 3 -u|-n mem_nfa_edges.bin"
+    "-v 2 -u -f|-n mem_nfa_edges_dfs.bin -l 1"
+    "-v 3 -a|-n mem_nfa_edges.bin"
+)
+
+# query_id,content of the results of a build (content ids of its dictionnary, the last level)
+contents()
+{
+    awk -F, 'NR == FNR { if (FNR > 1) { level[FNR] = $1; value[FNR] = $2; id[FNR] = $3; if ($1 > last) last = $1 }; n = FNR; next }
+             FNR == 1  { for (k = 2; k <= n; k++) if (level[k] == last) content[id[k]] = value[k]; next }
+                       { print $1 "," content[$2] }' $1/dictionnary.csv $2
+}
+
+# runs every mode on a rule set: rules, ruletype, queries and expected contents (or empty)
+check()
+{
+    local name=$1 rules=$2 ruletype=$3 queries=$4 expected=$5
+    local n_queries=$(($(wc -l < $queries) - 1))
+    local failed=0
+    for mode in "${MODES[@]}"; do
+        local options=${mode%|*}
+        local image=${mode#*|}
+        local folder=$BUILD/$name$(echo $options | tr -d ' ')
+        mkdir -p $folder
+        if ! $ERBIUM -d $folder/ -r $rules -t $ruletype $options > $folder/log.txt 2>&1; then
+            printf "%-10s %-16s compile failed (see %s/log.txt)\n" $name "$options" $folder
+            failed=1
+            continue
+        fi
+        if ! $ENGINE $(printf "%s" "$image" | sed "s| \([^ -][^ ]*\)| $folder/\1|") -q $queries -e $folder/ \
+                -r $folder/results.csv -o $folder/benchmark_out.csv \
+                -f $n_queries -m $((n_queries + 1)) -i 1 -k 1 > $folder/log_cpu.txt 2>&1; then
+            printf "%-10s %-16s engine failed (see %s/log_cpu.txt)\n" $name "$options" $folder
+            failed=1
+            continue
+        fi
+        contents $folder $folder/results.csv > $folder/contents.csv
+        [ -z "$reference" ] && reference=$folder/contents.csv
+        local wrong=$(diff $reference $folder/contents.csv | grep -c "^>")
+        printf "%-10s %-16s %4u/%u wrong\n" $name "$options" $wrong $n_queries
+        [ $wrong -eq 0 ] || failed=1
+    done
+    if [ -n "$expected" ]; then
+        local wrong=$(diff <(tail -n +2 $expected) $reference | grep -c "^>")
+        printf "%-10s %-16s %4u/%u wrong against the brute-force search\n" $name "(plain)" $wrong $n_queries
+        [ $wrong -eq 0 ] || failed=1
+    fi
+    return $failed
+}
+
+# every combination of the demo values
+DEMO_QUERIES=$BUILD/demo_queries.csv
+echo "AIRPORT,TERMINAL,INBOUND,OUTBOUND" > $DEMO_QUERIES
+for airport in ZRH CDG; do
+    for terminal in T1 T2 T3 T4; do
+        for inbound in INT SCH; do
+            for outbound in INT SCH; do
+                echo "$airport,$terminal,$inbound,$outbound" >> $DEMO_QUERIES
+            done
+        done
+    done
+done
+
+status=0
+reference=""
+check demo01 $DATA/demo_01.csv $DATA/check_demo_ruletype.xml $DEMO_QUERIES "" || status=1
+reference=""
+check check $DATA/check_rules.csv $DATA/check_ruletype.xml $DATA/check_queries.csv $DATA/check_results.csv || status=1
+
+[ $status -eq 0 ] && echo "# CHECK PASSED" || echo "# CHECK FAILED"
+exit $status
@@ -0,0 +1,756 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the 
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+
+#include "compiler.h"
+#include "dictionnary.h"
+#include "graph_handler.h"
+#include "nfa_estimator.h"
+#include "rule_parser.h"
+#include "sorting_optimiser.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace erbium {
+
+const std::string SortOptionTag[] = {"hRand", "h1Asc", "h1Des", "h2Asc", "h2Des", "hOpti"};
+
+namespace {
+
+// sink of a compilation, restored once it returns (swapped only when it differs, so that
+// concurrent compilations on the sink of the library leave it untouched)
+struct log_scope_s
+{
+    std::ostream* saved;
+
+    explicit log_scope_s(std::ostream* sink) : saved(get_log_sink())
+    {
+        if (sink != saved)
+            set_log_sink(sink);
+    }
+    ~log_scope_s()
+    {
+        if (get_log_sink() != saved)
+            set_log_sink(saved);
+    }
+};
+
+} // namespace
+
+// arbitrary positions of the H2 heuristics (key=position; value=criteria_id), empty for rule types
+// of fewer criteria than the MCT one (e.g. the other rule packs of a bundle)
+std::vector<int16_t> Compiler::get_mct_order(const rulePack_s& rulepack)
+{
+    std::vector<int16_t> arbitrary(rulepack.m_ruleType.m_criterionDefinition.size(), -1);
+    if (arbitrary.size() < 22)
+    {
+        log_printf("[!] Rule type %s has no MCT order, keeping the order of its definition\n",
+            rulepack.m_ruleType.m_code.c_str());
+        return std::vector<int16_t>();
+    }
+    arbitrary[ 0] = rulepack.m_ruleType.get_criterion_id("MCT_OFF");
+    arbitrary[ 1] = rulepack.m_ruleType.get_criterion_id("MCT_BRD");
+    arbitrary[ 2] = rulepack.m_ruleType.get_criterion_id("CTN_TYPE");
+    arbitrary[19] = rulepack.m_ruleType.get_criterion_id("MCT_PRD");
+    arbitrary[20] = rulepack.m_ruleType.get_criterion_id("OUT_FLT_RG");
+    arbitrary[21] = rulepack.m_ruleType.get_criterion_id("IN_FLT_RG");
+    return arbitrary;
+}
+
+void Compiler::sort_criteria(const SortOption& option,
+                             const rulePack_s& rulepack,
+                             Dictionnary* dic,
+                             const std::string& workload_file,
+                             const uint32_t& iterations)
+{
+    switch (option)
+    {
+        case SortOption::H1_Ascending:
+            log_stream() << "H1_Ascending sort" << std::endl;
+            dic->sort_by_n_of_values(SortOrder::Ascending);
+            break;
+
+        case SortOption::H1_Descending:
+            log_stream() << "H1_Descending sort" << std::endl;
+            dic->sort_by_n_of_values(SortOrder::Descending);
+            break;
+
+        case SortOption::H2_Ascending:
+        {
+            log_stream() << "Arbitrary order H2_Ascending" << std::endl;
+            std::vector<int16_t> arbitrary = get_mct_order(rulepack);
+            if (!arbitrary.empty())
+                dic->sort_by_n_of_values(SortOrder::Ascending, &arbitrary);
+        }
+            break;
+
+        case SortOption::H2_Descending:
+        {
+            log_stream() << "Arbitrary order H2_Descending" << std::endl;
+            std::vector<int16_t> arbitrary = get_mct_order(rulepack);
+            if (!arbitrary.empty())
+                dic->sort_by_n_of_values(SortOrder::Descending, &arbitrary);
+        }
+            break;
+
+        case SortOption::Optimised:
+        {
+            log_stream() << "Cost-model optimised order" << std::endl;
+            SortingOptimiser optimiser(rulepack, dic);
+            if (!workload_file.empty() && !optimiser.load_workload(workload_file, rulepack))
+                log_printf("[!] Failed to load workload %s, replaying rules instead\n", workload_file.c_str());
+            dic->m_sorting_map = optimiser.optimise(iterations);
+        }
+            break;
+
+        case SortOption::None:
+        default:
+            break;
+    }
+}
+
+uint32_t Compiler::expand_value_lists(rulePack_s* rulepack, const bool& keep_sets)
+{
+    std::vector<bool> criteria;
+    for (auto& aux : rulepack->m_ruleType.m_criterionDefinition)
+        criteria.push_back(!keep_sets || aux.m_isPair);
+    return rulepack->m_rules.expand_value_lists(criteria);
+}
+
+uint32_t Compiler::expand_first_level(rulePack_s* rulepack, Dictionnary* dic)
+{
+    std::vector<bool> criteria(rulepack->m_rules.n_criteria(), false);
+    criteria[dic->m_sorting_map[0]] = true;
+    const uint32_t n_added = rulepack->m_rules.expand_value_lists(criteria);
+    if (n_added > 0)
+    {
+        const sorting_map_t sorting_map = dic->m_sorting_map;
+        *dic = Dictionnary(*rulepack);
+        dic->m_sorting_map = sorting_map;
+    }
+    return n_added;
+}
+
+void Compiler::select_deterministic_levels(const rulePack_s& rulepack, Dictionnary* dic)
+{
+    // greedy: the level of best gain (backtracks avoided against transitions added) is
+    // determinised, and the hybrid image is rebuilt, until no level pays off; as the image stays
+    // partly nondeterministic, wildcard paths are only merged into specific ones on criteria of
+    // zero weight (see make_deterministic), the only candidates with pair and IN-list levels out
+    dic->m_deterministic_levels.assign(dic->m_sorting_map.size(), false);
+    int16_t added = -1;
+    log_printf("step level transitions backtracks/query | next: level +transitions     gain\n");
+    for (uint step = 0; ; step++)
+    {
+        GraphHandler probe(&rulepack, dic);
+        if (added >= 0)
+            probe.make_deterministic(0, &dic->m_deterministic_levels);
+        probe.suffix_reduction();
+        probe.consolidate_graph();
+
+        const std::vector<GraphHandler::tradeoff_s> tradeoff = probe.get_determinisation_tradeoff();
+        double backtracks = 0;
+        int16_t best = -1;
+        for (auto& aux : tradeoff)
+        {
+            backtracks += aux.backtracks;
+            const criterionDefinition_s* criterion_def =
+                &(*std::next(rulepack.m_ruleType.m_criterionDefinition.begin(), dic->m_sorting_map[aux.level]));
+            if (!dic->m_deterministic_levels[aux.level] && aux.gain > 0
+                && criterion_def->m_weight == 0 && probe.is_determinisable(aux.level)
+                && (best < 0 || aux.gain > tradeoff[best].gain))
+                best = aux.level;
+        }
+
+        log_printf("%4u %5d %11u %16.3f |", step, added, probe.get_num_transitions(), backtracks);
+        if (best < 0)
+        {
+            log_printf(" none\n");
+            break;
+        }
+        log_printf(" %11d %12d %8.3f\n", best, tradeoff[best].growth, tradeoff[best].gain);
+        dic->m_deterministic_levels[best] = true;
+        added = best;
+    }
+}
+
+rulePack_s Compiler::get_shard_pack(const rulePack_s& rulepack,
+                                    const Dictionnary* dic,
+                                    const operand_t& first,
+                                    const operand_t& last)
+{
+    const criterionid_t criterion_id = dic->m_sorting_map[0];
+    rulePack_s shard;
+    shard.m_ruleType = rulepack.m_ruleType;
+    std::vector<uint32_t> rules;
+    for (uint32_t rule = 0; rule < rulepack.m_rules.size(); rule++)
+    {
+        const operand_t value_id =
+            dic->get_valueid_by_code(criterion_id, rulepack.m_rules.get_code(rule, criterion_id));
+        if (value_id >= first && value_id <= last)
+            rules.push_back(rule);
+    }
+    shard.m_rules = rulepack.m_rules.select(rules);
+    return shard;
+}
+
+std::vector<std::pair<operand_t, operand_t>> Compiler::partition_shards(const rulePack_s& rulepack,
+                                                                        const Dictionnary* dic,
+                                                                        const uint32_t& max_depth)
+{
+    // value ids span the whole operand range: 65536 values do not fit in an operand_t count
+    const uint32_t n_values = dic->get_criterion_dic_by_level(0).size();
+    std::vector<std::pair<operand_t, operand_t>> shards;
+    if (n_values == 0)
+        return shards;
+    std::vector<std::vector<uint>> depths(n_values);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (uint32_t value = 0; value < n_values; value++)
+    {
+        NfaEstimator estimator(get_shard_pack(rulepack, dic, value, value), dic);
+        depths[value] = estimator.estimate(dic->m_sorting_map).transitions_per_level;
+    }
+
+    auto fits = [&](const std::vector<uint>& depth) {
+        return *std::max_element(depth.begin(), depth.end()) <= max_depth;
+    };
+
+    // the sum of the values is an upper bound (suffixes are shared within a shard), so the actual
+    // shard is only estimated once the bound overflows
+    uint32_t first = 0;
+    std::vector<uint> bound = depths[0];
+    for (uint32_t value = 1; value < n_values; value++)
+    {
+        std::vector<uint> candidate(bound);
+        for (size_t level = 0; level < candidate.size(); level++)
+            candidate[level] += depths[value][level];
+        if (!fits(candidate))
+        {
+            NfaEstimator estimator(get_shard_pack(rulepack, dic, first, value), dic);
+            candidate = estimator.estimate(dic->m_sorting_map).transitions_per_level;
+        }
+        if (fits(candidate))
+        {
+            bound = candidate;
+            continue;
+        }
+        shards.push_back(std::make_pair(first, value - 1));
+        first = value;
+        bound = depths[value];
+    }
+    shards.push_back(std::make_pair(first, n_values - 1));
+    return shards;
+}
+
+bool Compiler::compile_shards(const rulePack_s& rulepack,
+                              const Dictionnary* dic,
+                              const compile_options_s& options,
+                              compile_output_s* output)
+{
+    const criterionDefinition_s* criterion_def =
+        &(*std::next(rulepack.m_ruleType.m_criterionDefinition.begin(), dic->m_sorting_map[0]));
+    // transitions addressable by a pointer of a memory unit
+    const uint addressable = 1 << CFG_TRANSITION_POINTER_WIDTH;
+    if (!criterion_def->m_isMandatory)
+    {
+        log_printf("[!] Shards are routed by the first criterion, which must be mandatory (%s is not)\n",
+            criterion_def->m_code.c_str());
+        return false;
+    }
+
+    log_stream() << "# SHARDS" << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    const auto ranges = partition_shards(rulepack, dic, options.shard_depth);
+    if (ranges.empty())
+    {
+        log_printf("[!] No value of the first criterion (%s) to shard the rules by\n",
+            criterion_def->m_code.c_str());
+        return false;
+    }
+    output->shards.assign(ranges.size(), compile_shard_s());
+
+    bool overflow = false;
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t k = 0; k < ranges.size(); k++)
+    {
+        compile_shard_s& shard = output->shards[k];
+        shard.first = ranges[k].first;
+        shard.last = ranges[k].second;
+
+        const rulePack_s pack = get_shard_pack(rulepack, dic, shard.first, shard.last);
+        shard.n_rules = pack.m_rules.size();
+
+        GraphHandler nfa(&pack, dic);
+        nfa.suffix_reduction();
+        if (options.coalesce)
+        {
+            nfa.coalesce_ranges();
+            nfa.suffix_reduction();
+        }
+        if (options.disjoint)
+        {
+            nfa.split_intervals();
+            nfa.suffix_reduction();
+        }
+        nfa.consolidate_graph();
+
+        shard.n_states = nfa.get_num_states();
+        shard.n_transitions = nfa.get_num_transitions();
+        const std::vector<uint> transitions_per_level = nfa.get_transitions_per_level();
+        shard.max_depth = *std::max_element(transitions_per_level.begin(), transitions_per_level.end());
+        shard.fits = shard.max_depth <= addressable;
+
+        std::ostringstream stream;
+        try
+        {
+            if (options.image)
+            {
+                nfa.export_memory(&stream, NULL, WildcardFirst, options.image_version);
+                shard.image = stream.str();
+                stream.str("");
+            }
+            if (options.image_dfs)
+            {
+                nfa.export_memory_depth_first(&stream, NULL, WildcardFirst, options.image_version);
+                shard.image_dfs = stream.str();
+                stream.str("");
+            }
+        }
+        catch (const std::length_error& e)
+        {
+            #pragma omp critical
+            {
+                log_printf("[!] Image of shard %lu not exported: %s\n", k, e.what());
+                overflow = true;
+            }
+        }
+        if (options.vhdl && shard.fits)
+        {
+            RuleParser::export_vhdl_parameters(&stream, pack, dic, transitions_per_level);
+            shard.vhdl = stream.str();
+        }
+    }
+
+    auto finish = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = finish - start;
+
+    bool feasible = true;
+    log_printf("shard  first id  last id    rules     states  transitions  max depth\n");
+    for (size_t k = 0; k < output->shards.size(); k++)
+    {
+        const compile_shard_s& shard = output->shards[k];
+        log_printf("%5lu %9u %8u %8u %10u %12u %10u%s\n",
+            k,
+            shard.first,
+            shard.last,
+            shard.n_rules,
+            shard.n_states,
+            shard.n_transitions,
+            shard.max_depth,
+            (shard.fits) ? "" : "  infeasible");
+        feasible &= shard.fits;
+        output->n_states += shard.n_states;
+        output->n_transitions += shard.n_transitions;
+    }
+    log_stream() << "# SHARDS COMPLETED in " << elapsed.count() << " s\n";
+
+    if (!feasible)
+        log_printf("[!] A single first criterion value does not fit into the memory units (max depth %u)\n",
+            addressable);
+    return !overflow;
+}
+
+bool Compiler::compile(const rulePack_s& input,
+                       const compile_options_s& options,
+                       compile_output_s* output)
+{
+    const log_scope_s log_scope(options.log);
+    const auto start = std::chrono::high_resolution_clock::now();
+    auto stage = start;
+    std::chrono::duration<double> elapsed;
+
+    if (input.m_rules.empty() || input.m_ruleType.m_criterionDefinition.size() < 2
+        || input.m_rules.n_criteria() != input.m_ruleType.m_criterionDefinition.size())
+    {
+        log_printf("[!] Rule pack of %lu rules and %lu criteria cannot be compiled\n",
+            input.m_rules.size(), input.m_ruleType.m_criterionDefinition.size());
+        return false;
+    }
+    if (options.value_lists && options.image_version == C_IMAGE_VERSION_FIXED)
+    {
+        log_printf("[!] Value sets need a self-describing image (version 2 or 3)\n");
+        return false;
+    }
+    if (options.coalesce && options.image_version == C_IMAGE_VERSION_FIXED)
+    {
+        log_printf("[!] Coalesced ranges need a self-describing image (version 2 or 3)\n");
+        return false;
+    }
+    output->hash = 0;
+    output->n_states = 0;
+    output->n_transitions = 0;
+
+    // IN-LISTS: one rule per value, but those of the simple criteria kept as value sets (a copy of
+    // the rules is only made when some are expanded)
+    bool value_lists = options.value_lists;
+    if (value_lists && (options.dfa_budget >= 0 || options.shard_depth > 0 || options.hybrid))
+    {
+        log_printf("[!] Value sets are not supported by shards, DFA and hybrid images: IN-lists are expanded\n");
+        value_lists = false;
+    }
+    const std::vector<bool> listed = input.m_rules.get_list_criteria();
+    const bool has_lists = std::find(listed.begin(), listed.end(), true) != listed.end();
+    rulePack_s expanded;
+    uint32_t n_expanded = 0;
+    if (has_lists)
+    {
+        expanded = input;
+        n_expanded = expand_value_lists(&expanded, value_lists);
+        if (n_expanded > 0)
+            log_printf("IN-lists expanded into %u more rules\n", n_expanded);
+    }
+    const rulePack_s& rulepack = (has_lists) ? expanded : input;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // DICTIONNARY                                                                                //
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+
+    log_stream() << "# DICTIONNARY" << std::endl;
+    stage = std::chrono::high_resolution_clock::now();
+
+    // (the value ids of the snapshot are those of the rules before expansion)
+    std::shared_ptr<Dictionnary> dic =
+        std::make_shared<Dictionnary>(rulepack, (n_expanded == 0) ? options.snapshot : NULL);
+    sort_criteria(options.sorting, rulepack, dic.get(), options.workload_file, options.iterations);
+    if (has_lists && value_lists)
+    {
+        const uint32_t n_first = expand_first_level(&expanded, dic.get());
+        if (n_first > 0)
+            log_printf("IN-lists of the first level expanded into %u more rules\n", n_first);
+    }
+
+    // value ids leading to the same states become adjacent
+    if (options.coalesce)
+        dic->cluster_by_context(rulepack);
+    if (options.disjoint)
+        dic->flag_disjoint_levels(rulepack);
+
+    // expected cost of the selected order (on the sample workload if given)
+    if (get_log_sink() != NULL
+        && (options.sorting == SortOption::Optimised || !options.workload_file.empty()))
+    {
+        SortingOptimiser optimiser(rulepack, dic.get());
+        if (!options.workload_file.empty() && !optimiser.load_workload(options.workload_file, rulepack))
+            log_printf("[!] Failed to load workload %s, replaying rules instead\n", options.workload_file.c_str());
+        optimiser.print_cost(optimiser.evaluate(dic->m_sorting_map));
+    }
+
+    std::ostringstream stream;
+    auto take = [&stream](std::string* buffer) {
+        *buffer = stream.str();
+        stream.str("");
+    };
+    if (options.dictionnary)
+    {
+        dic->dump_dictionnary(&stream);
+        take(&output->dictionnary);
+        dic->dump_criteria(&stream, rulepack);
+        take(&output->criteria);
+    }
+    output->dic = dic;
+    output->n_rules = rulepack.m_rules.size();
+
+    elapsed = std::chrono::high_resolution_clock::now() - stage;
+    log_stream() << "# DICTIONNARY COMPLETED in " << elapsed.count() << " s\n";
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // ESTIMATE                                                                                   //
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+
+    if (options.estimate_only)
+    {
+        log_stream() << "# ESTIMATE" << std::endl;
+        stage = std::chrono::high_resolution_clock::now();
+
+        NfaEstimator estimator(rulepack, dic.get());
+        const auto estimate = estimator.estimate(dic->m_sorting_map);
+        output->n_states = estimate.n_states;
+        output->n_transitions = estimate.n_transitions;
+        output->transitions_per_level = estimate.transitions_per_level;
+
+        elapsed = std::chrono::high_resolution_clock::now() - stage;
+        estimator.print_estimate(estimate);
+        log_stream() << "estimated number of states: " << estimate.n_states << std::endl;
+        log_stream() << "estimated number of transitions: " << estimate.n_transitions << std::endl;
+        log_stream() << "# ESTIMATE COMPLETED in " << elapsed.count() << " s\n";
+
+        elapsed = std::chrono::high_resolution_clock::now() - start;
+        output->elapsed = elapsed.count();
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // PRUNE                                                                                      //
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+
+    // the dictionnary and the workload keep every rule, the graphs are built without dead ones
+    rulePack_s pruned;
+    if (options.prune)
+    {
+        log_stream() << "# PRUNE" << std::endl;
+        stage = std::chrono::high_resolution_clock::now();
+
+        pruned = rulepack;
+        uint32_t n_duplicates;
+        const uint32_t n_removed = pruned.remove_dominated_rules(&n_duplicates);
+        log_stream() << "dominated rules removed: " << n_removed << " (" << n_duplicates << " duplicated, "
+                     << n_removed - n_duplicates << " covered)" << std::endl;
+        if (get_log_sink() != NULL)
+        {
+            NfaEstimator full_estimator(rulepack, dic.get());
+            NfaEstimator pruned_estimator(pruned, dic.get());
+            const uint32_t n_transitions = full_estimator.estimate(dic->m_sorting_map).n_transitions;
+            const uint32_t n_pruned = pruned_estimator.estimate(dic->m_sorting_map).n_transitions;
+            log_stream() << "transitions removed: " << n_transitions - n_pruned << std::endl;
+        }
+
+        elapsed = std::chrono::high_resolution_clock::now() - stage;
+        log_stream() << "# PRUNE COMPLETED in " << elapsed.count() << " s\n";
+    }
+    const rulePack_s* compiled = (options.prune) ? &pruned : &rulepack;
+    output->n_rules = compiled->m_rules.size();
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // SHARDS                                                                                     //
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+
+    if (options.shard_depth > 0)
+    {
+        if (options.hybrid || options.dfa_budget >= 0)
+            log_printf("[!] Shards are nondeterministic: DFA and hybrid images are not compiled\n");
+        if (!compile_shards(*compiled, dic.get(), options, output))
+            return false;
+    }
+    else
+    {
+        ////////////////////////////////////////////////////////////////////////////////////////////
+        // GRAPH                                                                                  //
+        ////////////////////////////////////////////////////////////////////////////////////////////
+
+        // prefix tree of the rules, only built for its graphviz export
+        if (options.graphviz)
+        {
+            log_stream() << "# GRAPH" << std::endl;
+            stage = std::chrono::high_resolution_clock::now();
+
+            GraphHandler tree(compiled, dic.get());
+            tree.consolidate_graph();
+
+            elapsed = std::chrono::high_resolution_clock::now() - stage;
+            log_stream() << "number of states: " << tree.get_num_states() << std::endl;
+            log_stream() << "number of transitions: " << tree.get_num_transitions() << std::endl;
+            log_stream() << "# GRAPH COMPLETED in " << elapsed.count() << " s\n";
+
+            tree.export_graphviz(&stream);
+            take(&output->graphviz_tree);
+        }
+
+        ////////////////////////////////////////////////////////////////////////////////////////////
+        // DFA                                                                                    //
+        ////////////////////////////////////////////////////////////////////////////////////////////
+
+        if (options.dfa_budget >= 0)
+        {
+            log_stream() << "# DFA" << std::endl;
+
+            GraphHandler dfa(compiled, dic.get());
+            stage = std::chrono::high_resolution_clock::now();
+
+            std::vector<bool> determinised;
+            const uint n_levels = dfa.make_deterministic(options.dfa_budget, NULL, &determinised);
+            dfa.suffix_reduction();
+            dfa.consolidate_graph();
+
+            elapsed = std::chrono::high_resolution_clock::now() - stage;
+            log_stream() << "determinised levels: " << n_levels << "/" << dic->m_sorting_map.size() << std::endl;
+            log_stream() << "number of states: " << dfa.get_num_states() << std::endl;
+            log_stream() << "number of transitions: " << dfa.get_num_transitions() << std::endl;
+            log_stream() << "# DFA COMPLETED in " << elapsed.count() << " s\n";
+
+            // the header tells the engine which levels hold one transition per value (strict match)
+            dic->m_deterministic_levels = determinised;
+            dfa.export_memory(&stream, NULL, WildcardFirst, options.image_version);
+            take(&output->dfa_image);
+            dic->m_deterministic_levels.assign(dic->m_sorting_map.size(), false);
+        }
+
+        ////////////////////////////////////////////////////////////////////////////////////////////
+        // NFA                                                                                    //
+        ////////////////////////////////////////////////////////////////////////////////////////////
+
+        log_stream() << "# NFA" << std::endl;
+
+        GraphHandler nfa(compiled, dic.get());
+        stage = std::chrono::high_resolution_clock::now();
+
+        if (options.hybrid)
+        {
+            select_deterministic_levels(*compiled, dic.get());
+            const std::vector<bool> selected = dic->m_deterministic_levels;
+            const uint n_levels = nfa.make_deterministic(0, &selected, &dic->m_deterministic_levels);
+            log_stream() << "determinised levels: " << n_levels << "/" << dic->m_sorting_map.size() << std::endl;
+        }
+
+        nfa.suffix_reduction();
+        if (options.coalesce)
+        {
+            const uint n_coalesced = nfa.coalesce_ranges();
+            nfa.suffix_reduction();
+            log_stream() << "coalesced transitions: " << n_coalesced << std::endl;
+        }
+        if (options.disjoint)
+        {
+            const uint n_split = nfa.split_intervals();
+            nfa.suffix_reduction();
+            log_stream() << "disjoint interval states: " << n_split << std::endl;
+        }
+        nfa.consolidate_graph();
+
+        elapsed = std::chrono::high_resolution_clock::now() - stage;
+        log_stream() << "number of states: " << nfa.get_num_states() << std::endl;
+        log_stream() << "number of transitions: " << nfa.get_num_transitions() << std::endl;
+        log_stream() << "# NFA COMPLETED in " << elapsed.count() << " s\n";
+
+        output->hash = nfa.get_graph_hash();
+        output->n_states = nfa.get_num_states();
+        output->n_transitions = nfa.get_num_transitions();
+        output->transitions_per_level = nfa.get_transitions_per_level();
+
+        if (get_log_sink() != NULL)
+        {
+            log_stream() << "# NFA FINAL STATS" << std::endl;
+            nfa.print_stats();
+            log_stream() << "total number of states: " << output->n_states << std::endl;
+            log_stream() << "total number of transitions: " << output->n_transitions << std::endl;
+        }
+
+        ////////////////////////////////////////////////////////////////////////////////////////////
+        // EXPORTS                                                                                //
+        ////////////////////////////////////////////////////////////////////////////////////////////
+
+        if (options.vhdl)
+        {
+            // left empty (with a warning) when a level does not fit into the memory units or holds
+            // value sets
+            log_stream() << "# EXPORT CORE PARAMETERS" << std::endl;
+            RuleParser::export_vhdl_parameters(&stream, rulepack, dic.get(), output->transitions_per_level,
+                                               options.transition_layout <= 1); // wildcards first
+            take(&output->vhdl);
+        }
+        if (options.graphviz)
+        {
+            log_stream() << "# EXPORT GRAPHVIZ DOT FILE" << std::endl;
+            nfa.export_graphviz(&stream);
+            take(&output->graphviz);
+        }
+
+        if (options.image || options.image_dfs)
+        {
+            log_stream() << "# MEMORY DUMP" << std::endl;
+            stage = std::chrono::high_resolution_clock::now();
+
+            // hottest transitions first within each fan-out block, as seen by the sample workload
+            value_frequencies_t frequencies;
+            const WildcardPolicy wildcard_policy = static_cast<WildcardPolicy>(
+                (options.transition_layout > 0) ? options.transition_layout - 1 : 0);
+            if (options.transition_layout > 0)
+            {
+                SortingOptimiser profiler(rulepack, dic.get());
+                if (!options.workload_file.empty() && !profiler.load_workload(options.workload_file, rulepack))
+                    log_printf("[!] Failed to load workload %s, replaying rules instead\n",
+                        options.workload_file.c_str());
+                frequencies = profiler.get_value_frequencies();
+
+                log_printf("transitions scanned per query (strict match): %.2f value-sorted; %.2f hottest first\n",
+                    profiler.get_scanned_transitions(dic->m_sorting_map),
+                    profiler.get_scanned_transitions(dic->m_sorting_map, &frequencies, wildcard_policy));
+                if (wildcard_policy != WildcardFirst)
+                    log_printf("[!] Wildcards may follow the specific transitions: "
+                               "the simple levels run a full iteration\n");
+            }
+
+            try
+            {
+                if (options.image)
+                {
+                    nfa.export_memory(&stream,
+                                      (options.transition_layout > 0) ? &frequencies : NULL,
+                                      wildcard_policy,
+                                      options.image_version);
+                    take(&output->image);
+                }
+                if (options.image_dfs)
+                {
+                    nfa.export_memory_depth_first(&stream,
+                                                  (options.transition_layout > 0) ? &frequencies : NULL,
+                                                  wildcard_policy,
+                                                  options.image_version);
+                    take(&output->image_dfs);
+                }
+            }
+            catch (const std::length_error& e)
+            {
+                log_printf("[!] Image not exported: %s\n", e.what());
+                return false;
+            }
+
+            elapsed = std::chrono::high_resolution_clock::now() - stage;
+            log_stream() << "NFA hash: " << output->hash << std::endl;
+            log_stream() << "# MEMORY DUMP COMPLETED in " << elapsed.count() << " s\n";
+        }
+    }
+
+    if (options.workload)
+    {
+        log_stream() << "# WORKLOAD DUMP" << std::endl;
+        stage = std::chrono::high_resolution_clock::now();
+
+        std::ostringstream benchfile;
+        RuleParser::export_benchmark_workload(&stream, &benchfile, rulepack, dic.get(), options.image_version);
+        take(&output->workload_csv);
+        output->workload_bin = benchfile.str();
+
+        elapsed = std::chrono::high_resolution_clock::now() - stage;
+        log_stream() << "# WORKLOAD DUMP COMPLETED in " << elapsed.count() << " s\n";
+    }
+
+    elapsed = std::chrono::high_resolution_clock::now() - start;
+    output->elapsed = elapsed.count();
+    return true;
+}
+
+} // namespace erbium
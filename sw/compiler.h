@@ -0,0 +1,175 @@
+#ifndef ERBIUM_COMPILER_H
+#define ERBIUM_COMPILER_H
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the 
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "definitions.h"
+
+namespace erbium {
+
+class Dictionnary;
+
+// orders of the criteria (see erbium -s)
+enum SortOption { None, H1_Ascending, H1_Descending, H2_Ascending, H2_Descending, Optimised };
+extern const std::string SortOptionTag[];
+
+// what to compile and which exports to produce; the exports are left empty unless requested
+struct compile_options_s
+{
+    SortOption sorting       = H2_Descending;
+    uint32_t   iterations    = 200;   // optimiser iterations (sorting Optimised)
+    std::string workload_file;        // sample workload (benchmark.bin) of the optimiser and of the
+                                      // hottest-first layouts, the rules are replayed if empty
+    SnapshotReader* snapshot = NULL;  // initial dictionnary of the rules (the reader left at its
+                                      // section), unless IN-lists are expanded
+    bool       prune         = false; // remove the dominated rules before building the graph
+    bool       coalesce      = false; // adjacent equality transitions into ranges
+    bool       disjoint      = false; // overlapping pair transitions into disjoint intervals
+    bool       value_lists   = false; // IN-lists of the simple criteria as value sets (-v 2 or 3),
+                                      // expanded anyway with shards, DFA and hybrid images
+    bool       hybrid        = false; // determinise the levels selected by the cost model
+    int32_t    dfa_budget    = -1;    // >= 0: also a DFA bounded to this number of states
+                                      // (0 = unbounded)
+    uint32_t   shard_depth   = 0;     // > 0: one NFA per range of first criterion values, of at
+                                      // most this many transitions per level (see shards)
+    uint32_t   transition_layout = 0; // 0=Sorted 1=Hot_WildcardFirst 2=Hot_WildcardLast 3=Hot
+    uint32_t   image_version = C_IMAGE_VERSION_FIXED;
+    bool       estimate_only = false; // the dictionnary and the estimated NFA size, no graph
+
+    bool       image         = true;  // mem_nfa_edges.bin
+    bool       image_dfs     = false; // mem_nfa_edges_dfs.bin (CPU engine only)
+    bool       dictionnary   = true;  // dictionnary.csv and criteria.csv
+    bool       vhdl          = false; // cfg_criteria_<sorting>.vhd (left empty, with a warning, if
+                                      // a level exceeds the memory depth of the engine or holds
+                                      // value sets)
+    bool       graphviz      = false; // graphviz_tree.dot and graphviz_nfa.dot (seconds on large
+                                      // graphs)
+    bool       workload      = false; // benchmark.csv and benchmark.bin
+
+    // progress, statistics and warnings of the compilation; NULL silences them (the sink of the
+    // library, std::cout unless set_log_sink, by default)
+    std::ostream* log = get_log_sink();
+};
+
+// NFA of a range of first criterion values (compile_options_s::shard_depth)
+struct compile_shard_s
+{
+    operand_t   first;                // value ids of the first criterion
+    operand_t   last;
+    uint32_t    n_rules;
+    uint32_t    n_states;
+    uint32_t    n_transitions;
+    uint        max_depth;
+    bool        fits;                 // into the memory units of the engine
+    std::string image;
+    std::string image_dfs;
+    std::string vhdl;                 // cfg_criteria_<sorting>_<shard>.vhd, empty unless it fits
+};
+
+// in-memory counterparts of the files of the erbium executable
+struct compile_output_s
+{
+    std::string image;
+    std::string image_dfs;
+    std::string dfa_image;            // mem_dfa_edges.bin (dfa_budget)
+    std::string dictionnary;
+    std::string criteria;
+    std::string vhdl;
+    std::string graphviz_tree;
+    std::string graphviz;
+    std::string workload_csv;
+    std::string workload_bin;
+    std::vector<compile_shard_s> shards; // routed by the value id of the first criterion
+
+    std::shared_ptr<Dictionnary> dic; // value ids of the queries (always set)
+    uint64_t hash;                    // 0 for estimates and shards
+    uint32_t n_rules;                 // compiled ones, after pruning
+    uint32_t n_states;                // estimated ones with estimate_only, summed over the shards
+    uint32_t n_transitions;
+    std::vector<uint> transitions_per_level;
+    double   elapsed;                 // in seconds
+};
+
+// compile-to-memory API of the erbium library (liberbium.a, liberbium.so): rules are given in
+// memory (rulePack_s::load_ruleType and load_rules also read streams and buffers) and nothing is
+// written to disk
+class Compiler
+{
+  public:
+    // false if the rules cannot be compiled with these options or an image overflows its format;
+    // options.log is the sink of the library for the time of the call, so concurrent compilations
+    // share one sink
+    static bool compile(const rulePack_s& rulepack,
+                        const compile_options_s& options,
+                        compile_output_s* output);
+
+    // orders the criteria of the dictionnary according to the sorting option (workload_file is
+    // the sample workload of the optimiser, the rules are replayed if empty)
+    static void sort_criteria(const SortOption& option,
+                              const rulePack_s& rulepack,
+                              Dictionnary* dic,
+                              const std::string& workload_file,
+                              const uint32_t& iterations);
+
+    // expands the IN-lists (A|B) into one rule per value, but those of the simple criteria when
+    // they are kept as set-membership transitions; returns the number of rules added
+    static uint32_t expand_value_lists(rulePack_s* rulepack, const bool& keep_sets);
+
+    // the first level is indexed by value id: its IN-lists are expanded once the sorting is known,
+    // and the dictionnary rebuilt with the same order; returns the number of rules added
+    static uint32_t expand_first_level(rulePack_s* rulepack, Dictionnary* dic);
+
+  private:
+    Compiler();
+
+    // greedy selection of the levels of a hybrid image, flagged in dic->m_deterministic_levels
+    static void select_deterministic_levels(const rulePack_s& rulepack, Dictionnary* dic);
+
+    // rules of the pack whose first criterion value id lies in [first, last]
+    static rulePack_s get_shard_pack(const rulePack_s& rulepack,
+                                     const Dictionnary* dic,
+                                     const operand_t& first,
+                                     const operand_t& last);
+
+    // consecutive ranges of first criterion values whose NFA fits max_depth transitions per level
+    // (none if the first criterion has no value)
+    static std::vector<std::pair<operand_t, operand_t>> partition_shards(const rulePack_s& rulepack,
+                                                                         const Dictionnary* dic,
+                                                                         const uint32_t& max_depth);
+
+    // compiles one NFA per shard concurrently into output->shards
+    static bool compile_shards(const rulePack_s& rulepack,
+                               const Dictionnary* dic,
+                               const compile_options_s& options,
+                               compile_output_s* output);
+
+    // arbitrary positions of the H2 heuristics (key=position; value=criteria_id)
+    static std::vector<int16_t> get_mct_order(const rulePack_s& rulepack);
+};
+
+} // namespace erbium
+
+#endif // ERBIUM_COMPILER_H
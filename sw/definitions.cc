@@ -24,53 +24,121 @@
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/foreach.hpp>
 
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <omp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "definitions.h"
+#include "rule_parser.h"
+#include "snapshot.h"
 
 namespace erbium {
 
-class CSVRow
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// LOG                                                                                            //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+std::ostream  g_null_log(NULL); // without a buffer, everything written is discarded
+std::ostream* g_log_sink = &std::cout;
+}
+
+void set_log_sink(std::ostream* sink)
 {
-public:
-    std::vector<std::string> m_data;
-    
-    std::string const& operator[](std::size_t index) const
-    {
-        return m_data[index];
-    }
-    std::size_t size() const
-    {
-        return m_data.size();
-    }
-    std::string get_value(std::size_t index)
+    g_log_sink = sink;
+}
+
+std::ostream* get_log_sink()
+{
+    return g_log_sink;
+}
+
+std::ostream& log_stream()
+{
+    return (g_log_sink != NULL) ? *g_log_sink : g_null_log;
+}
+
+void log_printf(const char* format, ...)
+{
+    if (g_log_sink == NULL)
+        return;
+
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    const int size = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (size < (int)sizeof(buffer))
     {
-        // REMOVE " "
-        return m_data[index].substr(1, m_data[index].size()-2);
+        g_log_sink->write(buffer, std::max(size, 0));
+        return;
     }
-    void readNextRow(std::istream& str)
-    {
-        std::string line;
-        std::string cell;
+    std::vector<char> message(size + 1);
+    va_start(args, format);
+    vsnprintf(message.data(), message.size(), format, args);
+    va_end(args);
+    g_log_sink->write(message.data(), size);
+}
 
-        std::getline(str, line);
-        std::stringstream lineStream(line);
+// cell of a CSV line, without its quotes
+struct csv_cell_s
+{
+    const char* begin;
+    const char* end;
+    bool quoted;
+};
 
-        m_data.clear();
-        while(std::getline(lineStream, cell, ','))
+// splits a line into cells; quoted cells may hold commas and doubled quotes (memchr scans for the
+// delimiters with the vector instructions of the C library)
+void split_csv_line(const char* cursor, const char* end, std::vector<csv_cell_s>* cells)
+{
+    cells->clear();
+    while (true)
+    {
+        csv_cell_s cell;
+        cell.quoted = (cursor < end && *cursor == '"');
+        if (cell.quoted)
         {
-            m_data.push_back(cell);
+            cell.begin = ++cursor;
+            while ((cursor = (const char*)memchr(cursor, '"', end - cursor)) != NULL
+                   && cursor + 1 < end && cursor[1] == '"')
+                cursor += 2;
+            cell.end = (cursor == NULL) ? end : cursor;
+            cursor = (cursor == NULL) ? NULL : (const char*)memchr(cursor, ',', end - cursor);
         }
-        // This checks for a trailing comma with no data after it.
-        if (!lineStream && cell.empty())
+        else
         {
-            // If there was a trailing comma then add an empty element.
-            m_data.push_back("");
+            cell.begin = cursor;
+            cursor = (const char*)memchr(cursor, ',', end - cursor);
+            cell.end = (cursor == NULL) ? end : cursor;
         }
+        cells->push_back(cell);
+        if (cursor == NULL)
+            break;
+        cursor++;
     }
-};
-std::istream& operator>>(std::istream& str, CSVRow& data)
+}
+
+std::string get_csv_value(const csv_cell_s& cell)
 {
-    data.readNextRow(str);
-    return str;
+    std::string value(cell.begin, cell.end);
+    if (cell.quoted)
+    {
+        for (size_t pos = value.find("\"\""); pos != std::string::npos; pos = value.find("\"\"", pos + 1))
+            value.erase(pos, 1);
+    }
+    return value;
 }
 
 void erbium::abr_dataset_s::load(const std::string& filename)
@@ -115,6 +183,9 @@ void erbium::abr_dataset_s::load(const std::string& filename)
                             aux_criterionDef.m_isMandatory = aux_b.second.get("<xmlattr>.isMandatory",false);
                             aux_criterionDef.m_supertag = aux_b.second.get<std::string>("criterionType.<xmlattr>.supertag");
                             aux_criterionDef.m_weight = aux_b.second.get<weight_t>("criterionWeight.<xmlattr>.weight");
+                            // no criterion type reference: matched on equality of the value ids
+                            aux_criterionDef.m_functor = 60;
+                            aux_criterionDef.m_isPair = false;
                             aux_ruleType.m_criterionDefinition.insert(aux_criterionDef);
                         }
                         //printf("[%s] %s\n", aux_b.first.c_str(), aux_b.second.data().c_str());
@@ -125,59 +196,659 @@ void erbium::abr_dataset_s::load(const std::string& filename)
                 else if (!strcmp(aux_a.first.c_str(), "rule"))
                 {
                     // RULE
-                    rule_s aux_rule;
-                    aux_rule.m_ruleId  = aux_a.second.get<ruleid_t>("<xmlattr>.ruleId");
-                    aux_rule.m_weight  = aux_a.second.get<weight_t>("weight");
-                    aux_rule.m_content = aux_a.second.get<std::string>("content");
+                    std::map<criterionid_t, std::string> aux_criteria;
                     BOOST_FOREACH(boost::property_tree::ptree::value_type &aux_b, aux_a.second.get_child("criteria"))
                     {
                         //printf("[%s]\n", aux_b.first.c_str());
-
-                        criterion_s aux_criterion;
-                        aux_criterion.m_index = aux_b.second.get<criterionid_t>("<xmlattr>.index");
-                        aux_criterion.m_value = aux_b.second.get<std::string>("value");
-                        aux_rule.m_criteria.insert(aux_criterion);
+                        aux_criteria.emplace(aux_b.second.get<criterionid_t>("<xmlattr>.index"),
+                                             aux_b.second.get<std::string>("value"));
                     }
-                    
-                    aux_rulePack.m_rules.insert(aux_rule);
+                    std::vector<std::string> aux_values;
+                    for (auto& aux_c : aux_criteria)
+                        aux_values.push_back(aux_c.second);
+
+                    aux_rulePack.m_rules.add_rule(aux_a.second.get<ruleid_t>("<xmlattr>.ruleId"),
+                                                  aux_a.second.get<weight_t>("weight"),
+                                                  aux_values,
+                                                  aux_a.second.get<std::string>("content"));
                 }
             }
+            aux_rulePack.m_rules.sort_rules();
             m_rulePacks.insert(aux_rulePack);
         }
     }
 }
 
-void erbium::rulePack_s::load_rules(const std::string& filename)
+std::vector<std::string> split_value_list(const std::string& value)
+{
+    std::vector<std::string> members;
+    size_t first = 0;
+    for (size_t last; (last = value.find(C_VALUE_LIST_SEPARATOR, first)) != std::string::npos; first = last + 1)
+        members.push_back(value.substr(first, last - first));
+    members.push_back(value.substr(first));
+    return members;
+}
+
+std::string canonical_value_list(const std::string& value)
+{
+    std::vector<std::string> members = split_value_list(value);
+    members.erase(std::remove(members.begin(), members.end(), ""), members.end());
+    std::sort(members.begin(), members.end());
+    members.erase(std::unique(members.begin(), members.end()), members.end());
+    if (members.empty() || std::find(members.begin(), members.end(), "*") != members.end())
+        return "*";
+
+    std::string result = members[0];
+    for (size_t i = 1; i < members.size(); i++)
+        result += C_VALUE_LIST_SEPARATOR + members[i];
+    return result;
+}
+
+template <typename T>
+std::vector<T> gather_rows(const std::vector<T>& column, const std::vector<uint32_t>& rules)
+{
+    std::vector<T> result;
+    result.reserve(rules.size());
+    for (auto& rule : rules)
+        result.push_back(column[rule]);
+    return result;
+}
+
+void erbium::ruleStore_s::reset(const criterionid_t& n_criteria)
+{
+    m_ruleIds.clear();
+    m_weights.clear();
+    m_columns.assign(n_criteria + 1, std::vector<operand_t>());
+    m_pools.assign(n_criteria + 1, std::vector<std::string>());
+    m_codes.assign(n_criteria + 1, std::unordered_map<std::string, operand_t>());
+}
+
+operand_t erbium::ruleStore_s::intern(const criterionid_t& column, const std::string& value)
+{
+    std::unordered_map<std::string, operand_t>& codes = m_codes[column];
+    std::vector<std::string>& pool = m_pools[column];
+
+    // selections do not carry the lookup of their pools
+    if (codes.size() != pool.size())
+    {
+        codes.clear();
+        for (size_t code = 0; code < pool.size(); code++)
+            codes.emplace(pool[code], code);
+    }
+
+    auto aux = codes.emplace(value, pool.size());
+    if (aux.second)
+    {
+        if (pool.size() > std::numeric_limits<operand_t>::max())
+        {
+            codes.erase(aux.first);
+            throw std::length_error("column " + std::to_string(column) + " exceeds "
+                                    + std::to_string(pool.size()) + " values");
+        }
+        pool.push_back(value);
+    }
+    return aux.first->second;
+}
+
+void erbium::ruleStore_s::add_rule(const ruleid_t& rule_id, const weight_t& weight,
+                                   const std::vector<std::string>& values, const std::string& content)
+{
+    if (m_columns.empty())
+        reset(values.size());
+    if (values.size() != n_criteria())
+        throw std::invalid_argument("rule " + std::to_string(rule_id) + " has "
+                                    + std::to_string(values.size()) + " criteria");
+
+    std::vector<operand_t> codes(values.size() + 1);
+    for (criterionid_t criterion_id = 0; criterion_id < values.size(); criterion_id++)
+        codes[criterion_id] = (is_value_list(values[criterion_id]))
+                            ? intern(criterion_id, canonical_value_list(values[criterion_id]))
+                            : intern(criterion_id, values[criterion_id]);
+    codes.back() = intern(values.size(), content);
+
+    m_ruleIds.push_back(rule_id);
+    m_weights.push_back(weight);
+    for (size_t column = 0; column < codes.size(); column++)
+        m_columns[column].push_back(codes[column]);
+}
+
+void erbium::ruleStore_s::append(const ruleStore_s& other)
+{
+    if (other.empty())
+        return;
+    if (m_columns.empty())
+        reset(other.n_criteria());
+    if (other.m_columns.size() != m_columns.size())
+        throw std::invalid_argument("rules of " + std::to_string(other.n_criteria()) + " criteria");
+
+    std::vector<std::vector<operand_t>> translation(m_columns.size());
+    for (size_t column = 0; column < m_columns.size(); column++)
+    {
+        for (auto& value : other.m_pools[column])
+            translation[column].push_back(intern(column, value));
+    }
+
+    m_ruleIds.insert(m_ruleIds.end(), other.m_ruleIds.begin(), other.m_ruleIds.end());
+    m_weights.insert(m_weights.end(), other.m_weights.begin(), other.m_weights.end());
+    for (size_t column = 0; column < m_columns.size(); column++)
+    {
+        m_columns[column].reserve(m_columns[column].size() + other.size());
+        for (auto& code : other.m_columns[column])
+            m_columns[column].push_back(translation[column][code]);
+    }
+}
+
+void erbium::ruleStore_s::sort_rules()
+{
+    bool sorted = true;
+    for (size_t rule = 1; rule < size() && sorted; rule++)
+        sorted = m_ruleIds[rule - 1] < m_ruleIds[rule];
+    if (sorted)
+        return;
+
+    std::vector<uint32_t> order(size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+        [this](const uint32_t& a, const uint32_t& b) { return m_ruleIds[a] < m_ruleIds[b]; });
+    order.erase(std::unique(order.begin(), order.end(),
+        [this](const uint32_t& a, const uint32_t& b) { return m_ruleIds[a] == m_ruleIds[b]; }),
+        order.end());
+
+    m_ruleIds = gather_rows(m_ruleIds, order);
+    m_weights = gather_rows(m_weights, order);
+    for (auto& column : m_columns)
+        column = gather_rows(column, order);
+}
+
+erbium::ruleStore_s erbium::ruleStore_s::select(const std::vector<uint32_t>& rules) const
+{
+    ruleStore_s result;
+    result.m_ruleIds = gather_rows(m_ruleIds, rules);
+    result.m_weights = gather_rows(m_weights, rules);
+    for (auto& column : m_columns)
+        result.m_columns.push_back(gather_rows(column, rules));
+    result.m_pools = m_pools;
+    result.m_codes.resize(m_codes.size());
+    return result;
+}
+
+uint32_t erbium::ruleStore_s::expand_value_lists(const std::vector<bool>& criteria)
+{
+    // codes of the members of each pooled list (none for plain values)
+    std::vector<std::vector<std::vector<operand_t>>> members(n_criteria()); // per criterion > per code
+    bool any = false;
+    for (criterionid_t column = 0; column < n_criteria() && column < criteria.size(); column++)
+    {
+        if (!criteria[column])
+            continue;
+        const size_t pool_size = m_pools[column].size();
+        members[column].resize(pool_size);
+        for (size_t code = 0; code < pool_size; code++)
+        {
+            if (!is_value_list(m_pools[column][code]))
+                continue;
+            for (auto& member : split_value_list(m_pools[column][code]))
+                members[column][code].push_back(intern(column, member));
+            any = true;
+        }
+    }
+    if (!any)
+        return 0;
+
+    // odometer over the members of the listed criteria of each rule
+    std::vector<ruleid_t> rule_ids;
+    std::vector<weight_t> weights;
+    std::vector<std::vector<operand_t>> columns(m_columns.size());
+    std::vector<operand_t> codes(m_columns.size());
+    std::vector<criterionid_t> listed;
+    std::vector<size_t> digits;
+    for (uint32_t rule = 0; rule < size(); rule++)
+    {
+        listed.clear();
+        for (size_t column = 0; column < m_columns.size(); column++)
+        {
+            codes[column] = m_columns[column][rule];
+            if (column < members.size() && !members[column].empty() && !members[column][codes[column]].empty())
+                listed.push_back(column);
+        }
+        digits.assign(listed.size(), 0);
+        while (true)
+        {
+            for (size_t k = 0; k < listed.size(); k++)
+                codes[listed[k]] = members[listed[k]][m_columns[listed[k]][rule]][digits[k]];
+            rule_ids.push_back(m_ruleIds[rule]);
+            weights.push_back(m_weights[rule]);
+            for (size_t column = 0; column < m_columns.size(); column++)
+                columns[column].push_back(codes[column]);
+
+            size_t k = 0;
+            for (; k < listed.size(); k++)
+            {
+                if (++digits[k] < members[listed[k]][m_columns[listed[k]][rule]].size())
+                    break;
+                digits[k] = 0;
+            }
+            if (k == listed.size())
+                break;
+        }
+    }
+
+    const uint32_t n_added = rule_ids.size() - size();
+    m_ruleIds.swap(rule_ids);
+    m_weights.swap(weights);
+    m_columns.swap(columns);
+    return n_added;
+}
+
+std::vector<bool> erbium::ruleStore_s::get_list_criteria() const
+{
+    std::vector<bool> result(n_criteria(), false);
+    for (criterionid_t column = 0; column < n_criteria(); column++)
+    {
+        std::vector<bool> used(m_pools[column].size(), false);
+        for (auto& code : m_columns[column])
+            used[code] = true;
+        for (size_t code = 0; code < used.size() && !result[column]; code++)
+            result[column] = used[code] && is_value_list(m_pools[column][code]);
+    }
+    return result;
+}
+
+void erbium::ruleStore_s::save(SnapshotWriter* snapshot) const
+{
+    snapshot->put(m_ruleIds);
+    snapshot->put(m_weights);
+    snapshot->put<uint64_t>(m_columns.size());
+    for (size_t column = 0; column < m_columns.size(); column++)
+    {
+        snapshot->put(m_columns[column]);
+        snapshot->put(m_pools[column]);
+    }
+}
+
+bool erbium::ruleStore_s::load(SnapshotReader* snapshot)
+{
+    uint64_t n_columns;
+    snapshot->get(&m_ruleIds);
+    snapshot->get(&m_weights);
+    snapshot->get(&n_columns);
+
+    bool valid = snapshot->good() && n_columns > 0 && n_columns <= UINT16_MAX
+              && m_weights.size() == m_ruleIds.size();
+    if (valid)
+    {
+        m_columns.resize(n_columns);
+        m_pools.resize(n_columns);
+        m_codes.assign(n_columns, std::unordered_map<std::string, operand_t>());
+    }
+    for (size_t column = 0; valid && column < n_columns; column++)
+    {
+        snapshot->get(&m_columns[column]);
+        snapshot->get(&m_pools[column]);
+        valid = snapshot->good() && m_columns[column].size() == m_ruleIds.size()
+             && m_pools[column].size() <= (size_t)std::numeric_limits<operand_t>::max() + 1
+             && std::all_of(m_columns[column].begin(), m_columns[column].end(),
+                    [&](const operand_t& code) { return code < m_pools[column].size(); });
+    }
+    if (!valid)
+        *this = ruleStore_s();
+    return valid;
+}
+
+void erbium::ruleType_s::save(SnapshotWriter* snapshot) const
+{
+    snapshot->put(m_organization);
+    snapshot->put(m_code);
+    snapshot->put(m_description);
+    snapshot->put(m_release);
+    snapshot->put<uint64_t>(m_criterionDefinition.size());
+    for (auto& aux : m_criterionDefinition)
+    {
+        snapshot->put(aux.m_index);
+        snapshot->put(aux.m_code);
+        snapshot->put(aux.m_isMandatory);
+        snapshot->put(aux.m_supertag);
+        snapshot->put(aux.m_functor);
+        snapshot->put(aux.m_weight);
+        snapshot->put(aux.m_isPair);
+    }
+}
+
+void erbium::ruleType_s::load(SnapshotReader* snapshot)
+{
+    uint64_t n_criteria;
+    snapshot->get(&m_organization);
+    snapshot->get(&m_code);
+    snapshot->get(&m_description);
+    snapshot->get(&m_release);
+    snapshot->get(&n_criteria);
+    m_criterionDefinition.clear();
+    for (uint64_t i = 0; i < n_criteria && snapshot->good(); i++)
+    {
+        criterionDefinition_s aux_criterionDef;
+        snapshot->get(&aux_criterionDef.m_index);
+        snapshot->get(&aux_criterionDef.m_code);
+        snapshot->get(&aux_criterionDef.m_isMandatory);
+        snapshot->get(&aux_criterionDef.m_supertag);
+        snapshot->get(&aux_criterionDef.m_functor);
+        snapshot->get(&aux_criterionDef.m_weight);
+        snapshot->get(&aux_criterionDef.m_isPair);
+        m_criterionDefinition.insert(aux_criterionDef);
+    }
+}
+
+void erbium::rulePack_s::save(SnapshotWriter* snapshot) const
+{
+    m_ruleType.save(snapshot);
+    m_rules.save(snapshot);
+}
+
+bool erbium::rulePack_s::load(SnapshotReader* snapshot)
+{
+    m_ruleType.load(snapshot);
+    return snapshot->good() && m_rules.load(snapshot)
+        && m_rules.n_criteria() == m_ruleType.m_criterionDefinition.size();
+}
+
+void erbium::abr_dataset_s::save(const std::string& filename)
+{
+    // each pack is followed by the size of its dictionnary section (none here)
+    SnapshotWriter snapshot;
+    snapshot.put(m_organization);
+    snapshot.put(m_application);
+    snapshot.put<uint64_t>(m_rulePacks.size());
+    for (auto& aux : m_rulePacks)
+    {
+        aux.save(&snapshot);
+        snapshot.put<uint64_t>(0);
+    }
+    const snapshot_source_s unknown = {0, 0};
+    if (!snapshot.save(filename, unknown, unknown))
+        log_printf("[!] Failed to write snapshot %s\n", filename.c_str());
+}
+
+bool erbium::abr_dataset_s::load_snapshot(const std::string& filename)
+{
+    SnapshotReader snapshot;
+    if (!snapshot.open(filename))
+        return false;
+
+    uint64_t n_packs;
+    snapshot.get(&m_organization);
+    snapshot.get(&m_application);
+    snapshot.get(&n_packs);
+    m_rulePacks.clear();
+    for (uint64_t i = 0; i < n_packs; i++)
+    {
+        rulePack_s aux_rulePack;
+        uint64_t dictionnary_size;
+        if (!aux_rulePack.load(&snapshot))
+            break;
+        snapshot.get(&dictionnary_size);
+        snapshot.skip(dictionnary_size);
+        m_rulePacks.insert(aux_rulePack);
+    }
+    if (!snapshot.good() || m_rulePacks.size() != n_packs)
+    {
+        log_printf("[!] Snapshot %s holds malformed rule packs\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+size_t erbium::rulePack_s::load_rules(const std::string& filename)
 {
-    std::ifstream file(filename);
-    CSVRow row;
-    row.readNextRow(file);
-    int aux = row.m_data.size()-4;
-    while(file >> row)
+    const int fd = open(filename.c_str(), O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+    {
+        log_printf("[!] Failed to open rules file %s\n", filename.c_str());
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+    const size_t file_size = file_stat.st_size;
+    const char* file_data = (const char*)mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file_data == MAP_FAILED)
     {
-        erbium::rule_s rl;
-        rl.m_ruleId = std::stoi(row.m_data[0].substr(1));
-        rl.m_weight = std::stoi(row.m_data[1]);
+        log_printf("[!] Failed to map rules file %s\n", filename.c_str());
+        return 0;
+    }
+    madvise((void*)file_data, file_size, MADV_SEQUENTIAL);
+
+    const bool loaded = load_rules(file_data, file_size, filename);
+    munmap((void*)file_data, file_size);
+    return (loaded) ? file_size : 0;
+}
+
+bool erbium::rulePack_s::load_rules(const char* file_data, const size_t& file_size, const std::string& source)
+{
+    const char* file_end = file_data + file_size;
+
+    // header: criteria columns lie between the 6 rule attributes and the 4 content ones
+    const char* body = (const char*)memchr(file_data, '\n', file_size);
+    body = (body == NULL) ? file_end : body + 1;
+    const char* header_end = (body > file_data && body[-1] == '\n') ? body - 1 : body;
+    if (header_end > file_data && header_end[-1] == '\r')
+        header_end--;
+    std::vector<csv_cell_s> cells;
+    split_csv_line(file_data, header_end, &cells);
+    const int aux = cells.size() - 4;
+
+    // line-aligned chunks, parsed concurrently (records never span lines)
+    const size_t min_chunk = 1 << 16;
+    const size_t n_chunks = std::max((size_t)1,
+        std::min((size_t)omp_get_max_threads(), (size_t)(file_end - body) / min_chunk));
+    std::vector<const char*> bounds(n_chunks + 1, file_end);
+    bounds[0] = body;
+    for (size_t k = 1; k < n_chunks; k++)
+    {
+        const char* cursor = body + (file_end - body) * k / n_chunks;
+        cursor = (const char*)memchr(cursor, '\n', file_end - cursor);
+        bounds[k] = (cursor == NULL) ? file_end : std::max(cursor + 1, bounds[k-1]);
+    }
+
+    // each chunk interns its own values, then translates them into the pack pools
+    const criterionid_t n_criteria = std::max(aux - 6, 0);
+    std::vector<ruleStore_s> chunk_rules(n_chunks);
+    std::vector<uint32_t> malformed(n_chunks, 0);
+    std::vector<std::string> values;
+    #pragma omp parallel for schedule(static, 1) private(cells, values)
+    for (size_t k = 0; k < n_chunks; k++)
+    {
+        chunk_rules[k].reset(n_criteria);
+        values.resize(n_criteria);
+        for (const char* line = bounds[k]; line < bounds[k+1]; )
+        {
+            const char* line_end = (const char*)memchr(line, '\n', bounds[k+1] - line);
+            const char* next = (line_end == NULL) ? bounds[k+1] : line_end + 1;
+            line_end = (line_end == NULL) ? bounds[k+1] : line_end;
+            if (line_end > line && line_end[-1] == '\r')
+                line_end--;
+            if (line_end == line)
+            {
+                line = next;
+                continue;
+            }
+
+            split_csv_line(line, line_end, &cells);
+            cells.resize(std::max(cells.size(), (size_t)aux + 4), csv_cell_s{line_end, line_end, false});
+            try
+            {
+                const ruleid_t rule_id = std::stoi(get_csv_value(cells[0]).substr(1));
+                const weight_t weight = std::stoi(get_csv_value(cells[1]));
+
+                for (int i=6; i<aux; i++)
+                {
+                    if (cells[i].begin != cells[i].end || cells[i].quoted)
+                        values[i-6] = get_csv_value(cells[i]);
+                    else
+                        values[i-6] = "*";
+                }
+
+                if (get_csv_value(cells[aux+2]) == "TRUE")
+                    chunk_rules[k].add_rule(rule_id, weight, values, "999");
+                else
+                    chunk_rules[k].add_rule(rule_id, weight, values,
+                                            std::to_string(std::stoi(get_csv_value(cells[aux+1]))*60 +
+                                                           std::stoi(get_csv_value(cells[aux+3]))));
+            }
+            catch (const std::exception& e)
+            {
+                malformed[k]++;
+            }
+            line = next;
+        }
+    }
 
-        for (int i=6; i<aux; i++)
+    // chunks in file order, as the sequential reading (the first of duplicated ids is kept)
+    uint32_t n_malformed = 0;
+    m_rules.reset(n_criteria);
+    try
+    {
+        for (size_t k = 0; k < n_chunks; k++)
         {
-            erbium::criterion_s ct;
-            ct.m_index = i-6;
-            if (!row.m_data[i].empty())
-                ct.m_value = row.get_value(i);
-            else
-                ct.m_value = "*";
-            rl.m_criteria.insert(ct);
+            m_rules.append(chunk_rules[k]);
+            chunk_rules[k] = ruleStore_s();
+            n_malformed += malformed[k];
         }
+    }
+    catch (const std::length_error& e)
+    {
+        log_printf("[!] Too many distinct values in %s: %s\n", source.c_str(), e.what());
+        m_rules.reset(n_criteria);
+        return false;
+    }
+    m_rules.sort_rules();
+    if (n_malformed > 0)
+        log_printf("[!] %u malformed rules skipped in %s\n", n_malformed, source.c_str());
+
+    return true;
+}
 
-        if (row.m_data[aux+2] == "\"TRUE\"")
-            rl.m_content = "999";
+uint32_t erbium::rulePack_s::remove_dominated_rules(uint32_t* n_duplicates)
+{
+    const size_t n_criteria = m_ruleType.m_criterionDefinition.size();
+    std::vector<const criterionDefinition_s*> definitions;
+    for (auto& aux : m_ruleType.m_criterionDefinition)
+        definitions.push_back(&aux);
+
+    // codes of the wildcard (none when a column never holds it)
+    std::vector<int32_t> wildcards(n_criteria, -1);
+    for (criterionid_t index = 0; index < n_criteria; index++)
+    {
+        const std::vector<std::string>& pool = m_rules.m_pools[index];
+        auto aux = std::find(pool.begin(), pool.end(), "*");
+        if (aux != pool.end())
+            wildcards[index] = aux - pool.begin();
+    }
+
+    // identical criteria: only one content survives in the NFA, the lowest one of the dictionnary
+    std::map<std::vector<operand_t>, uint32_t> signatures;
+    std::vector<bool> dead(m_rules.size(), false);
+    uint32_t duplicates = 0;
+    for (uint32_t rule = 0; rule < m_rules.size(); rule++)
+    {
+        std::vector<operand_t> signature(n_criteria);
+        for (criterionid_t index = 0; index < n_criteria; index++)
+            signature[index] = m_rules.get_code(rule, index);
+
+        auto kept = signatures.find(signature);
+        if (kept == signatures.end())
+            signatures[signature] = rule;
+        else if (m_rules.get_content(rule) < m_rules.get_content(kept->second))
+        {
+            dead[kept->second] = true;
+            kept->second = rule;
+        }
         else
-            rl.m_content = std::to_string(std::stoi(row.get_value(aux+1))*60 + 
-                                          std::stoi(row.get_value(aux+3)));
+            dead[rule] = true;
+        duplicates += (kept != signatures.end());
+    }
+    if (n_duplicates != NULL)
+        *n_duplicates = duplicates;
 
-        m_rules.insert(rl);
+    // covering rules can only tie, since each specific criterion adds its (non-negative) weight:
+    // a rule is dead when another one of the same content matches all its queries with the same
+    // weight, i.e. it only differs by wider pairs or wildcards on null-weight criteria
+    struct candidate_s
+    {
+        uint32_t rule;
+        weight_t weight;
+        std::vector<std::pair<operand_t, operand_t>> operands; // pair criteria only
+    };
+    std::map<std::vector<operand_t>, std::vector<candidate_s>> buckets; // content & mandatory
+    for (uint32_t rule = 0; rule < m_rules.size(); rule++)
+    {
+        if (dead[rule])
+            continue;
+        candidate_s candidate;
+        candidate.rule = rule;
+        candidate.weight = 0;
+        candidate.operands.resize(n_criteria);
+        std::vector<operand_t> key(1, m_rules.get_content_code(rule));
+        for (criterionid_t index = 0; index < n_criteria; index++)
+        {
+            const criterionDefinition_s* criterion_def = definitions[index];
+            const operand_t code = m_rules.get_code(rule, index);
+            if (criterion_def->m_isMandatory)
+                key.push_back(code);
+            if (code == wildcards[index])
+                continue;
+            candidate.weight += criterion_def->m_weight;
+            if (criterion_def->m_isPair)
+                RuleParser::parse_value(m_rules.get_value(rule, index), 0,
+                    &candidate.operands[index].first,
+                    &candidate.operands[index].second,
+                    criterion_def);
+        }
+        buckets[key].push_back(candidate);
     }
+
+    uint32_t dominated = 0;
+    for (auto& bucket : buckets)
+    {
+        std::vector<bool> removed(bucket.second.size(), false);
+        for (size_t b = 0; b < bucket.second.size(); b++)
+        {
+            const candidate_s& covered = bucket.second[b];
+            for (size_t a = 0; a < bucket.second.size() && !removed[b]; a++)
+            {
+                const candidate_s& cover = bucket.second[a];
+                if (a == b || removed[a] || cover.weight < covered.weight)
+                    continue;
+
+                bool covers = true;
+                for (criterionid_t index = 0; covers && index < n_criteria; index++)
+                {
+                    const operand_t code_a = m_rules.get_code(cover.rule, index);
+                    const operand_t code_b = m_rules.get_code(covered.rule, index);
+                    if (code_a == wildcards[index] || code_a == code_b)
+                        continue;
+                    covers = definitions[index]->m_isPair && code_b != wildcards[index]
+                          && cover.operands[index].first  <= covered.operands[index].first
+                          && cover.operands[index].second >= covered.operands[index].second;
+                }
+                removed[b] = covers;
+            }
+            if (removed[b])
+            {
+                dead[covered.rule] = true;
+                dominated++;
+            }
+        }
+    }
+
+    std::vector<uint32_t> alive;
+    for (uint32_t rule = 0; rule < m_rules.size(); rule++)
+    {
+        if (!dead[rule])
+            alive.push_back(rule);
+    }
+    m_rules = m_rules.select(alive);
+
+    return duplicates + dominated;
 }
 
 void erbium::rulePack_s::load_ruleType(const std::string& filename)
@@ -186,14 +857,25 @@ void erbium::rulePack_s::load_ruleType(const std::string& filename)
 
     boost::property_tree::ptree tree;
     boost::property_tree::read_xml(filename, tree);
+    load_ruleType(tree);
+}
+
+void erbium::rulePack_s::load_ruleType(std::istream* stream)
+{
+    boost::property_tree::ptree tree;
+    boost::property_tree::read_xml(*stream, tree);
+    load_ruleType(tree);
+}
 
+void erbium::rulePack_s::load_ruleType(const boost::property_tree::ptree& tree)
+{
     // m_ruleType.m_organization = tree.get<std::string>("ruleTypeDefinition.organization");
     m_ruleType.m_organization = "Amadeus";
     m_ruleType.m_code         = tree.get<std::string>("ruleTypeDefinition.code");
     m_ruleType.m_description  = tree.get<std::string>("ruleTypeDefinition.description");
     m_ruleType.m_release      = tree.get<unsigned long int>("ruleTypeDefinition.subversion");
 
-    BOOST_FOREACH(boost::property_tree::ptree::value_type &aux, tree.get_child("ruleTypeDefinition"))
+    BOOST_FOREACH(const boost::property_tree::ptree::value_type &aux, tree.get_child("ruleTypeDefinition"))
     {
         if (!strcmp(aux.first.c_str(), "criterionDefinition"))
         {
@@ -216,7 +898,7 @@ void erbium::rulePack_s::load_ruleType(const std::string& filename)
                 default:
                     // problem!
                     aux_criterionDef.m_isPair = false;
-                    printf("[!] Criterion %s has %lu `guiProperties`. Expected: 1 (simple) or 2 (pair)\n",
+                    log_printf("[!] Criterion %s has %lu `guiProperties`. Expected: 1 (simple) or 2 (pair)\n",
                             aux_criterionDef.m_code.c_str(), aux.second.count("guiProperties"));
             }
             m_ruleType.m_criterionDefinition.insert(aux_criterionDef);
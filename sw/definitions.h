@@ -23,10 +23,14 @@
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include <boost/graph/adjacency_list.hpp>
+#include <boost/property_tree/ptree_fwd.hpp>
 
 #include <string>
+#include <istream>
+#include <ostream>
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 namespace erbium {
@@ -73,14 +77,138 @@ const char SHIFT_OPERAND_B = CFG_CRITERION_VALUE_WIDTH + SHIFT_OPERAND_A;
 const char SHIFT_POINTER   = CFG_CRITERION_VALUE_WIDTH + SHIFT_OPERAND_B;
 const char SHIFT_LAST      = CFG_TRANSITION_POINTER_WIDTH + SHIFT_POINTER;
 
+// upper address bits of the depth-first (single memory) layout, above the last flag (CPU only)
+const uint16_t CFG_TRANSITION_POINTER_HIGH_WIDTH = 21; // in bits
+const transition_t MASK_POINTER_HIGH = generate_mask(CFG_TRANSITION_POINTER_HIGH_WIDTH);
+const char SHIFT_POINTER_HIGH = 1 + SHIFT_LAST;
+
+// matching configuration of a level (must be consistent with core_pkg.vhd); FNCTR_SIMP_IN (CPU
+// engine only) tests operand_b as a reference to a value set of the image (see image_sets_s), such
+// transitions lead their fan-out block and a strict-match scan goes on past them
+enum MatchStructureType {STRCT_SIMPLE, STRCT_PAIR};
+enum MatchPairFunction {FNCTR_PAIR_NOP, FNCTR_PAIR_AND, FNCTR_PAIR_OR, FNCTR_PAIR_XOR, FNCTR_PAIR_NAND, FNCTR_PAIR_NOR};
+enum MatchSimpFunction {FNCTR_SIMP_NOP, FNCTR_SIMP_EQU, FNCTR_SIMP_NEQ, FNCTR_SIMP_GRT, FNCTR_SIMP_GEQ, FNCTR_SIMP_LES, FNCTR_SIMP_LEQ, FNCTR_SIMP_IN};
+enum MatchModeType {MODE_STRICT_MATCH, MODE_FULL_ITERATION};
+
+// self-describing NFA image: a header (engine parameters of each level, offset of each memory and
+// checksum of the payload), then the memories (must be consistent with kernel_<shell>.cpp)
+//   version 1: legacy fixed-width image of the hardware (hash, then the memories), without header
+//   version 2: header, each memory packed with its minimal field widths (CPU engine only)
+//   version 3: header, then the memories of version 1 (hosts upload the payload as is)
+const uint64_t C_IMAGE_MAGIC             = 0x000041464e425245; // "ERBNFA"
+const uint32_t C_IMAGE_VERSION_FIXED     = 1;
+const uint32_t C_IMAGE_VERSION_PACKED    = 2;
+const uint32_t C_IMAGE_VERSION_DESCRIBED = 3;
+
+const uint8_t C_IMAGE_LAYOUT_LEVELS      = 0; // one memory per level
+const uint8_t C_IMAGE_LAYOUT_DEPTH_FIRST = 1; // one memory, absolute pointers
+
+const uint8_t C_IMAGE_FLAG_VALUE_SETS    = 1; // an image_sets_s follows the memory descriptors
+
+struct image_header_s
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;  // in bytes, cache-line aligned (the payload follows)
+    uint64_t hash;         // automata id
+    uint64_t checksum;     // FNV-1a of the payload
+    uint16_t n_criteria;   // followed by one image_criterion_s per level
+    uint16_t n_memories;   // followed by one image_memory_s per memory
+    uint8_t  layout;
+    uint8_t  flags;        // C_IMAGE_FLAG_*
+    uint8_t  reserved[2];
+};
+struct image_criterion_s
+{
+    uint16_t criterion_id;   // sorting map
+    uint16_t functor;
+    uint32_t weight;
+    uint8_t  structure;      // MatchStructureType
+    uint8_t  function_a;     // MatchSimpFunction
+    uint8_t  function_b;     // MatchSimpFunction
+    uint8_t  function_pair;  // MatchPairFunction
+    uint8_t  match_mode;     // MatchModeType
+    uint8_t  wildcard;       // wildcard enabled
+    uint16_t reserved;
+};
+struct image_memory_s
+{
+    uint64_t offset;         // in bytes from the beginning of the image, first transition
+    uint64_t size;           // in bytes, padding included
+    uint32_t n_transitions;  // (fixed memories keep their count word before the first transition)
+    uint8_t  operand_width;  // in bits, both operands
+    uint8_t  pointer_width;  // in bits
+    uint8_t  slots_per_word; // transitions per 64-bit word (never split across words)
+    uint8_t  reserved;
+};
+// value sets of the IN-list transitions: n_sets + 1 uint32_t bounds, then the operand_t values;
+// the members of set s (from 1) are values[bounds[s-1]] to values[bounds[s]-1], in ascending order
+struct image_sets_s
+{
+    uint64_t offset;         // in bytes from the beginning of the image, first bound
+    uint64_t size;           // in bytes, padding included
+    uint32_t n_sets;
+    uint32_t n_values;
+};
+
+// bundle of the NFA images of several rule types (CPU engine only): a header, one entry per
+// image, then the images (self-describing, version 2 or 3) each aligned to a cache line
+const uint64_t C_BUNDLE_MAGIC   = 0x004c444e42425245; // "ERBBNDL"
+const uint32_t C_BUNDLE_VERSION = 1;
+
+struct bundle_header_s
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t n_images;     // followed by one bundle_entry_s per image
+};
+struct bundle_entry_s
+{
+    uint16_t rule_type;    // id the queries are dispatched by (see benchmark_bundle.bin)
+    uint16_t n_criteria;
+    uint32_t reserved;
+    uint64_t offset;       // in bytes from the beginning of the bundle
+    uint64_t size;         // in bytes
+};
+
+// 64-bit FNV-1a, the checksum of the image payload
+inline uint64_t image_checksum(const char* data, const size_t& size)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3;
+    return hash;
+}
 
 // Static sanity checks
 static_assert(CFG_TRANSITION_POINTER_WIDTH + 2*CFG_CRITERION_VALUE_WIDTH + 1 <= sizeof(transition_t)*8,
               "NFA Transition fields to be stored must fit into the memory line.");
 
+static_assert(SHIFT_POINTER_HIGH + CFG_TRANSITION_POINTER_HIGH_WIDTH <= sizeof(transition_t)*8,
+              "Depth-first address pointers must fit into the memory line.");
+
 static_assert(CFG_CRITERION_VALUE_WIDTH <= sizeof(operand_t) * 8,
               "Operand (criterion value) size must fit into operand_t type.");
 
+static_assert(sizeof(image_header_s) == 40 && sizeof(image_criterion_s) == 16 && sizeof(image_memory_s) == 24
+              && sizeof(image_sets_s) == 24,
+              "NFA image descriptors must keep their on-disk size.");
+
+static_assert(sizeof(bundle_header_s) == 16 && sizeof(bundle_entry_s) == 24,
+              "NFA bundle descriptors must keep their on-disk size.");
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// LOG                                                                                            //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// progress, statistics and "[!]" warnings of the library go to one sink, std::cout by default;
+// NULL silences them (Compiler::compile sets compile_options_s::log for the time of a compilation)
+void set_log_sink(std::ostream* sink);
+std::ostream* get_log_sink();
+std::ostream& log_stream();
+void log_printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // TYPEDEF                                                                                        //
@@ -95,6 +223,7 @@ typedef uint32_t                                ruleid_t;
 typedef std::map<std::string, operand_t>       dictionnary_t;
 typedef std::map<criterionid_t, dictionnary_t>  dic_criteria_t;
 typedef std::vector<criterionid_t>              sorting_map_t;
+typedef std::vector<std::vector<uint32_t>>      value_frequencies_t; // per criterion_id > per value_id > hits
 
 // graph
 struct vertex_info;
@@ -104,17 +233,24 @@ typedef std::map<criterionid_t, std::map<operand_t, std::set<vertex_id_t>>>  ver
 
 
 enum SortOrder { Ascending, Descending };
+enum WildcardPolicy { WildcardFirst, WildcardLast, WildcardByFrequency };
 
 struct vertex_info { 
     criterionid_t level;
     std::string   label;
+    std::string   label_end; // last value of a coalesced range (empty otherwise)
+    std::pair<operand_t, operand_t> interval; // operands of a pair transition on a disjoint level
     std::string   path;
-    weight_t      weight; // only used for DFA filtering at last level
+    weight_t      weight; // engine rank of the path (criterion weights of its specific values)
     std::set<vertex_id_t> parents;
     std::set<vertex_id_t> children;
-    uint16_t dump_pointer;
+    uint32_t dump_pointer;
 };
 
+// binary snapshots (snapshot.h)
+class SnapshotWriter;
+class SnapshotReader;
+
 struct criterionDefinition_s
 {
     criterionid_t m_index;
@@ -157,7 +293,9 @@ struct ruleType_s
         for(auto& aux : m_criterionDefinition)
             aux.print(level + "\t");
     }
-    int get_criterion_id(const std::string& code)
+    void save(SnapshotWriter* snapshot) const;
+    void load(SnapshotReader* snapshot);
+    int get_criterion_id(const std::string& code) const
     {
         for (auto& aux : m_criterionDefinition)
         {
@@ -168,50 +306,103 @@ struct ruleType_s
     }
 
 };
-struct criterion_s
+// IN-list values: a simple criterion may accept several values, written A|B|C in the rules; they
+// are stored canonical (ascending members, without duplicates; a wildcard member makes a wildcard)
+const char C_VALUE_LIST_SEPARATOR = '|';
+
+inline bool is_value_list(const std::string& value)
 {
-    criterionid_t m_index;
-    std::string m_value;
-    bool operator < (const criterion_s &other) const { return m_index < other.m_index; }
-    void print(const std::string &level) const
-    {
-        printf("%s[Criterion] id=%d value=%s\n",
-            level.c_str(),
-            m_index,
-            m_value.c_str());
-    }
-};
-struct rule_s
+    return value.find(C_VALUE_LIST_SEPARATOR) != std::string::npos;
+}
+// members of a value, the value itself when it is no list
+std::vector<std::string> split_value_list(const std::string& value);
+std::string canonical_value_list(const std::string& value);
+
+// columnar rule storage: every criterion (then the content) is a column of codes into the pool of
+// its distinct values, so that a value is reached in O(1) from its rule position
+struct ruleStore_s
 {
-    ruleid_t m_ruleId;
-    weight_t m_weight;
-    std::set<criterion_s> m_criteria;
-    std::string m_content;
-    bool operator < (const rule_s &other) const { return m_ruleId < other.m_ruleId; }
+    std::vector<ruleid_t> m_ruleIds;                 // per rule
+    std::vector<weight_t> m_weights;                 // per rule
+    std::vector<std::vector<operand_t>>   m_columns; // per criterion_id, then content > per rule > code
+    std::vector<std::vector<std::string>> m_pools;   // per criterion_id, then content > per code > value
+
+    // empties the store for rules of n_criteria criteria
+    void reset(const criterionid_t& n_criteria);
+    // appends a rule (values by criterion_id); sort_rules() restores the ordering by id
+    void add_rule(const ruleid_t& rule_id, const weight_t& weight,
+                  const std::vector<std::string>& values, const std::string& content);
+    // appends the rules of another store, whose codes are translated into this one
+    void append(const ruleStore_s& other);
+    // orders the rules by id; only the first rule of a duplicated id is kept
+    void sort_rules();
+    // copy of the given rules (positions), with the same pools hence the same codes
+    ruleStore_s select(const std::vector<uint32_t>& rules) const;
+    // rewrites the rules holding IN-lists on the flagged criteria (per criterion_id) into one rule
+    // per combination of members, of same id, weight and content; returns the number of rules added
+    uint32_t expand_value_lists(const std::vector<bool>& criteria);
+    // per criterion_id, whether a rule holds an IN-list
+    std::vector<bool> get_list_criteria() const;
+
+    void save(SnapshotWriter* snapshot) const;
+    // false when the columns do not match (the store is then empty)
+    bool load(SnapshotReader* snapshot);
+
+    size_t size() const { return m_ruleIds.size(); }
+    bool empty() const { return m_ruleIds.empty(); }
+    criterionid_t n_criteria() const { return (m_columns.empty()) ? 0 : m_columns.size() - 1; }
+    operand_t get_code(const uint32_t& rule, const criterionid_t& criterion_id) const
+        { return m_columns[criterion_id][rule]; }
+    const std::string& get_value(const uint32_t& rule, const criterionid_t& criterion_id) const
+        { return m_pools[criterion_id][m_columns[criterion_id][rule]]; }
+    operand_t get_content_code(const uint32_t& rule) const { return m_columns.back()[rule]; }
+    const std::string& get_content(const uint32_t& rule) const
+        { return m_pools.back()[m_columns.back()[rule]]; }
+
     void print(const std::string &level) const
     {
-        printf("%s[Rule] id=%d weight=%u content=%s\n", 
-            level.c_str(),
-            m_ruleId,
-            m_weight,
-            m_content.c_str());
-        for(auto& aux : m_criteria)
-            aux.print(level + "\t");
+        for (uint32_t rule = 0; rule < size(); rule++)
+        {
+            printf("%s[Rule] id=%d weight=%u content=%s\n",
+                level.c_str(),
+                m_ruleIds[rule],
+                m_weights[rule],
+                get_content(rule).c_str());
+            for (criterionid_t criterion_id = 0; criterion_id < n_criteria(); criterion_id++)
+                printf("%s\t[Criterion] id=%d value=%s\n",
+                    level.c_str(),
+                    criterion_id,
+                    get_value(rule, criterion_id).c_str());
+        }
     }
+
+  private:
+    std::vector<std::unordered_map<std::string, operand_t>> m_codes; // per column > value > code
+
+    operand_t intern(const criterionid_t& column, const std::string& value);
 };
 struct rulePack_s
 {
     ruleType_s m_ruleType;
-    std::set<rule_s> m_rules;
+    ruleStore_s m_rules;
 
     void load_ruleType(const std::string& filename);
-    void load_rules(const std::string& filename);
+    void load_ruleType(std::istream* stream);
+    void load_ruleType(const boost::property_tree::ptree& tree);
+    // parses the CSV rules concurrently from a memory-mapped file; returns its size in bytes
+    size_t load_rules(const std::string& filename);
+    // same from a buffer in memory (source names it in the messages); false if unusable
+    bool load_rules(const char* data, const size_t& size, const std::string& source = "rules");
+    // removes the rules that never decide a result: duplicated criteria (the kept content is the
+    // one the NFA exports) and rules covered by a rule of equal criteria weight and same content
+    uint32_t remove_dominated_rules(uint32_t* n_duplicates = NULL);
+    void save(SnapshotWriter* snapshot) const;
+    bool load(SnapshotReader* snapshot);
     bool operator < (const rulePack_s &other) const { return true; }
     void print(const std::string &level) const
     {
         m_ruleType.print(level);
-        for(auto& aux : m_rules)
-            aux.print(level + "\t");
+        m_rules.print(level + "\t");
     }
 };
 struct abr_dataset_s
@@ -221,7 +412,9 @@ struct abr_dataset_s
     std::set<rulePack_s> m_rulePacks;
 
     void load(const std::string& filename);
+    // binary snapshot of the parsed rule packs (see snapshot.h)
     void save(const std::string &filename);
+    bool load_snapshot(const std::string& filename);
 
     void print(const std::string &level) const
     {
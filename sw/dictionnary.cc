@@ -21,28 +21,108 @@
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "dictionnary.h"
+#include "snapshot.h"
 
 #include <algorithm>
 #include <fstream>
+#include <stdexcept>
 
 //#define WILDCARD_AS_LAST true
 namespace erbium {
 
-Dictionnary::Dictionnary(const rulePack_s& rulepack)
+void ValueTable::assign(const dictionnary_t& dic)
 {
+    m_size = dic.size();
+    m_values.assign(m_size, std::string());
+    for (auto& value : dic)
+    {
+        if (value.second >= m_values.size())
+            m_values.resize(value.second + 1);
+        m_values[value.second] = value.first;
+    }
+
+    // load factor below 1/2
+    size_t capacity = 1;
+    while (capacity < 2 * m_size)
+        capacity <<= 1;
+    m_slots.assign(capacity, C_EMPTY_SLOT);
+    for (auto& value : dic)
+    {
+        size_t slot = std::hash<std::string_view>{}(value.first) & (capacity - 1);
+        while (m_slots[slot] != C_EMPTY_SLOT)
+            slot = (slot + 1) & (capacity - 1);
+        m_slots[slot] = value.second;
+    }
+}
+
+bool ValueTable::find(const std::string_view& value, operand_t* value_id) const
+{
+    if (m_slots.empty())
+        return false;
+    const size_t mask = m_slots.size() - 1;
+    for (size_t slot = std::hash<std::string_view>{}(value) & mask; m_slots[slot] != C_EMPTY_SLOT;
+         slot = (slot + 1) & mask)
+    {
+        if (m_values[m_slots[slot]] == value)
+        {
+            *value_id = m_slots[slot];
+            return true;
+        }
+    }
+    return false;
+}
+
+operand_t ValueTable::operator[](const std::string_view& value) const
+{
+    operand_t value_id = 0;
+    find(value, &value_id);
+    return value_id;
+}
+
+operand_t ValueTable::at(const std::string_view& value) const
+{
+    operand_t value_id;
+    if (!find(value, &value_id))
+        throw std::out_of_range("ValueTable::at");
+    return value_id;
+}
+
+Dictionnary::Dictionnary(const rulePack_s& rulepack, SnapshotReader* snapshot)
+{
+    if (snapshot != NULL)
+    {
+        if (load(snapshot, rulepack))
+            return;
+        log_printf("[!] Unreadable dictionnary in the snapshot, scanning the rules\n");
+    }
+
     for (auto& aux : rulepack.m_ruleType.m_criterionDefinition)
     {
         if (!aux.m_isMandatory)
             m_dic_criteria[aux.m_index]["*"] = 0;
     }
     
-    // scan rules
-    for (auto& rule : rulepack.m_rules)
+    // scan rules: the pooled values in use by each column
+    const ruleStore_s& rules = rulepack.m_rules;
+    for (criterionid_t column = 0; !rules.empty() && column <= rules.n_criteria(); column++)
     {
-        for (auto& aux : rule.m_criteria)
-            m_dic_criteria[aux.m_index][aux.m_value] = 0;
+        std::vector<bool> used(rules.m_pools[column].size(), false);
+        for (auto& code : rules.m_columns[column])
+            used[code] = true;
 
-        m_dic_contents[rule.m_content] = 0;
+        dictionnary_t& dic = (column == rules.n_criteria()) ? m_dic_contents : m_dic_criteria[column];
+        for (size_t code = 0; code < used.size(); code++)
+        {
+            if (!used[code])
+                continue;
+            dic[rules.m_pools[column][code]] = 0;
+            // the members of an IN-list are the values its queries carry
+            if (column < rules.n_criteria() && is_value_list(rules.m_pools[column][code]))
+            {
+                for (auto& member : split_value_list(rules.m_pools[column][code]))
+                    dic[member] = 0;
+            }
+        }
     }
 
     // content indexes
@@ -82,6 +162,108 @@ Dictionnary::Dictionnary(const rulePack_s& rulepack)
     // sorting map
     for (auto& criterion : m_dic_criteria)
         m_sorting_map.push_back(criterion.first);
+    m_range_levels.assign(m_sorting_map.size(), false);
+    m_disjoint_levels.assign(m_sorting_map.size(), false);
+    m_deterministic_levels.assign(m_sorting_map.size(), false);
+    build_tables(rules);
+}
+
+void Dictionnary::build_tables(const ruleStore_s& rules)
+{
+    m_tables.resize(m_dic_criteria.size() + 1);
+    m_list_criteria.assign(m_dic_criteria.size(), false);
+    for (auto& criterion : m_dic_criteria)
+    {
+        m_tables[criterion.first].assign(criterion.second);
+        for (auto& value : criterion.second)
+        {
+            if (is_value_list(value.first))
+            {
+                m_list_criteria[criterion.first] = true;
+                break;
+            }
+        }
+    }
+    m_tables[m_dic_criteria.size()].assign(m_dic_contents);
+
+    // value id of every pooled value, the contents last as in the tables
+    m_code_ids.resize(rules.m_pools.size());
+    for (size_t column = 0; column < rules.m_pools.size(); column++)
+    {
+        const ValueTable& table = (column == rules.n_criteria())
+                                ? m_tables[m_dic_criteria.size()] : m_tables[column];
+        m_code_ids[column].clear();
+        for (auto& value : rules.m_pools[column])
+            m_code_ids[column].push_back(table[value]);
+    }
+}
+
+void Dictionnary::save(SnapshotWriter* snapshot) const
+{
+    snapshot->put<uint64_t>(m_dic_criteria.size());
+    for (auto& criterion : m_dic_criteria)
+    {
+        snapshot->put(criterion.first);
+        snapshot->put<uint64_t>(criterion.second.size());
+        for (auto& value : criterion.second)
+        {
+            snapshot->put(value.first);
+            snapshot->put(value.second);
+        }
+    }
+    snapshot->put<uint64_t>(m_dic_contents.size());
+    for (auto& value : m_dic_contents)
+    {
+        snapshot->put(value.first);
+        snapshot->put(value.second);
+    }
+    snapshot->put(m_sorting_map);
+}
+
+bool Dictionnary::load(SnapshotReader* snapshot, const rulePack_s& rulepack)
+{
+    auto load_values = [snapshot](dictionnary_t* dic) {
+        uint64_t n_values;
+        std::string value;
+        operand_t value_id;
+        snapshot->get(&n_values);
+        for (uint64_t i = 0; i < n_values && snapshot->good(); i++)
+        {
+            snapshot->get(&value);
+            snapshot->get(&value_id);
+            dic->emplace_hint(dic->end(), value, value_id);
+        }
+    };
+
+    uint64_t n_criteria;
+    criterionid_t criterion_id;
+    snapshot->get(&n_criteria);
+    for (uint64_t i = 0; i < n_criteria && snapshot->good(); i++)
+    {
+        snapshot->get(&criterion_id);
+        load_values(&m_dic_criteria[criterion_id]);
+    }
+    load_values(&m_dic_contents);
+    snapshot->get(&m_sorting_map);
+
+    // the ids must cover the criteria of the rules, each one being in the sorting map
+    bool valid = snapshot->good() && m_dic_criteria.size() == n_criteria
+              && m_sorting_map.size() == n_criteria && n_criteria == rulepack.m_rules.n_criteria();
+    for (criterionid_t level = 0; valid && level < m_sorting_map.size(); level++)
+        valid = m_sorting_map[level] < n_criteria && m_dic_criteria.count(level) > 0;
+    if (!valid)
+    {
+        m_dic_criteria.clear();
+        m_dic_contents.clear();
+        m_sorting_map.clear();
+        return false;
+    }
+
+    m_range_levels.assign(m_sorting_map.size(), false);
+    m_disjoint_levels.assign(m_sorting_map.size(), false);
+    m_deterministic_levels.assign(m_sorting_map.size(), false);
+    build_tables(rulepack.m_rules);
+    return true;
 }
 
 sorting_map_t Dictionnary::sort_by_n_of_values(const SortOrder order, std::vector<int16_t>* arbitrary)
@@ -130,6 +312,123 @@ sorting_map_t Dictionnary::sort_by_n_of_values(const SortOrder order, std::vecto
     return m_sorting_map;
 }
 
+void Dictionnary::cluster_by_context(const rulePack_s& rulepack)
+{
+    auto mix = [](uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccd;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53;
+        x ^= x >> 33;
+        return x;
+    };
+
+    // position-aware hash of each rule, so that a criterion can be masked out by subtraction
+    const ruleStore_s& rules = rulepack.m_rules;
+    std::vector<std::vector<uint64_t>> value_hash(rules.m_pools.size()); // per column > per code
+    for (criterionid_t column = 0; column < rules.m_pools.size(); column++)
+    {
+        for (auto& value : rules.m_pools[column])
+            value_hash[column].push_back((column == rules.n_criteria())
+                ? mix(std::hash<std::string>{}(value))
+                : mix(std::hash<std::string>{}(value) + column * 0x9e3779b97f4a7c15));
+    }
+    std::vector<uint64_t> rule_hash(rules.size(), 0);
+    for (criterionid_t column = 0; column < rules.m_columns.size(); column++)
+    {
+        for (uint32_t rule_id = 0; rule_id < rules.size(); rule_id++)
+            rule_hash[rule_id] += value_hash[column][rules.m_columns[column][rule_id]];
+    }
+
+    m_range_levels.assign(m_sorting_map.size(), false);
+    for (criterionid_t level = 1; level < m_sorting_map.size(); level++)
+    {
+        const criterionid_t criterion_id = m_sorting_map[level];
+        const criterionDefinition_s* criterion_def =
+            &(*std::next(rulepack.m_ruleType.m_criterionDefinition.begin(), criterion_id));
+        if (criterion_def->m_isPair || m_list_criteria[criterion_id])
+            continue;
+        m_range_levels[level] = true;
+
+        // contexts (rule without this criterion) of each value
+        const std::vector<std::string>& pool = rules.m_pools[criterion_id];
+        const std::vector<operand_t>& column = rules.m_columns[criterion_id];
+        std::vector<std::vector<uint64_t>> contexts(pool.size()); // per code
+        for (uint32_t rule_id = 0; rule_id < rules.size(); rule_id++)
+            contexts[column[rule_id]].push_back(rule_hash[rule_id] - value_hash[criterion_id][column[rule_id]]);
+
+        // values are chained greedily, each followed by the one sharing most contexts with it,
+        // so that siblings leading to the same states get adjacent ids
+        dictionnary_t& dic = m_dic_criteria[criterion_id];
+        std::vector<std::pair<operand_t, operand_t>> values;   // <former id, code>
+        for (size_t code = 0; code < contexts.size(); code++)
+        {
+            std::vector<uint64_t>& value = contexts[code];
+            if (value.empty())
+                continue;
+            std::sort(value.begin(), value.end());
+            value.erase(std::unique(value.begin(), value.end()), value.end());
+            if (pool[code] != "*")
+                values.push_back(std::make_pair(dic[pool[code]], (operand_t)code));
+        }
+        std::sort(values.begin(), values.end());
+
+        std::map<uint64_t, std::vector<uint32_t>> holders; // context > values
+        for (uint32_t i = 0; i < values.size(); i++)
+        {
+            for (auto& context : contexts[values[i].second])
+                holders[context].push_back(i);
+        }
+
+        std::vector<bool> placed(values.size(), false);
+        std::vector<uint32_t> shared(values.size());
+        std::vector<operand_t> order;
+        for (uint32_t seed = 0; seed < values.size(); seed++)
+        {
+            if (placed[seed])
+                continue;
+            for (uint32_t last = seed; ; )
+            {
+                placed[last] = true;
+                order.push_back(values[last].second);
+
+                std::fill(shared.begin(), shared.end(), 0);
+                for (auto& context : contexts[values[last].second])
+                {
+                    for (auto& other : holders[context])
+                        shared[other]++;
+                }
+                uint32_t next = last;
+                for (uint32_t i = 0; i < values.size(); i++)
+                {
+                    if (!placed[i] && shared[i] > 0 && (next == last || shared[i] > shared[next]))
+                        next = i;
+                }
+                if (next == last)
+                    break;
+                last = next;
+            }
+        }
+
+        // the wildcard keeps its id
+        operand_t key = (criterion_def->m_isMandatory) ? 0 : 1;
+        for (auto& aux : order)
+            dic[pool[aux]] = key++;
+    }
+    build_tables(rules);
+}
+
+void Dictionnary::flag_disjoint_levels(const rulePack_s& rulepack)
+{
+    m_disjoint_levels.assign(m_sorting_map.size(), false);
+    for (criterionid_t level = 1; level + 1u < m_sorting_map.size(); level++)
+    {
+        const criterionDefinition_s* criterion_def =
+            &(*std::next(rulepack.m_ruleType.m_criterionDefinition.begin(), m_sorting_map[level]));
+        m_disjoint_levels[level] = criterion_def->m_isPair;
+    }
+}
+
 bool Dictionnary::exists_in_vector(const std::vector<int16_t> vec, const criterionid_t& point)
 {
     for (auto& aux : vec)
@@ -140,12 +439,17 @@ bool Dictionnary::exists_in_vector(const std::vector<int16_t> vec, const criteri
     return false;
 }
 
-dictionnary_t Dictionnary::get_criterion_dic_by_level(const criterionid_t& level) const
+bool Dictionnary::is_set_level(const criterionid_t& level) const
+{
+    return level > 0 && level < m_sorting_map.size() && m_list_criteria[m_sorting_map[level]];
+}
+
+const ValueTable& Dictionnary::get_criterion_dic_by_level(const criterionid_t& level) const
 {
     if (level == m_dic_criteria.size())
-        return m_dic_contents;
+        return m_tables[level];
     else
-        return m_dic_criteria.at(m_sorting_map[level]);
+        return m_tables[m_sorting_map[level]];
 }
 
 int16_t Dictionnary::get_level_by_criterion_id(const criterionid_t& criterion_id) const
@@ -162,41 +466,64 @@ int16_t Dictionnary::get_level_by_criterion_id(const criterionid_t& criterion_id
 
 operand_t Dictionnary::get_valueid_by_sort(const criterionid_t& sort_id, const std::string& value) const
 {
-    if (sort_id == m_dic_criteria.size())
-        return m_dic_contents.at(value);
-    else
-        return m_dic_criteria.at(sort_id).at(value);
+    return m_tables[sort_id].at(value);
+}
+
+operand_t Dictionnary::get_valueid_by_code(const criterionid_t& sort_id, const operand_t& code) const
+{
+    return m_code_ids[sort_id][code];
 }
 
 operand_t Dictionnary::get_valueid_by_level(const criterionid_t& level, const std::string& value) const
 {
-    if (level == m_dic_criteria.size())
-        return m_dic_contents.at(value);
-    else
-        return m_dic_criteria.at(m_sorting_map[level]).at(value);
+    return get_criterion_dic_by_level(level).at(value);
 }
 
 void Dictionnary::dump_dictionnary(const std::string& filename)
 {
     std::ofstream filecsv(filename, std::ios::out | std::ios::trunc);
+    dump_dictionnary(&filecsv);
+    filecsv.close();
+}
 
-    filecsv << "level,value,id\n";
+void Dictionnary::dump_dictionnary(std::ostream* filecsv)
+{
+    *filecsv << "level,value,id\n";
     criterionid_t level = 0;
     for (auto& aux : m_sorting_map)
     {
         for (auto& pair : m_dic_criteria[aux])
         {
-            filecsv << level << "," << pair.first << "," << pair.second << std::endl;
+            *filecsv << level << "," << pair.first << "," << pair.second << std::endl;
         }
         level++;
     }
 
     for (auto& pair : m_dic_contents)
     {
-        filecsv << level << "," << pair.first << "," << pair.second << std::endl;
+        *filecsv << level << "," << pair.first << "," << pair.second << std::endl;
     }
+}
 
+void Dictionnary::dump_criteria(const std::string& filename, const rulePack_s& rulepack) const
+{
+    std::ofstream filecsv(filename, std::ios::out | std::ios::trunc);
+    dump_criteria(&filecsv, rulepack);
     filecsv.close();
 }
 
+void Dictionnary::dump_criteria(std::ostream* filecsv, const rulePack_s& rulepack) const
+{
+    *filecsv << "level,criterion_id,code,functor,pair,mandatory\n";
+    criterionid_t level = 0;
+    for (auto& aux : m_sorting_map)
+    {
+        const criterionDefinition_s& criterion =
+            *std::next(rulepack.m_ruleType.m_criterionDefinition.begin(), aux);
+        *filecsv << level++ << "," << criterion.m_index << "," << criterion.m_code << ","
+                 << criterion.m_functor << "," << criterion.m_isPair << "," << criterion.m_isMandatory
+                 << std::endl;
+    }
+}
+
 } // namespace erbium
\ No newline at end of file
@@ -24,32 +24,93 @@
 
 #include <map>
 #include <vector>
+#include <string_view>
 
 #include "definitions.h"
 
 namespace erbium {
 
+// read-only value ids of one level: each value is interned once (by id) and found through a flat
+// open-addressing table of ids, without copies nor allocations
+class ValueTable
+{
+  public:
+    void assign(const dictionnary_t& dic);
+
+    // id of a value, 0 (as for a missing map key) when unknown
+    operand_t operator[](const std::string_view& value) const;
+    // id of a value, throws std::out_of_range when unknown
+    operand_t at(const std::string_view& value) const;
+
+    const std::string& get_value(const operand_t& value_id) const { return m_values[value_id]; }
+    size_t size() const { return m_size; }
+
+  private:
+    static constexpr uint32_t C_EMPTY_SLOT = UINT32_MAX;
+
+    std::vector<std::string> m_values; // per value_id
+    std::vector<uint32_t>    m_slots;  // value_id, or C_EMPTY_SLOT (power-of-two capacity)
+    size_t                   m_size;
+
+    bool find(const std::string_view& value, operand_t* value_id) const;
+};
+
 class Dictionnary
 {
   public:
     sorting_map_t  m_sorting_map; // key=position; value=criterion_id
+    std::vector<bool> m_range_levels; // key=level; equality transitions coalesced into ranges
+    std::vector<bool> m_disjoint_levels; // key=level; pair transitions split into disjoint intervals
+    std::vector<bool> m_deterministic_levels; // key=level; determinised (one transition per value)
 
-    Dictionnary(const rulePack_s& rulepack);
+    // scans the rules, or restores the section of a snapshot positioned at it (the rules being
+    // scanned when it is unreadable)
+    Dictionnary(const rulePack_s& rulepack, SnapshotReader* snapshot = NULL);
 
     // sorting
     sorting_map_t sort_by_n_of_values(const SortOrder order, std::vector<int16_t>* arbitrary = NULL);
 
-    dictionnary_t get_criterion_dic_by_level(const criterionid_t& level) const;
+    // reassigns the value ids of the simple criteria (but the first level and those holding
+    // IN-lists) so that values found in the same rule contexts are contiguous, and flags their
+    // levels for range coalescing;
+    // to be called once the sorting is final
+    void cluster_by_context(const rulePack_s& rulepack);
+
+    // flags the pair criteria levels (but the first and the last ones) whose overlapping
+    // intervals are to be split; to be called once the sorting is final
+    void flag_disjoint_levels(const rulePack_s& rulepack);
+
+    // levels whose IN-lists are kept as set-membership transitions (never the first one, indexed
+    // by value id, nor the content)
+    bool is_set_level(const criterionid_t& level) const;
+
+    const ValueTable& get_criterion_dic_by_level(const criterionid_t& level) const;
     int16_t get_level_by_criterion_id(const criterionid_t& criterion_id) const;
 
     operand_t get_valueid_by_sort(const criterionid_t& sort_id, const std::string& value) const;
     operand_t get_valueid_by_level(const criterionid_t& level, const std::string& value) const;
+    // value id of a code of the rule store (the contents after the criteria); valid for the rule
+    // pack of the dictionnary and for its selections, which share its pools
+    operand_t get_valueid_by_code(const criterionid_t& sort_id, const operand_t& code) const;
 
     void dump_dictionnary(const std::string& filename);
+    void dump_dictionnary(std::ostream* filecsv);
+    // criterion of each level, so the runtime query encoder can parse raw values (see cpu/)
+    void dump_criteria(const std::string& filename, const rulePack_s& rulepack) const;
+    void dump_criteria(std::ostream* filecsv, const rulePack_s& rulepack) const;
+    // section of a snapshot holding the value ids (see snapshot.h)
+    void save(SnapshotWriter* snapshot) const;
 
   private:
     dic_criteria_t m_dic_criteria; // per criterion_id > per value > ID
     dictionnary_t  m_dic_contents;  // per value > ID
+    std::vector<ValueTable> m_tables; // per criterion_id, then the contents (lookups)
+    std::vector<std::vector<operand_t>> m_code_ids; // per criterion_id, then contents > per code > ID
+    std::vector<bool> m_list_criteria; // per criterion_id; holds IN-lists
+
+    // (re)builds the lookup tables once the value ids are assigned
+    void build_tables(const ruleStore_s& rules);
+    bool load(SnapshotReader* snapshot, const rulePack_s& rulepack);
 
     bool exists_in_vector(const std::vector<int16_t> vec, const criterionid_t& point);
     struct sort_pred_inv
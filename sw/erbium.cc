@@ -21,10 +21,12 @@
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include <string>
-#include <exception>
+#include <stdexcept>    // std::length_error
 #include <iostream>     // std::cout
 #include <iomanip>      // std::setw
+#include <sstream>      // in-memory images of a bundle
 #include <chrono>       // time
+#include <algorithm>    // std::max_element
 #include <math.h>
 #include <unistd.h>
 
@@ -32,9 +34,455 @@
 #include "rule_parser.h"
 #include "dictionnary.h"
 #include "graph_handler.h"
+#include "sorting_optimiser.h"
+#include "snapshot.h"
+#include "compiler.h"
+
+// compiles the NFA of every sorting heuristic concurrently and exports the best one
+int compile_all_heuristics(const erbium::rulePack_s& rulepack,
+                           const std::string& dest_folder,
+                           const std::string& workload_file,
+                           const uint32_t& iterations,
+                           const uint32_t& image_version)
+{
+    struct variant_s
+    {
+        erbium::Dictionnary*   dic;
+        erbium::GraphHandler*  nfa;
+        std::vector<uint>      transitions_per_level;
+        uint32_t n_states;
+        uint32_t n_transitions;
+        uint     max_depth;   // largest per-level memory
+        double   latency;     // average transitions visited per query
+        double   cost;        // optimiser cost model (latency, tail and memory)
+        double   elapsed;
+    };
+    const int n_variants = erbium::SortOption::Optimised + 1;
+    std::vector<variant_s> variants(n_variants);
+
+    std::cout << "# HEURISTICS" << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int option = 0; option < n_variants; option++)
+    {
+        auto v_start = std::chrono::high_resolution_clock::now();
+        variant_s& variant = variants[option];
+
+        variant.dic = new erbium::Dictionnary(rulepack);
+        erbium::Compiler::sort_criteria(static_cast<erbium::SortOption>(option), rulepack, variant.dic,
+                                        workload_file, iterations);
+
+        variant.nfa = new erbium::GraphHandler(&rulepack, variant.dic);
+        variant.nfa->suffix_reduction();
+        variant.nfa->consolidate_graph();
+
+        variant.n_states = variant.nfa->get_num_states();
+        variant.n_transitions = variant.nfa->get_num_transitions();
+        variant.transitions_per_level = variant.nfa->get_transitions_per_level();
+        variant.max_depth = *std::max_element(variant.transitions_per_level.begin(),
+                                              variant.transitions_per_level.end());
+
+        erbium::SortingOptimiser optimiser(rulepack, variant.dic);
+        if (!workload_file.empty() && !optimiser.load_workload(workload_file, rulepack))
+            printf("[!] Failed to load workload %s, replaying rules instead\n", workload_file.c_str());
+        const auto cost = optimiser.evaluate(variant.dic->m_sorting_map);
+        variant.latency = cost.visited;
+        variant.cost = cost.total;
+
+        std::chrono::duration<double> v_elapsed = std::chrono::high_resolution_clock::now() - v_start;
+        variant.elapsed = v_elapsed.count();
+    }
+
+    // best: fits the memory units, then lowest cost
+    int best = -1;
+    for (int option = 0; option < n_variants; option++)
+    {
+        if (variants[option].max_depth > erbium::CFG_MEM_MAX_DEPTH)
+            continue;
+        if (best < 0 || variants[option].cost < variants[best].cost)
+            best = option;
+    }
+
+    auto finish = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = finish - start;
+
+    printf("heuristic     states  transitions  max depth  est. latency      cost  compile (s)\n");
+    for (int option = 0; option < n_variants; option++)
+    {
+        const variant_s& variant = variants[option];
+        printf("%-9s %10u %12u %10u %13.2f %9.2f %12.3f%s\n",
+            erbium::SortOptionTag[option].c_str(),
+            variant.n_states,
+            variant.n_transitions,
+            variant.max_depth,
+            variant.latency,
+            variant.cost,
+            variant.elapsed,
+            (option == best) ? "  <- best" : (variant.max_depth > erbium::CFG_MEM_MAX_DEPTH) ? "  infeasible" : "");
+    }
+    std::cout << "# HEURISTICS COMPLETED in " << elapsed.count() << " s\n";
+
+    if (best < 0)
+    {
+        printf("[!] No heuristic fits into the memory units (max depth %u)\n", erbium::CFG_MEM_MAX_DEPTH);
+    }
+    else
+    {
+        std::cout << "# EXPORT " << erbium::SortOptionTag[best] << std::endl;
+        const variant_s& variant = variants[best];
+
+        variant.dic->dump_dictionnary(dest_folder + "dictionnary.csv");
+        variant.dic->dump_criteria(dest_folder + "criteria.csv", rulepack);
+        erbium::RuleParser::export_vhdl_parameters(
+                    dest_folder + "cfg_criteria_" + erbium::SortOptionTag[best] + ".vhd",
+                    rulepack,
+                    variant.dic,
+                    variant.transitions_per_level);
+        variant.nfa->export_memory(dest_folder + "mem_nfa_edges.bin", NULL, erbium::WildcardFirst, image_version);
+        std::cout << "NFA hash: " << variant.nfa->get_graph_hash() << std::endl;
+        erbium::RuleParser::export_benchmark_workload(dest_folder, rulepack, variant.dic, image_version);
+    }
+
+    for (auto& variant : variants)
+    {
+        delete variant.nfa;
+        delete variant.dic;
+    }
+    return (best >= 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// writes an export of the compiler into the destination folder, unless it is empty
+void write_export(const std::string& filename, const std::string& content)
+{
+    if (content.empty())
+        return;
+    std::ofstream file(filename, std::ios::out | std::ios::trunc | std::ios::binary);
+    file.write(content.data(), content.size());
+    file.close();
+}
+
+// snapshot of the parsed rules and of their initial dictionnary (an abr dataset of one pack)
+bool save_snapshot(const std::string& filename,
+                   const erbium::rulePack_s& rulepack,
+                   const erbium::Dictionnary& dic,
+                   const std::string& rules_file,
+                   const std::string& ruletype_file)
+{
+    erbium::SnapshotWriter snapshot;
+    snapshot.put(rulepack.m_ruleType.m_organization);
+    snapshot.put(rulepack.m_ruleType.m_code);
+    snapshot.put<uint64_t>(1);
+    rulepack.save(&snapshot);
+    const size_t offset = snapshot.tell();
+    snapshot.put<uint64_t>(0);
+    dic.save(&snapshot);
+    snapshot.patch(offset, snapshot.tell() - offset - sizeof(uint64_t));
+    return snapshot.save(filename,
+                         erbium::snapshot_source_s::of(rules_file),
+                         erbium::snapshot_source_s::of(ruletype_file));
+}
+
+// reads the rule pack of an up-to-date snapshot, leaving it at the dictionnary section
+bool load_snapshot(erbium::SnapshotReader* snapshot,
+                   const std::string& filename,
+                   erbium::rulePack_s* rulepack,
+                   const std::string& rules_file,
+                   const std::string& ruletype_file)
+{
+    if (!snapshot->open(filename))
+        return false;
+
+    const erbium::snapshot_source_s rules = erbium::snapshot_source_s::of(rules_file);
+    const erbium::snapshot_source_s ruletype = erbium::snapshot_source_s::of(ruletype_file);
+    if ((rules.known() && !(rules == snapshot->header().rules))
+        || (ruletype.known() && !(ruletype == snapshot->header().ruletype)))
+    {
+        printf("[!] Snapshot %s is out of date with its sources, parsing them\n", filename.c_str());
+        snapshot->close();
+        return false;
+    }
+
+    std::string organization, application;
+    uint64_t n_packs, dictionnary_size;
+    snapshot->get(&organization);
+    snapshot->get(&application);
+    snapshot->get(&n_packs);
+    bool valid = (n_packs == 1) && rulepack->load(snapshot);
+    snapshot->get(&dictionnary_size);
+    if (valid && snapshot->good() && dictionnary_size > 0)
+        return true;
+
+    printf("[!] Snapshot %s holds no compilable rule pack, parsing the sources\n", filename.c_str());
+    snapshot->close();
+    *rulepack = erbium::rulePack_s();
+    return false;
+}
+
+// abr dataset of an XML file or of a snapshot (abr_dataset_s::save)
+bool load_dataset(const std::string& filename, erbium::abr_dataset_s* dataset)
+{
+    uint32_t magic = 0;
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+        printf("[!] Failed to open dataset %s\n", filename.c_str());
+        return false;
+    }
+    file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    file.close();
+
+    if (magic == erbium::C_SNAPSHOT_MAGIC)
+        return dataset->load_snapshot(filename);
+    dataset->load(filename);
+    return true;
+}
+
+// compiles every rule pack of the dataset concurrently, each with its own dictionnary and order,
+// and exports their images as one bundle dispatched by rule type id (position in the dataset)
+int compile_bundle(const erbium::abr_dataset_s& dataset,
+                   const std::string& dest_folder,
+                   const erbium::SortOption& sorting_option,
+                   const uint32_t& iterations,
+                   const bool& prune,
+                   const bool& coalesce,
+                   const bool& disjoint,
+                   const bool& depth_first,
+                   const uint32_t& image_version)
+{
+    struct image_s
+    {
+        const erbium::rulePack_s* pack;
+        uint16_t n_criteria;
+        uint32_t n_rules;
+        uint32_t n_states;
+        uint32_t n_transitions;
+        uint     max_depth;
+        std::string image;
+        std::string image_dfs;
+        uint64_t offset;
+        uint64_t offset_dfs;
+    };
+
+    std::cout << "# BUNDLE" << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // hosts of the hardware engine run one rule type at a time: bundles are described images
+    const uint32_t version = (image_version == erbium::C_IMAGE_VERSION_FIXED)
+                           ? erbium::C_IMAGE_VERSION_DESCRIBED : image_version;
+    const uint addressable = 1 << erbium::CFG_TRANSITION_POINTER_WIDTH;
+    std::vector<image_s> images;
+    for (auto& pack : dataset.m_rulePacks)
+    {
+        image_s image;
+        image.pack = &pack;
+        images.push_back(image);
+    }
+    if (images.empty() || images.size() > UINT16_MAX)
+    {
+        printf("[!] Dataset of %lu rule packs cannot be bundled\n", images.size());
+        return EXIT_FAILURE;
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t k = 0; k < images.size(); k++)
+    {
+        image_s& image = images[k];
+
+        // IN-lists are expanded into one rule per value (a copy is only made when some exist)
+        const std::vector<bool> listed = image.pack->m_rules.get_list_criteria();
+        const bool has_lists = std::find(listed.begin(), listed.end(), true) != listed.end();
+        erbium::rulePack_s expanded;
+        if (has_lists)
+        {
+            expanded = *image.pack;
+            erbium::Compiler::expand_value_lists(&expanded, false);
+        }
+        const erbium::rulePack_s& rulepack = (has_lists) ? expanded : *image.pack;
+        const std::string prefix = dest_folder + "bundle_" + std::to_string(k) + "_";
+        image.n_criteria = rulepack.m_ruleType.m_criterionDefinition.size();
+
+        erbium::Dictionnary dic(rulepack);
+        erbium::Compiler::sort_criteria(sorting_option, rulepack, &dic, "", iterations);
+        if (coalesce)
+            dic.cluster_by_context(rulepack);
+        if (disjoint)
+            dic.flag_disjoint_levels(rulepack);
+        dic.dump_dictionnary(prefix + "dictionnary.csv");
+        dic.dump_criteria(prefix + "criteria.csv", rulepack);
+
+        // the dictionnary and the workload keep every rule, the graph is built without dead ones
+        erbium::rulePack_s pruned;
+        if (prune)
+        {
+            pruned = rulepack;
+            pruned.remove_dominated_rules();
+        }
+        const erbium::rulePack_s* compiled = (prune) ? &pruned : &rulepack;
+        image.n_rules = compiled->m_rules.size();
+
+        erbium::GraphHandler nfa(compiled, &dic);
+        nfa.suffix_reduction();
+        if (coalesce)
+        {
+            nfa.coalesce_ranges();
+            nfa.suffix_reduction();
+        }
+        if (disjoint)
+        {
+            nfa.split_intervals();
+            nfa.suffix_reduction();
+        }
+        nfa.consolidate_graph();
 
-enum SortOption { None, H1_Ascending, H1_Descending, H2_Ascending, H2_Descending };
-std::string SortOptionTag[] = {"hRand", "h1Asc", "h1Des", "h2Asc", "h2Des"};
+        image.n_states = nfa.get_num_states();
+        image.n_transitions = nfa.get_num_transitions();
+        const std::vector<uint> transitions_per_level = nfa.get_transitions_per_level();
+        image.max_depth = *std::max_element(transitions_per_level.begin(), transitions_per_level.end());
+
+        std::ostringstream memory(std::ios::out | std::ios::binary);
+        nfa.export_memory(&memory, NULL, erbium::WildcardFirst, version);
+        image.image = memory.str();
+        if (depth_first)
+        {
+            std::ostringstream memory_dfs(std::ios::out | std::ios::binary);
+            nfa.export_memory_depth_first(&memory_dfs, NULL, erbium::WildcardFirst, version);
+            image.image_dfs = memory_dfs.str();
+        }
+        erbium::RuleParser::export_benchmark_workload(prefix, rulepack, &dic, version);
+    }
+
+    // bundle: header, entries, then the images aligned to a cache line
+    auto align = [](const uint64_t& offset) {
+        return (offset + erbium::C_CACHELINE_SIZE - 1) / erbium::C_CACHELINE_SIZE * erbium::C_CACHELINE_SIZE;
+    };
+    auto write_bundle = [&](const std::string& filename, const bool& dfs) {
+        erbium::bundle_header_s header;
+        header.magic = erbium::C_BUNDLE_MAGIC;
+        header.version = erbium::C_BUNDLE_VERSION;
+        header.n_images = images.size();
+
+        std::vector<erbium::bundle_entry_s> entries(images.size());
+        uint64_t offset = align(sizeof(header) + entries.size() * sizeof(erbium::bundle_entry_s));
+        for (size_t k = 0; k < images.size(); k++)
+        {
+            const std::string& image = (dfs) ? images[k].image_dfs : images[k].image;
+            entries[k].rule_type = k;
+            entries[k].n_criteria = images[k].n_criteria;
+            entries[k].reserved = 0;
+            entries[k].offset = offset;
+            entries[k].size = image.size();
+            ((dfs) ? images[k].offset_dfs : images[k].offset) = offset;
+            offset = align(offset + image.size());
+        }
+
+        std::ofstream bundle(filename, std::ios::out | std::ios::trunc | std::ios::binary);
+        bundle.write((char*)&header, sizeof(header));
+        bundle.write((char*)entries.data(), entries.size() * sizeof(erbium::bundle_entry_s));
+        for (size_t k = 0; k < images.size(); k++)
+        {
+            const std::string& image = (dfs) ? images[k].image_dfs : images[k].image;
+            const std::string padding(entries[k].offset - bundle.tellp(), '\0');
+            bundle.write(padding.data(), padding.size());
+            bundle.write(image.data(), image.size());
+        }
+        bundle.close();
+    };
+    write_bundle(dest_folder + "mem_nfa_bundle.bin", false);
+    if (depth_first)
+        write_bundle(dest_folder + "mem_nfa_bundle_dfs.bin", true);
+
+    // workload: the queries of the rule types interleaved, each led by its rule type id
+    std::vector<std::vector<char>> workloads(images.size());
+    std::vector<uint32_t> query_sizes(images.size());
+    uint32_t n_queries = 0;
+    uint16_t max_criteria = 0;
+    for (size_t k = 0; k < images.size(); k++)
+    {
+        std::ifstream benchmark(dest_folder + "bundle_" + std::to_string(k) + "_benchmark.bin",
+                                std::ios::in | std::ios::binary);
+        uint32_t benchmark_size = 0;
+        benchmark.read(reinterpret_cast<char*>(&query_sizes[k]), sizeof(query_sizes[k]));
+        benchmark.read(reinterpret_cast<char*>(&benchmark_size), sizeof(benchmark_size));
+        workloads[k].resize((size_t)query_sizes[k] * benchmark_size);
+        benchmark.read(workloads[k].data(), workloads[k].size());
+        n_queries += benchmark_size;
+        max_criteria = std::max(max_criteria, images[k].n_criteria);
+    }
+    uint32_t query_size = (1 + max_criteria) * sizeof(erbium::operand_t);
+    query_size = align(query_size);
+
+    std::ofstream benchfile(dest_folder + "benchmark_bundle.bin", std::ios::out | std::ios::trunc | std::ios::binary);
+    std::ofstream benchcsv(dest_folder + "benchmark_bundle.csv", std::ios::out | std::ios::trunc);
+    benchfile.write(reinterpret_cast<char*>(&query_size), sizeof(query_size));
+    benchfile.write(reinterpret_cast<char*>(&n_queries), sizeof(n_queries));
+    benchcsv << "query_id,rule_type,rule_type_query_id\n";
+    std::vector<char> query(query_size);
+    uint32_t query_id = 0;
+    for (uint32_t row = 0; query_id < n_queries; row++)
+    {
+        for (size_t k = 0; k < images.size(); k++)
+        {
+            if ((size_t)row * query_sizes[k] >= workloads[k].size())
+                continue;
+            const uint16_t rule_type = k;
+            std::fill(query.begin(), query.end(), 0);
+            memcpy(query.data(), &rule_type, sizeof(rule_type));
+            memcpy(query.data() + sizeof(rule_type), &workloads[k][(size_t)row * query_sizes[k]],
+                   images[k].n_criteria * sizeof(erbium::operand_t));
+            benchfile.write(query.data(), query.size());
+            benchcsv << query_id++ << "," << k << "," << row << "\n";
+        }
+    }
+    benchfile.close();
+    benchcsv.close();
+
+    auto finish = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = finish - start;
+
+    // index of the bundle
+    std::ofstream index(dest_folder + "bundle.csv", std::ios::out | std::ios::trunc);
+    index << "rule_type,organization,code,release,criteria,rules,states,transitions,"
+          << "image_offset,image_size,image_dfs_offset,image_dfs_size,dictionnary,benchmark\n";
+
+    bool feasible = true;
+    printf("type  code          criteria    rules     states  transitions  max depth  image (B)\n");
+    for (size_t k = 0; k < images.size(); k++)
+    {
+        const image_s& image = images[k];
+        const erbium::ruleType_s& ruletype = image.pack->m_ruleType;
+        const bool fits = version == erbium::C_IMAGE_VERSION_PACKED || image.max_depth <= addressable;
+        printf("%4lu  %-12s %9u %8u %10u %12u %10u %10lu%s\n",
+            k,
+            ruletype.m_code.c_str(),
+            image.n_criteria,
+            image.n_rules,
+            image.n_states,
+            image.n_transitions,
+            image.max_depth,
+            image.image.size(),
+            (fits) ? "" : "  infeasible");
+        feasible &= fits;
+
+        const std::string prefix = "bundle_" + std::to_string(k) + "_";
+        index << k << "," << ruletype.m_organization << "," << ruletype.m_code << ","
+              << ruletype.m_release << "," << image.n_criteria << "," << image.n_rules << ","
+              << image.n_states << "," << image.n_transitions << ","
+              << image.offset << "," << image.image.size() << ",";
+        if (depth_first)
+            index << image.offset_dfs << "," << image.image_dfs.size();
+        else
+            index << ",";
+        index << "," << prefix << "dictionnary.csv," << prefix << "benchmark.bin\n";
+    }
+    index.close();
+    std::cout << "bundle of " << images.size() << " rule types, " << n_queries << " queries\n";
+    std::cout << "# BUNDLE COMPLETED in " << elapsed.count() << " s\n";
+
+    if (!feasible)
+        printf("[!] Some rule types exceed the fixed widths of the memory units: export the packed bundle (-v 2)\n");
+    return (feasible) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
 int main(int argc, char** argv)
 {
@@ -43,14 +491,42 @@ int main(int argc, char** argv)
     ////////////////////////////////////////////////////////////////////////////////////////////////
     std::cout << "# PARAMETERS" << std::endl;
 
-    SortOption sorting_option = H2_Descending;
+    erbium::SortOption sorting_option = erbium::H2_Descending;
     std::string dest_folder = "build/";
     std::string rules_file = "../data/mct_rules.csv";
     std::string ruletype_file = "../data/mct_ruleTypeDefinition_MCT_v1.xml";
+    std::string workload_file = "";
+    std::string snapshot_file = "";
+    std::string dataset_file = "";
+    uint32_t optimiser_iterations = 200;
+    bool estimate_only = false;
+    bool compile_all = false;
+    int transition_layout = 0;
+    bool depth_first = false;
+    bool coalesce = false;
+    bool disjoint = false;
+    int32_t dfa_budget = -1;
+    bool hybrid = false;
+    bool prune = false;
+    bool value_lists = false;
+    int32_t shard_depth = -1;
+    uint32_t image_version = erbium::C_IMAGE_VERSION_FIXED;
 
     int opt;
-    while ((opt = getopt(argc, argv, "d:r:s:t:h")) != -1) {
+    while ((opt = getopt(argc, argv, "ab:cd:efg:i:k:l:mnpr:s:t:uv:w:x:h")) != -1) {
         switch (opt) {
+        case 'a':
+            compile_all = true;
+            break;
+        case 'b':
+            dfa_budget = atoi(optarg);
+            break;
+        case 'c':
+            coalesce = true;
+            break;
+        case 'e':
+            estimate_only = true;
+            break;
         case 'd':
             dest_folder = optarg;
             break;
@@ -61,15 +537,69 @@ int main(int argc, char** argv)
             ruletype_file = optarg;
             break;
         case 's':
-            sorting_option = static_cast<SortOption>(atoi(optarg));
+            sorting_option = static_cast<erbium::SortOption>(atoi(optarg));
+            break;
+        case 'g':
+            dataset_file = optarg;
+            break;
+        case 'i':
+            optimiser_iterations = atoi(optarg);
+            break;
+        case 'v':
+            image_version = atoi(optarg);
+            break;
+        case 'w':
+            workload_file = optarg;
+            break;
+        case 'x':
+            snapshot_file = optarg;
+            break;
+        case 'k':
+            shard_depth = atoi(optarg);
+            break;
+        case 'l':
+            transition_layout = atoi(optarg);
+            break;
+        case 'f':
+            depth_first = true;
+            break;
+        case 'm':
+            hybrid = true;
+            break;
+        case 'n':
+            disjoint = true;
+            break;
+        case 'p':
+            prune = true;
+            break;
+        case 'u':
+            value_lists = true;
             break;
         case 'h':
         default: /* '?' */
             std::cerr << "Usage: " << argv[0] << "\n"
+                      << "\t-a  compile all sorting heuristics and export the best one\n"
+                      << "\t-b  also export a DFA bounded to this number of states (0 = unbounded)\n"
+                      << "\t-c  coalesce adjacent equality transitions into ranges (-v 2 or 3)\n"
                       << "\t-d  destination folder\n"
+                      << "\t-e  estimate the NFA size for the selected sorting and exit\n"
+                      << "\t-f  also export a depth-first NFA image for the CPU engine\n"
+                      << "\t-g  abr dataset (XML or snapshot): compile every rule pack into one bundle\n"
+                      << "\t-i  optimiser iterations (sorting 5)\n"
+                      << "\t-k  split the rules into shards of at most this many transitions per level (0 = memory depth)\n"
+                      << "\t-l  transition layout: 0=Sorted 1=Hot_WildcardFirst 2=Hot_WildcardLast 3=Hot\n"
+                      << "\t-m  determinise the levels selected by the cost model (hybrid image)\n"
+                      << "\t-n  normalise overlapping pair transitions into disjoint intervals\n"
+                      << "\t-p  prune dominated rules before building the graph\n"
                       << "\t-r  rules file\n"
-                      << "\t-s  sorting: 0=None 1=H1_Asc 2=H1_Desc 4=H2_Asc 5=H2_Desc\n"
+                      << "\t-s  sorting: 0=None 1=H1_Asc 2=H1_Desc 3=H2_Asc 4=H2_Desc 5=Optimised\n"
                       << "\t-t  ruletype file\n"
+                      << "\t-u  keep the IN-lists (A|B) of the simple criteria as set-membership transitions\n"
+                      << "\t    (CPU engine, -v 2 or 3); they are expanded into one rule per value otherwise\n"
+                      << "\t-v  image format: 1=fixed widths (hardware) 2=packed per-level widths (CPU engine)\n"
+                      << "\t                  3=fixed widths with self-describing header\n"
+                      << "\t-w  sample workload (benchmark.bin) for the optimiser cost model\n"
+                      << "\t-x  snapshot of the parsed rules: read instead of -r/-t when up to date, written otherwise\n"
                       << "\t-h  help\n";
             exit(EXIT_FAILURE);
         }
@@ -79,14 +609,69 @@ int main(int argc, char** argv)
         dest_folder = dest_folder + "/";
 
     std::cout << "-d destination folder: " << dest_folder << std::endl;
+    if (compile_all)
+        std::cout << "-a compile all heuristics" << std::endl;
+    if (dfa_budget >= 0)
+        std::cout << "-b DFA state budget: " << dfa_budget << std::endl;
+    if (coalesce)
+        std::cout << "-c coalesce ranges" << std::endl;
+    if (estimate_only)
+        std::cout << "-e estimate only" << std::endl;
     std::cout << "-r rules file: " << rules_file << std::endl;
-    printf("-s sorting: [%c]none [%c]H1_Asc [%c]H1_Desc [%c]H2_Asc [%c]H2_Desc\n",
-            (sorting_option==SortOption::None)          ? 'x' : ' ',
-            (sorting_option==SortOption::H1_Ascending)  ? 'x' : ' ',
-            (sorting_option==SortOption::H1_Descending) ? 'x' : ' ',
-            (sorting_option==SortOption::H2_Ascending)  ? 'x' : ' ',
-            (sorting_option==SortOption::H2_Descending) ? 'x' : ' ');
+    printf("-s sorting: [%c]none [%c]H1_Asc [%c]H1_Desc [%c]H2_Asc [%c]H2_Desc [%c]Optimised\n",
+            (sorting_option==erbium::SortOption::None)          ? 'x' : ' ',
+            (sorting_option==erbium::SortOption::H1_Ascending)  ? 'x' : ' ',
+            (sorting_option==erbium::SortOption::H1_Descending) ? 'x' : ' ',
+            (sorting_option==erbium::SortOption::H2_Ascending)  ? 'x' : ' ',
+            (sorting_option==erbium::SortOption::H2_Descending) ? 'x' : ' ',
+            (sorting_option==erbium::SortOption::Optimised)     ? 'x' : ' ');
+    if (sorting_option == erbium::SortOption::Optimised)
+        std::cout << "-i optimiser iterations: " << optimiser_iterations << std::endl;
+    if (shard_depth == 0)
+        shard_depth = 1 << erbium::CFG_TRANSITION_POINTER_WIDTH;
+    if (shard_depth > 0)
+        std::cout << "-k shard depth: " << shard_depth << std::endl;
+    printf("-l transition layout: [%c]Sorted [%c]Hot_WildcardFirst [%c]Hot_WildcardLast [%c]Hot\n",
+            (transition_layout == 0) ? 'x' : ' ',
+            (transition_layout == 1) ? 'x' : ' ',
+            (transition_layout == 2) ? 'x' : ' ',
+            (transition_layout == 3) ? 'x' : ' ');
+    if (hybrid)
+        std::cout << "-m hybrid image" << std::endl;
+    if (disjoint)
+        std::cout << "-n disjoint intervals" << std::endl;
+    if (prune)
+        std::cout << "-p prune dominated rules" << std::endl;
     std::cout << "-t ruletype file: " << ruletype_file << std::endl;
+    if (value_lists)
+        std::cout << "-u value sets" << std::endl;
+    printf("-v image format: [%c]fixed [%c]packed [%c]described\n",
+            (image_version == erbium::C_IMAGE_VERSION_FIXED)     ? 'x' : ' ',
+            (image_version == erbium::C_IMAGE_VERSION_PACKED)    ? 'x' : ' ',
+            (image_version == erbium::C_IMAGE_VERSION_DESCRIBED) ? 'x' : ' ');
+    if (image_version < erbium::C_IMAGE_VERSION_FIXED || image_version > erbium::C_IMAGE_VERSION_DESCRIBED)
+    {
+        printf("[!] Unknown image format %u\n", image_version);
+        exit(EXIT_FAILURE);
+    }
+    if (value_lists && image_version == erbium::C_IMAGE_VERSION_FIXED)
+    {
+        printf("[!] Value sets (-u) need a self-describing image (-v 2 or 3)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (coalesce && image_version == erbium::C_IMAGE_VERSION_FIXED)
+    {
+        printf("[!] Coalesced ranges (-c) need a self-describing image (-v 2 or 3)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (depth_first)
+        std::cout << "-f depth-first image: " << dest_folder << "mem_nfa_edges_dfs.bin" << std::endl;
+    if (!workload_file.empty())
+        std::cout << "-w sample workload: " << workload_file << std::endl;
+    if (!snapshot_file.empty())
+        std::cout << "-x snapshot: " << snapshot_file << std::endl;
+    if (!dataset_file.empty())
+        std::cout << "-g abr dataset: " << dataset_file << std::endl;
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // LOAD                                                                                       //
@@ -94,254 +679,152 @@ int main(int argc, char** argv)
 
     std::cout << "# LOAD" << std::endl;
     auto start = std::chrono::high_resolution_clock::now();
-    
-    erbium::rulePack_s the_rulePack;
-    the_rulePack.load_ruleType(ruletype_file);
-    the_rulePack.load_rules(rules_file);
+    auto finish = start;
+    std::chrono::duration<double> elapsed;
 
-    auto finish = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> elapsed = finish - start;
-    std::cout << the_rulePack.m_rules.size() << " rules loaded" << std::endl;
-    std::cout << "# LOAD COMPLETED in " << elapsed.count() << " s\n";
-
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-    // DICTIONNARY                                                                                //
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-    
-    std::cout << "# DICTIONNARY" << std::endl;
-    start = std::chrono::high_resolution_clock::now();
-    
-    erbium::Dictionnary the_dictionnary(the_rulePack);
-
-    switch (sorting_option)
+    if (!dataset_file.empty())
     {
-        case SortOption::H1_Ascending:
-            std::cout << "H1_Ascending sort" << std::endl;
-            the_dictionnary.sort_by_n_of_values(erbium::SortOrder::Ascending);
-            break;
-
-        case SortOption::H1_Descending:
-            std::cout << "H1_Descending sort" << std::endl;
-            the_dictionnary.sort_by_n_of_values(erbium::SortOrder::Descending);
-            break;
-
-        case SortOption::H2_Ascending:
-        {
-            std::cout << "Arbitrary order H2_Ascending" << std::endl;
-            std::vector<int16_t> arbitrary; // key=position; value=criteria_id
-            for (auto& aux __attribute__((unused)) : the_rulePack.m_ruleType.m_criterionDefinition)
-                 arbitrary.push_back(-1);
-            arbitrary[ 0] = the_rulePack.m_ruleType.get_criterion_id("MCT_OFF");
-            arbitrary[ 1] = the_rulePack.m_ruleType.get_criterion_id("MCT_BRD");
-            arbitrary[ 2] = the_rulePack.m_ruleType.get_criterion_id("CTN_TYPE");
-            arbitrary[19] = the_rulePack.m_ruleType.get_criterion_id("MCT_PRD");
-            arbitrary[20] = the_rulePack.m_ruleType.get_criterion_id("OUT_FLT_RG");
-            arbitrary[21] = the_rulePack.m_ruleType.get_criterion_id("IN_FLT_RG");
-            the_dictionnary.sort_by_n_of_values(erbium::SortOrder::Ascending, &arbitrary);
-        }
-            break;
+        if (compile_all || estimate_only || shard_depth > 0 || hybrid || dfa_budget >= 0
+            || transition_layout > 0 || !workload_file.empty() || !snapshot_file.empty() || value_lists)
+            printf("[!] Bundles only take -c -f -i -n -p -s -v: the other options are ignored\n");
+
+        erbium::abr_dataset_s the_dataset;
+        if (!load_dataset(dataset_file, &the_dataset))
+            return EXIT_FAILURE;
+
+        finish = std::chrono::high_resolution_clock::now();
+        elapsed = finish - start;
+        size_t n_rules = 0;
+        for (auto& pack : the_dataset.m_rulePacks)
+            n_rules += pack.m_rules.size();
+        printf("%lu rule packs of %lu rules loaded\n", the_dataset.m_rulePacks.size(), n_rules);
+        std::cout << "# LOAD COMPLETED in " << elapsed.count() << " s\n";
+
+        return compile_bundle(the_dataset, dest_folder, sorting_option, optimiser_iterations,
+                              prune, coalesce, disjoint, depth_first, image_version);
+    }
 
-        case SortOption::H2_Descending:
+    erbium::rulePack_s the_rulePack;
+    erbium::SnapshotReader snapshot;
+    const bool from_snapshot = !snapshot_file.empty()
+        && load_snapshot(&snapshot, snapshot_file, &the_rulePack, rules_file, ruletype_file);
+    if (from_snapshot)
+    {
+        finish = std::chrono::high_resolution_clock::now();
+        elapsed = finish - start;
+        printf("%lu rules loaded from snapshot (%.4f s for %.2f MB)\n",
+               the_rulePack.m_rules.size(),
+               elapsed.count(),
+               (snapshot.header().header_size + snapshot.header().payload_size) / 1e6);
+    }
+    else
+    {
+        the_rulePack.load_ruleType(ruletype_file);
+        finish = std::chrono::high_resolution_clock::now();
+        elapsed = finish - start;
+        const double ruletype_time = elapsed.count();
+        const size_t rules_size = the_rulePack.load_rules(rules_file);
+
+        finish = std::chrono::high_resolution_clock::now();
+        elapsed = finish - start;
+        printf("%lu rules loaded (rule type %.4f s, rules %.4f s for %.2f MB: %.1f MB/s)\n",
+               the_rulePack.m_rules.size(),
+               ruletype_time,
+               elapsed.count() - ruletype_time,
+               rules_size / 1e6,
+               rules_size / 1e6 / std::max(elapsed.count() - ruletype_time, 1e-9));
+
+        if (!snapshot_file.empty())
         {
-            std::cout << "Arbitrary order H2_Descending" << std::endl;
-            std::vector<int16_t> arbitrary; // key=position; value=criteria_id
-            for (auto& aux __attribute__((unused)) : the_rulePack.m_ruleType.m_criterionDefinition)
-                 arbitrary.push_back(-1);
-            arbitrary[ 0] = the_rulePack.m_ruleType.get_criterion_id("MCT_OFF");
-            arbitrary[ 1] = the_rulePack.m_ruleType.get_criterion_id("MCT_BRD");
-            arbitrary[ 2] = the_rulePack.m_ruleType.get_criterion_id("CTN_TYPE");
-            arbitrary[19] = the_rulePack.m_ruleType.get_criterion_id("MCT_PRD");
-            arbitrary[20] = the_rulePack.m_ruleType.get_criterion_id("OUT_FLT_RG");
-            arbitrary[21] = the_rulePack.m_ruleType.get_criterion_id("IN_FLT_RG");
-            the_dictionnary.sort_by_n_of_values(erbium::SortOrder::Descending, &arbitrary);
+            if (save_snapshot(snapshot_file, the_rulePack, erbium::Dictionnary(the_rulePack),
+                              rules_file, ruletype_file))
+                std::cout << "snapshot written to " << snapshot_file << std::endl;
+            else
+                printf("[!] Failed to write snapshot %s\n", snapshot_file.c_str());
+            finish = std::chrono::high_resolution_clock::now();
+            elapsed = finish - start;
         }
-            break;
-
-        case SortOption::None:
-        default:
-            break;
     }
 
-    finish = std::chrono::high_resolution_clock::now();
-
-    the_dictionnary.dump_dictionnary(dest_folder + "dictionnary.csv");
-
-    elapsed = finish - start;
-    std::cout << "# DICTIONNARY COMPLETED in " << elapsed.count() << " s\n";
-
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-    // SANDBOX
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-
-    /*std::cout.fill(' ');
-    std::cout << ". Experiments on " << rules_file << " (r=" << the_rulePack.m_rules.size() << "):" << std::endl;
-
-    start = std::chrono::high_resolution_clock::now();
-    erbium::GraphHandler ticaTRE(&the_rulePack, &the_dictionnary);
-    ticaTRE.consolidate_graph();
-    finish = std::chrono::high_resolution_clock::now();
-    elapsed = finish - start;
-
-    std::cout << ".. Tre: s= " << std::setw(9) << ticaTRE.get_num_states()
-              << ", t= " << std::setw(9) << ticaTRE.get_num_transitions()
-              << " (" << elapsed.count() << ")" << std::endl;
-
-    erbium::GraphHandler ticaDFA(&the_rulePack, &the_dictionnary);
-    start = std::chrono::high_resolution_clock::now();
-    ticaDFA.make_deterministic();
-    ticaDFA.consolidate_graph();
-    finish = std::chrono::high_resolution_clock::now();
-    elapsed = finish - start;
-
-    std::cout << ".. DFA: s= " << std::setw(9) << ticaDFA.get_num_states()
-              << ", t= " << std::setw(9) << ticaDFA.get_num_transitions()
-              << " (" << elapsed.count() << ")" << std::endl;
-
-    start = std::chrono::high_resolution_clock::now();
-    ticaDFA.suffix_reduction();
-    ticaDFA.consolidate_graph();
-    finish = std::chrono::high_resolution_clock::now();
-    elapsed = finish - start;
-
-    std::cout << ".. DFA: s= " << std::setw(9) << ticaDFA.get_num_states()
-              << ", t= " << std::setw(9) << ticaDFA.get_num_transitions()
-              << " (" << elapsed.count() << ")" << std::endl;
-
-    erbium::GraphHandler ticaNFA(&the_rulePack, &the_dictionnary);
-    start = std::chrono::high_resolution_clock::now();
-    ticaNFA.suffix_reduction();
-    ticaNFA.consolidate_graph();
-    finish = std::chrono::high_resolution_clock::now();
-    elapsed = finish - start;
-
-    std::cout << ".. NFA: s= " << std::setw(9) << ticaNFA.get_num_states()
-              << ", t= " << std::setw(9) << ticaNFA.get_num_transitions()
-              << " (" << elapsed.count() << ")" << std::endl;
-
-    return 0;*/
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-    // GRAPH                                                                                      //
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-
-    std::cout << "# GRAPH" << std::endl;
-    start = std::chrono::high_resolution_clock::now();
-    
-    erbium::GraphHandler the_tree(&the_rulePack, &the_dictionnary);
-    the_tree.consolidate_graph();
-
-    finish = std::chrono::high_resolution_clock::now();
-    elapsed = finish - start;
-
-    // Stats
-    std::cout << "number of states: " << the_tree.get_num_states() << std::endl;
-    std::cout << "number of transitions: " << the_tree.get_num_transitions() << std::endl;
-    std::cout << "# GRAPH COMPLETED in " << elapsed.count() << " s\n";
-
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-    // DFA                                                                                        //
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-
-    // std::cout << "# DFA" << std::endl;
-    // 
-    // erbium::GraphHandler the_dfa(&the_rulePack, &the_dictionnary);
-    // start = std::chrono::high_resolution_clock::now();
-    //
-    // /*the_dfa.make_deterministic();
-    // the_dfa.suffix_reduction();*/
-    // the_dfa.consolidate_graph();
-    //
-    // finish = std::chrono::high_resolution_clock::now();
-    // elapsed = finish - start;
-    //
-    // // Stats
-    // std::cout << "number of states: " << the_dfa.get_num_states() << std::endl;
-    // std::cout << "number of transitions: " << the_dfa.get_num_transitions() << std::endl;
-    // std::cout << "# DFA COMPLETED in " << elapsed.count() << " s\n";
-
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-    // NFA                                                                                        //
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-
-    std::cout << "# NFA" << std::endl;
-    
-    erbium::GraphHandler the_nfa(&the_rulePack, &the_dictionnary);
-    start = std::chrono::high_resolution_clock::now();
-
-    the_nfa.suffix_reduction();
-    the_nfa.consolidate_graph();
-
-    finish = std::chrono::high_resolution_clock::now();
-    elapsed = finish - start;
-
-    // Stats
-    std::cout << "number of states: " << the_nfa.get_num_states() << std::endl;
-    std::cout << "number of transitions: " << the_nfa.get_num_transitions() << std::endl;
-    std::cout << "# NFA COMPLETED in " << elapsed.count() << " s\n";
-
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-    // FINAL STATS                                                                                //
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-
-    std::cout << "# NFA FINAL STATS" << std::endl;
-    the_nfa.print_stats();
-
-    std::cout << "total number of states: " << the_nfa.get_num_states() << std::endl;
-    std::cout << "total number of transitions: " << the_nfa.get_num_transitions() << std::endl;
-
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-    // EXPORT CORE PARAMETERS                                                                     //
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-
-    std::cout << "# EXPORT CORE PARAMETERS" << std::endl;
-    erbium::RuleParser::export_vhdl_parameters(
-                dest_folder + "cfg_criteria_" + SortOptionTag[sorting_option] + ".vhd",
-                the_rulePack,
-                &the_dictionnary,
-                the_nfa.get_transitions_per_level());
-
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-    // EXPORT GRAPHVIZ DOT FILE                                                                   //
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-    
-    std::cout << "# EXPORT GRAPHVIZ DOT FILE" << std::endl;
-
-    the_tree.export_graphviz(dest_folder + "graphviz_tree.dot");
-    //the_dfa.export_graphviz(dest_folder + "graphviz_dfa.dot");
-    the_nfa.export_graphviz(dest_folder + "graphviz_nfa.dot");
+    if (compile_all)
+    {
+        if (value_lists)
+            printf("[!] Value sets (-u) are not supported with -a: IN-lists are expanded\n");
+        const uint32_t n_expanded = erbium::Compiler::expand_value_lists(&the_rulePack, false);
+        if (n_expanded > 0)
+            printf("IN-lists expanded into %u more rules\n", n_expanded);
+        std::cout << "# LOAD COMPLETED in " << elapsed.count() << " s\n";
+        return compile_all_heuristics(the_rulePack, dest_folder, workload_file, optimiser_iterations,
+                                      image_version);
+    }
+    std::cout << "# LOAD COMPLETED in " << elapsed.count() << " s\n";
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
-    // MEMORY DUMP                                                                                //
+    // COMPILE                                                                                    //
     ////////////////////////////////////////////////////////////////////////////////////////////////
 
-    std::cout << "# MEMORY DUMP" << std::endl;
-
-    start = std::chrono::high_resolution_clock::now();
-
-    //the_dfa.export_memory(dest_folder + "mem_dfa_edges.bin");
-    the_nfa.export_memory(dest_folder + "mem_nfa_edges.bin");
-    finish = std::chrono::high_resolution_clock::now();
-
-    //std::cout << "DFA hash: " << the_dfa.get_graph_hash() << std::endl;
-    std::cout << "NFA hash: " << the_nfa.get_graph_hash() << std::endl;
-
-    elapsed = finish - start;
-    std::cout << "# MEMORY DUMP COMPLETED in " << elapsed.count() << " s\n";
+    erbium::compile_options_s options;
+    options.sorting = sorting_option;
+    options.iterations = optimiser_iterations;
+    options.workload_file = workload_file;
+    options.snapshot = (from_snapshot) ? &snapshot : NULL;
+    options.prune = prune;
+    options.coalesce = coalesce;
+    options.disjoint = disjoint;
+    options.value_lists = value_lists;
+    options.hybrid = hybrid;
+    options.dfa_budget = dfa_budget;
+    options.shard_depth = std::max(shard_depth, 0);
+    options.transition_layout = transition_layout;
+    options.image_version = image_version;
+    options.estimate_only = estimate_only;
+    options.image_dfs = depth_first;
+    options.vhdl = true;
+    options.graphviz = true;
+    options.workload = true;
+
+    erbium::compile_output_s output;
+    const bool compiled = erbium::Compiler::compile(the_rulePack, options, &output);
+    snapshot.close();
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
-    // WORKLOAD DUMP                                                                              //
+    // EXPORT                                                                                     //
     ////////////////////////////////////////////////////////////////////////////////////////////////
-    std::cout << "# WORKLOAD DUMP" << std::endl;
-    start = std::chrono::high_resolution_clock::now();
 
-    erbium::RuleParser::export_benchmark_workload(dest_folder, the_rulePack, &the_dictionnary);
-
-    finish = std::chrono::high_resolution_clock::now();
-    elapsed = finish - start;
-    std::cout << "# WORKLOAD DUMP COMPLETED in " << elapsed.count() << " s\n";
-    
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-    //                                                                                            //
-    ////////////////////////////////////////////////////////////////////////////////////////////////
+    const std::string tag = erbium::SortOptionTag[sorting_option];
+    write_export(dest_folder + "dictionnary.csv", output.dictionnary);
+    write_export(dest_folder + "criteria.csv", output.criteria);
+    write_export(dest_folder + "cfg_criteria_" + tag + ".vhd", output.vhdl);
+    write_export(dest_folder + "graphviz_tree.dot", output.graphviz_tree);
+    write_export(dest_folder + "graphviz_nfa.dot", output.graphviz);
+    write_export(dest_folder + "mem_dfa_edges.bin", output.dfa_image);
+    write_export(dest_folder + "mem_nfa_edges.bin", output.image);
+    write_export(dest_folder + "mem_nfa_edges_dfs.bin", output.image_dfs);
+    write_export(dest_folder + "benchmark.csv", output.workload_csv);
+    write_export(dest_folder + "benchmark.bin", output.workload_bin);
+
+    // shards: their images and the routing table, looked up by the value id of the first criterion
+    bool feasible = true;
+    if (!output.shards.empty())
+    {
+        std::ofstream routing(dest_folder + "shards.csv", std::ios::out | std::ios::trunc);
+        routing << "shard,first_id,last_id,image,image_dfs\n";
+        for (size_t k = 0; k < output.shards.size(); k++)
+        {
+            const erbium::compile_shard_s& shard = output.shards[k];
+            const std::string suffix = "_" + std::to_string(k);
+            write_export(dest_folder + "mem_nfa_edges" + suffix + ".bin", shard.image);
+            write_export(dest_folder + "mem_nfa_edges_dfs" + suffix + ".bin", shard.image_dfs);
+            write_export(dest_folder + "cfg_criteria_" + tag + suffix + ".vhd", shard.vhdl);
+            feasible &= shard.fits;
+
+            routing << k << "," << shard.first << "," << shard.last << ",mem_nfa_edges_" << k << ".bin,";
+            if (depth_first)
+                routing << "mem_nfa_edges_dfs_" << k << ".bin";
+            routing << "\n";
+        }
+        routing.close();
+    }
 
-    return (1 ? EXIT_SUCCESS : EXIT_FAILURE);
+    return (compiled && feasible) ? EXIT_SUCCESS : EXIT_FAILURE;
 } // end of main
\ No newline at end of file
@@ -26,48 +26,60 @@
 
 #include <boost/graph/graphviz.hpp>
 #include <fstream>                  // file read/write
-#include <iostream>                 // std::cout
+#include <sstream>                  // image payload
+#include <cstring>                  // memset
 #include <omp.h>                    // openmp
 #include <iterator>
+#include <tuple>
+#include <unordered_map>
+#include <algorithm>                // std::stable_sort
+#include <limits>
+#include <stdexcept>                // std::length_error
 
 namespace erbium {
 
 GraphHandler::GraphHandler(const rulePack_s* rulepack, const Dictionnary* dic)
 {
     add_vertex(m_graph); // origin;
-
-    std::map<std::string, vertex_id_t> path_map;   // from node_path to node_id
-    std::string   path_fwd;
+    m_graph[0].weight = 0;
+
+    // a state is reached from its parent through a value code, so a path is found without
+    // building its string (which is only kept for the new states)
+    const ruleStore_s& rules = rulepack->m_rules;
+    std::unordered_map<uint64_t, vertex_id_t> path_map;   // from (parent, code) to node_id
+    std::vector<vertex_id_t> content_map((rules.empty()) ? 0 : rules.m_pools.back().size(), 0);
+    std::vector<weight_t> criterion_weights;
+    for (auto& aux : rulepack->m_ruleType.m_criterionDefinition)
+        criterion_weights.push_back(aux.m_weight);
     vertex_id_t   prev_id = 0;
     vertex_id_t   node_to_use = 0;
     criterionid_t level = 0;
+    path_map.reserve(rules.size());
 
-    for (auto& rule : rulepack->m_rules)
+    for (uint32_t rule = 0; rule < rules.size(); rule++)
     {
-        path_fwd = "";
         prev_id = 0;
         level = 0;
 
         // Add criteria
         for (auto& ord : dic->m_sorting_map)
         {
-            criterion_s criterion = *std::next(rule.m_criteria.begin(), ord);
-
-            path_fwd = criterion.m_value + "_" + path_fwd;
+            const operand_t code = rules.get_code(rule, ord);
+            auto path = path_map.emplace(((uint64_t)prev_id << (sizeof(operand_t) * 8)) | code, 0);
 
-            node_to_use = 0;
-            if (path_map[path_fwd] == 0) // new path
+            if (path.second) // new path
             {
                 node_to_use = boost::add_vertex(m_graph);
-                path_map[path_fwd] = node_to_use;
-                m_graph[node_to_use].label = criterion.m_value;
+                path.first->second = node_to_use;
+                m_graph[node_to_use].label = rules.m_pools[ord][code];
                 m_graph[node_to_use].level = level;
-                m_graph[node_to_use].path = path_fwd;
-                m_graph[node_to_use].weight = rule.m_weight; // only used for last level DFA filtering
-                m_vertexes[level][dic->get_valueid_by_sort(criterion.m_index, criterion.m_value)].insert(node_to_use);
+                m_graph[node_to_use].path = m_graph[node_to_use].label + "_" + m_graph[prev_id].path;
+                m_graph[node_to_use].weight = m_graph[prev_id].weight
+                    + ((m_graph[node_to_use].label == "*") ? 0 : criterion_weights[ord]);
+                m_vertexes[level][dic->get_valueid_by_code(ord, code)].insert(node_to_use);
             }
             else // use existing path
-                node_to_use = path_map[path_fwd];
+                node_to_use = path.first->second;
 
             m_graph[node_to_use].parents.insert(prev_id);
             m_graph[prev_id].children.insert(node_to_use);
@@ -76,18 +88,19 @@ GraphHandler::GraphHandler(const rulePack_s* rulepack, const Dictionnary* dic)
         }
 
         // Add content
-        if (path_map[rule.m_content] == 0)
+        const operand_t content = rules.get_content_code(rule);
+        if (content_map[content] == 0)
         {
             // It does not exist
             node_to_use = boost::add_vertex(m_graph);
-            path_map[rule.m_content] = node_to_use;
-            m_graph[node_to_use].label = rule.m_content;
+            content_map[content] = node_to_use;
+            m_graph[node_to_use].label = rules.get_content(rule);
             m_graph[node_to_use].level = level;
-            m_graph[node_to_use].path  = rule.m_content;
-            m_vertexes[level][dic->get_valueid_by_sort(level, rule.m_content)].insert(node_to_use);
+            m_graph[node_to_use].path  = m_graph[node_to_use].label;
+            m_vertexes[level][dic->get_valueid_by_code(level, content)].insert(node_to_use);
         }
         else
-            node_to_use = path_map[rule.m_content];
+            node_to_use = content_map[content];
 
         m_graph[node_to_use].parents.insert(prev_id);
         m_graph[prev_id].children.insert(node_to_use);
@@ -130,8 +143,10 @@ uint GraphHandler::suffix_reduction()
                     if (m_graph[aux].label == "")
                         continue;
 
-                    // Check if both states point to the same states
-                    if (m_graph[aux].children == m_graph[vertex].children)
+                    // Check if both states point to the same states (and cover the same range)
+                    if (m_graph[aux].children == m_graph[vertex].children
+                        && m_graph[aux].label_end == m_graph[vertex].label_end
+                        && m_graph[aux].interval == m_graph[vertex].interval)
                     {
                         // redirect all the in edges of aux to vertex
                         for (auto& cr : m_graph[aux].parents)
@@ -156,6 +171,247 @@ uint GraphHandler::suffix_reduction()
     return n_merged;
 }
 
+uint GraphHandler::coalesce_ranges()
+{
+    uint n_coalesced = 0;
+    // <level, first value, last value, children> > range state, shared among parents
+    std::map<std::tuple<criterionid_t, std::string, std::string, std::set<vertex_id_t>>, vertex_id_t> ranges;
+    std::vector<std::pair<operand_t, vertex_id_t>> siblings; // <value_id, state>
+    const criterionid_t content_level = m_vertexes.size() - 1;
+    m_value_sets.clear();
+    m_set_refs.clear();
+
+    for (criterionid_t level = 0; level + 1 < content_level; level++)
+    {
+        if (!m_dic->m_range_levels[level+1])
+            continue;
+
+        const std::vector<vertex_id_t> parents = [&]() {
+            std::vector<vertex_id_t> aux;
+            for (auto& value : m_vertexes[level])
+                aux.insert(aux.end(), value.second.begin(), value.second.end());
+            return aux;
+        }();
+
+        for (auto& parent : parents)
+        {
+            if (m_graph[parent].label == "" || m_graph[parent].children.size() < 2)
+                continue;
+
+            siblings.clear();
+            for (auto& child : m_graph[parent].children)
+                siblings.push_back(std::make_pair(
+                    m_dic->get_valueid_by_level(level+1, m_graph[child].label), child));
+            std::sort(siblings.begin(), siblings.end());
+
+            for (size_t first = 0, last = 0; first < siblings.size(); first = last + 1)
+            {
+                // longest run of adjacent ids leading to the same states
+                last = first;
+                while (m_graph[siblings[first].second].label != "*"
+                       && last + 1 < siblings.size()
+                       && siblings[last+1].first == siblings[last].first + 1
+                       && m_graph[siblings[last+1].second].children == m_graph[siblings[first].second].children)
+                    last++;
+                if (last == first)
+                    continue;
+
+                const vertex_id_t head = siblings[first].second;
+                auto key = std::make_tuple(level+1,
+                                           m_graph[head].label,
+                                           m_graph[siblings[last].second].label,
+                                           m_graph[head].children);
+                auto range = ranges.find(key);
+                if (range == ranges.end())
+                {
+                    const vertex_id_t neo = boost::add_vertex(m_graph);
+                    m_graph[neo].level = level+1;
+                    m_graph[neo].label = std::get<1>(key);
+                    m_graph[neo].label_end = std::get<2>(key);
+                    m_graph[neo].path = std::get<1>(key) + ".." + std::get<2>(key) + "_" + m_graph[head].path;
+                    m_graph[neo].weight = m_graph[head].weight;
+                    m_graph[neo].children = std::get<3>(key);
+                    for (auto& grand_child : std::get<3>(key))
+                        m_graph[grand_child].parents.insert(neo);
+                    m_vertexes[level+1][siblings[first].first].insert(neo);
+                    range = ranges.emplace(key, neo).first;
+                }
+
+                // replace the run by the range state
+                for (size_t i = first; i <= last; i++)
+                {
+                    const vertex_id_t sibling = siblings[i].second;
+                    m_graph[parent].children.erase(sibling);
+                    m_graph[sibling].parents.erase(parent);
+                    if (m_graph[sibling].parents.empty())
+                        m_graph[sibling].label = "";
+                }
+                m_graph[parent].children.insert(range->second);
+                m_graph[range->second].parents.insert(parent);
+                n_coalesced += last - first;
+            }
+        }
+    }
+    return n_coalesced;
+}
+
+uint GraphHandler::split_intervals()
+{
+    uint n_split = 0;
+    // <level, lower bound, upper bound, children> > interval state, shared among parents
+    std::map<std::tuple<criterionid_t, uint32_t, uint32_t, std::set<vertex_id_t>>, vertex_id_t> intervals;
+    std::vector<std::tuple<uint32_t, uint32_t, vertex_id_t>> ranges; // <a, b, state>
+    std::vector<uint32_t> bounds;
+    const criterionid_t content_level = m_vertexes.size() - 1;
+
+    for (criterionid_t level = 0; level + 1 < content_level; level++)
+    {
+        if (!m_dic->m_disjoint_levels[level+1])
+            continue;
+
+        const ValueTable& dic = m_dic->get_criterion_dic_by_level(level+1);
+        const criterionDefinition_s* criterion_def =
+            &(*std::next(m_rulePack->m_ruleType.m_criterionDefinition.begin(),
+                         m_dic->m_sorting_map[level+1]));
+
+        // operands of the original transitions
+        for (auto& value : m_vertexes[level+1])
+        {
+            for (auto& vert : value.second)
+            {
+                if (m_graph[vert].label == "" || m_graph[vert].label == "*")
+                    continue;
+                RuleParser::parse_value(
+                        m_graph[vert].label,
+                        dic[m_graph[vert].label],
+                        &m_graph[vert].interval.first,
+                        &m_graph[vert].interval.second,
+                        criterion_def);
+            }
+        }
+
+        std::vector<vertex_id_t> parents;
+        for (auto& value : m_vertexes[level])
+            parents.insert(parents.end(), value.second.begin(), value.second.end());
+
+        for (auto& parent : parents)
+        {
+            if (m_graph[parent].label == "" || m_graph[parent].children.size() < 2)
+                continue;
+
+            ranges.clear();
+            for (auto& child : m_graph[parent].children)
+            {
+                if (m_graph[child].label != "*")
+                    ranges.push_back(std::make_tuple(m_graph[child].interval.first,
+                                                     m_graph[child].interval.second,
+                                                     child));
+            }
+            std::sort(ranges.begin(), ranges.end());
+
+            bool overlap = false;
+            for (size_t i = 1; i < ranges.size() && !overlap; i++)
+                overlap = std::get<0>(ranges[i]) <= std::get<1>(ranges[i-1]);
+            if (!overlap)
+                continue;
+
+            // elementary intervals between consecutive bounds
+            bounds.clear();
+            for (auto& range : ranges)
+            {
+                bounds.push_back(std::get<0>(range));
+                bounds.push_back(std::get<1>(range) + 1);
+            }
+            std::sort(bounds.begin(), bounds.end());
+            bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+            std::vector<std::tuple<uint32_t, uint32_t, std::vector<vertex_id_t>, std::set<vertex_id_t>>> pieces;
+            for (size_t k = 0; k + 1 < bounds.size(); k++)
+            {
+                const uint32_t lower = bounds[k];
+                const uint32_t upper = bounds[k+1] - 1;
+                std::vector<vertex_id_t> covering;
+                std::set<vertex_id_t> targets;
+                for (auto& range : ranges)
+                {
+                    if (std::get<0>(range) <= lower && std::get<1>(range) >= upper)
+                    {
+                        covering.push_back(std::get<2>(range));
+                        targets.insert(m_graph[std::get<2>(range)].children.begin(),
+                                       m_graph[std::get<2>(range)].children.end());
+                    }
+                }
+                if (covering.empty())
+                    continue;
+
+                // adjacent pieces leading to the same states are kept together
+                if (!pieces.empty()
+                    && std::get<1>(pieces.back()) + 1 == lower
+                    && std::get<3>(pieces.back()) == targets)
+                {
+                    std::get<1>(pieces.back()) = upper;
+                    for (auto& aux : covering)
+                    {
+                        std::vector<vertex_id_t>& merged = std::get<2>(pieces.back());
+                        if (std::find(merged.begin(), merged.end(), aux) == merged.end())
+                            merged.push_back(aux);
+                    }
+                    continue;
+                }
+                pieces.push_back(std::make_tuple(lower, upper, covering, targets));
+            }
+
+            // replace the original transitions by the pieces
+            for (auto& range : ranges)
+            {
+                const vertex_id_t child = std::get<2>(range);
+                m_graph[parent].children.erase(child);
+                m_graph[child].parents.erase(parent);
+            }
+            for (auto& piece : pieces)
+            {
+                const vertex_id_t head = std::get<2>(piece).front();
+                vertex_id_t piece_id = head;
+                if (std::get<2>(piece).size() != 1
+                    || m_graph[head].interval.first  != std::get<0>(piece)
+                    || m_graph[head].interval.second != std::get<1>(piece))
+                {
+                    auto key = std::make_tuple(level+1, std::get<0>(piece), std::get<1>(piece), std::get<3>(piece));
+                    auto found = intervals.find(key);
+                    if (found == intervals.end())
+                    {
+                        const vertex_id_t neo = boost::add_vertex(m_graph);
+                        m_graph[neo].level = level+1;
+                        m_graph[neo].label = m_graph[head].label;
+                        m_graph[neo].interval = std::make_pair((operand_t)std::get<0>(piece),
+                                                               (operand_t)std::get<1>(piece));
+                        m_graph[neo].path = "[" + std::to_string(std::get<0>(piece)) + ","
+                                          + std::to_string(std::get<1>(piece)) + "]_" + m_graph[head].path;
+                        m_graph[neo].weight = 0;
+                        for (auto& aux : std::get<2>(piece))
+                            m_graph[neo].weight = std::max(m_graph[neo].weight, m_graph[aux].weight);
+                        m_graph[neo].children = std::get<3>(piece);
+                        for (auto& grand_child : std::get<3>(piece))
+                            m_graph[grand_child].parents.insert(neo);
+                        m_vertexes[level+1][dic[m_graph[neo].label]].insert(neo);
+                        found = intervals.emplace(key, neo).first;
+                        n_split++;
+                    }
+                    piece_id = found->second;
+                }
+                m_graph[parent].children.insert(piece_id);
+                m_graph[piece_id].parents.insert(parent);
+            }
+            for (auto& range : ranges)
+            {
+                if (m_graph[std::get<2>(range)].parents.empty())
+                    m_graph[std::get<2>(range)].label = "";
+            }
+        }
+    }
+    return n_split;
+}
+
 void GraphHandler::consolidate_graph()
 {
     // effectively remove obsolete vertexes from the graph
@@ -165,11 +421,11 @@ void GraphHandler::consolidate_graph()
     std::map<vertex_id_t, vertex_id_t> map_old2new;
 
     // iterates all states
-    dictionnary_t dic;
+    const ValueTable* dic;
     vertex_id_t node_to_use;
     for (auto& level : m_vertexes)
     {
-        dic = m_dic->get_criterion_dic_by_level(level.first);
+        dic = &m_dic->get_criterion_dic_by_level(level.first);
         for (auto& value : m_vertexes[level.first])
         {
             for (auto& vert : m_vertexes[level.first][value.first])
@@ -183,7 +439,7 @@ void GraphHandler::consolidate_graph()
                     final_graph[node_to_use].parents.clear();
                     final_graph[node_to_use].children.clear();
 
-                    final_vertexes[level.first][dic[m_graph[vert].label]].insert(node_to_use);
+                    final_vertexes[level.first][(*dic)[m_graph[vert].label]].insert(node_to_use);
                 }
             }
         }
@@ -213,132 +469,373 @@ void GraphHandler::consolidate_graph()
     m_vertexes = final_vertexes;
 }
 
-void GraphHandler::make_deterministic()
+bool GraphHandler::is_determinisable(const criterionid_t& level) const
 {
-    dictionnary_t dic;   
-    // iterate all level from origin
-    for (auto& level : m_vertexes)
-    {
-        dic = m_dic->get_criterion_dic_by_level(level.first);
+    // pair criteria and IN-lists may match several specific transitions of a state, whose
+    // subsets cannot be merged by label
+    const criterionDefinition_s* criterion_def =
+        &(*std::next(m_rulePack->m_ruleType.m_criterionDefinition.begin(), m_dic->m_sorting_map[level]));
+    return !criterion_def->m_isPair && !m_dic->is_set_level(level);
+}
 
-        if (strcmp(dic.begin()->first.c_str(), "*") != 0)
-            continue;
+uint GraphHandler::make_deterministic(const uint32_t& state_budget,
+                                      const std::vector<bool>* levels,
+                                      std::vector<bool>* determinised)
+{
+    typedef std::vector<vertex_id_t> subset_t; // states of the tree merged into one DFA state
+
+    const criterionid_t last_level = m_vertexes.size() - 2;
+    const vertex_id_t n_tree = boost::num_vertices(m_graph);
+
+    std::vector<bool> merge(last_level + 1);
+    std::vector<weight_t> criterion_weights(last_level + 1);
+    bool complete = true;
+    for (criterionid_t level = 0; level <= last_level; level++)
+    {
+        merge[level] = ((levels == NULL) || (level < levels->size() && (*levels)[level]))
+                    && is_determinisable(level);
+        complete = complete && merge[level];
+        criterion_weights[level] = std::next(m_rulePack->m_ruleType.m_criterionDefinition.begin(),
+                                             m_dic->m_sorting_map[level])->m_weight;
+    }
 
-        /*std::cout << "Level " << level.first << " has "
-                  << m_vertexes[level.first][dic.begin()->second].size()
-                  << " wildcard states "
-                  << dic.begin()->first
-                  << std::endl;*/
+    // subsets of every level, and the transitions of the previous level's subsets to them
+    std::vector<std::vector<subset_t>> states;
+    std::vector<std::vector<std::vector<uint32_t>>> moves;
 
-        // for each wildcard vertex in this level
-        for (auto& the_wildcard : m_vertexes[level.first][dic.begin()->second])
+    // a wildcard member merged into a specific state is credited with the criterion weight by the
+    // engine: this only holds when the whole graph is deterministic, as the most specific path then
+    // reaches every matching rule and its content is chosen below; otherwise the wildcard members
+    // only join specific states of zero weight, so that the members of a state share their rank
+    bool absorb = complete;
+    criterionid_t level = 0;
+    for (;;)
+    {
+        std::vector<subset_t> frontier(1, subset_t(1, 0));
+        states.clear();
+        moves.clear();
+        uint32_t n_states = 1;
+        for (level = 0; level <= last_level; level++)
         {
-            // for each of its parent -- N.B.: at this point it **should** be only one though...
-            const auto list_parents = m_graph[the_wildcard].parents;
-            for (auto& the_parent : list_parents)
+            const bool absorb_level = absorb || criterion_weights[level] == 0;
+
+            // outgoing transitions of every DFA state: the states reached by the same value, plus
+            // the ones reached by the wildcard (read-only on the tree, independent subsets)
+            std::vector<std::vector<subset_t>> targets(frontier.size());
+            #pragma omp parallel for schedule(dynamic)
+            for (uint32_t i = 0; i < frontier.size(); i++)
             {
-                // for each other children
-                const auto list_child = m_graph[the_parent].children;
-                for (auto& the_child : list_child)
+                if (!merge[level])
                 {
-                    if (the_child == the_wildcard)
-                        continue;
+                    // left nondeterministic: every member keeps its own transitions
+                    for (auto& member : frontier[i])
+                    {
+                        for (auto& child : m_graph[member].children)
+                            targets[i].push_back(subset_t(1, child));
+                    }
+                    std::sort(targets[i].begin(), targets[i].end());
+                    targets[i].erase(std::unique(targets[i].begin(), targets[i].end()), targets[i].end());
+                    continue;
+                }
 
-                    // duplicate the_wildcard into the_child
-                    // "crescite et multiplicamini"
-                    dfa_merge_paths(the_wildcard, the_child);
+                std::map<std::string, subset_t> by_label;
+                for (auto& member : frontier[i])
+                {
+                    for (auto& child : m_graph[member].children)
+                        by_label[m_graph[child].label].push_back(child);
+                }
+                const auto wildcard = by_label.find("*");
+                for (auto& aux : by_label)
+                {
+                    if (absorb_level && wildcard != by_label.end() && aux.first != "*")
+                        aux.second.insert(aux.second.end(), wildcard->second.begin(), wildcard->second.end());
+                    std::sort(aux.second.begin(), aux.second.end());
+                    aux.second.erase(std::unique(aux.second.begin(), aux.second.end()), aux.second.end());
+                    targets[i].push_back(aux.second);
+                }
+            }
+
+            // memoization of the subsets already built at this level
+            std::map<subset_t, uint32_t> memo;
+            std::vector<subset_t> next;
+            std::vector<std::vector<uint32_t>> move(frontier.size());
+            for (uint32_t i = 0; i < frontier.size(); i++)
+            {
+                for (auto& subset : targets[i])
+                {
+                    auto found = memo.emplace(subset, next.size());
+                    if (found.second)
+                        next.push_back(subset);
+                    move[i].push_back(found.first->second);
                 }
             }
+
+            if (state_budget != 0 && n_states + next.size() > state_budget)
+                break;
+            n_states += next.size();
+            states.push_back(next);
+            moves.push_back(move);
+            frontier.swap(next);
         }
+        if (level > last_level || !absorb)
+            break;
+        absorb = false; // the graph is not entirely deterministic: rebuilt with ranked states
+    }
+    if (level <= last_level)
+    {
+        log_stream() << "[!] State budget reached at level " << level
+                     << ": the remaining levels are left nondeterministic\n";
     }
-}
 
-void GraphHandler::dfa_merge_paths(const vertex_id_t& orgi_state, const vertex_id_t& dest_state)
-{
-    /*std::cout << "merge at " << m_graph[orgi_state].level
-                << " for " << m_graph[orgi_state].label << " into "
-                << m_graph[dest_state].label << std::endl;*/
+    uint n_merged = 0;
+    if (determinised != NULL)
+        determinised->assign(last_level + 1, false);
+    for (criterionid_t aux = 0; aux < level; aux++)
+    {
+        n_merged += merge[aux];
+        if (determinised != NULL)
+            (*determinised)[aux] = merge[aux];
+    }
+    if (level == 0)
+        return 0;
 
-    if (m_graph[orgi_state].level == m_vertexes.size() - 2)
+    // one vertex per DFA state, labelled by its specific value (if any)
+    std::vector<std::pair<vertex_id_t, vertex_id_t>> edges;
+    std::vector<vertex_id_t> frontier_ids(1, 0); // origin kept
+    for (criterionid_t aux = 0; aux < level; aux++)
     {
-        // keep only highest weight
-        if (m_graph[orgi_state].weight > m_graph[dest_state].weight)
+        std::vector<vertex_id_t> next_ids(states[aux].size());
+        for (uint32_t k = 0; k < states[aux].size(); k++)
         {
-            //std::cout << "I'm not sure when this would happen... [GraphHandler::dfa_merge_paths]\n";
+            const subset_t& subset = states[aux][k];
+            vertex_id_t head = subset.front();
+            for (auto& member : subset)
+            {
+                if (m_graph[member].label != "*")
+                {
+                    head = member;
+                    break;
+                }
+            }
+            const vertex_id_t neo = boost::add_vertex(m_graph);
+            m_graph[neo].label  = m_graph[head].label;
+            m_graph[neo].level  = aux;
+            m_graph[neo].path   = m_graph[head].path;
+            m_graph[neo].weight = 0;
+            for (auto& member : subset)
+                m_graph[neo].weight = std::max(m_graph[neo].weight, m_graph[member].weight);
+            m_vertexes[aux][m_dic->get_valueid_by_level(aux, m_graph[neo].label)].insert(neo);
+            next_ids[k] = neo;
+
+            // last criterion: keep only the content of the rules of highest rank, as the engine
+            if (aux == last_level)
+            {
+                vertex_id_t best = subset.front();
+                for (auto& member : subset)
+                {
+                    if (m_graph[member].weight > m_graph[best].weight)
+                        best = member;
+                }
+                edges.push_back(std::make_pair(neo, *m_graph[best].children.begin()));
+            }
+        }
 
-            // remove initial content
-            m_graph[*(m_graph[dest_state].children.begin())].parents.erase(dest_state);
-            m_graph[dest_state].children.clear();
+        for (uint32_t i = 0; i < frontier_ids.size(); i++)
+        {
+            for (auto& target : moves[aux][i])
+                edges.push_back(std::make_pair(frontier_ids[i], next_ids[target]));
+        }
+        frontier_ids.swap(next_ids);
+    }
 
-            // add new one
-            m_graph[*(m_graph[orgi_state].children.begin())].parents.insert(dest_state);
-            m_graph[dest_state].children.insert(*(m_graph[orgi_state].children.begin()));
+    // past the budget, DFA states keep the (nondeterministic) transitions of their members
+    if (level <= last_level)
+    {
+        for (uint32_t i = 0; i < frontier_ids.size(); i++)
+        {
+            for (auto& member : states[level-1][i])
+            {
+                for (auto& child : m_graph[member].children)
+                    edges.push_back(std::make_pair(frontier_ids[i], child));
+            }
+        }
+    }
 
-            // update weight
-            m_graph[dest_state].weight = m_graph[orgi_state].weight;
+    // drop the replaced states of the tree and link the DFA states
+    m_graph[0].children.clear();
+    for (criterionid_t aux = 0; aux <= level && aux < m_vertexes.size(); aux++)
+    {
+        for (auto& value : m_vertexes[aux])
+        {
+            for (auto& vert : value.second)
+            {
+                if (vert >= n_tree)
+                    continue;
+                m_graph[vert].parents.clear();
+                if (aux < level)
+                {
+                    m_graph[vert].children.clear();
+                    m_graph[vert].label = "";
+                }
+            }
         }
-        return;
     }
+    for (auto& edge : edges)
+    {
+        m_graph[edge.first].children.insert(edge.second);
+        m_graph[edge.second].parents.insert(edge.first);
+    }
+    return n_merged;
+}
 
-    bool existing_edge;
-    // iterates all outgoing transition of origin state
-    const auto list = m_graph[orgi_state].children;
-    for (auto& orgi_children : list)
+std::vector<GraphHandler::tradeoff_s> GraphHandler::get_determinisation_tradeoff()
+{
+    const criterionid_t n_levels = m_vertexes.size() - 1;
+    const uint32_t n_rules = m_rulePack->m_rules.size();
+    std::vector<tradeoff_s> tradeoff(n_levels);
+
+    // matching range of every state (value ids, or parsed operands of the pair criteria)
+    std::vector<std::pair<operand_t, operand_t>> operands(boost::num_vertices(m_graph));
+    std::vector<const criterionDefinition_s*> definitions(n_levels);
+    std::vector<bool> has_wildcard(boost::num_vertices(m_graph), false);
+    for (criterionid_t level = 0; level < n_levels; level++)
     {
-        existing_edge = false;
-        
-        // check for same-value out. transitions
-        const auto child_list = m_graph[dest_state].children;
-        for (auto& dest_children : child_list)
+        const ValueTable& dic = m_dic->get_criterion_dic_by_level(level);
+        definitions[level] = &(*std::next(m_rulePack->m_ruleType.m_criterionDefinition.begin(),
+                                          m_dic->m_sorting_map[level]));
+        for (auto& value : m_vertexes[level])
         {
-            if (m_graph[orgi_children].label == m_graph[dest_children].label)
+            for (auto& vert : value.second)
             {
-                existing_edge = true;
+                if (m_graph[vert].label == "*")
+                {
+                    for (auto& parent : m_graph[vert].parents)
+                        has_wildcard[parent] = true;
+                    continue;
+                }
+                if (m_graph[vert].level < m_dic->m_disjoint_levels.size()
+                    && m_dic->m_disjoint_levels[m_graph[vert].level])
+                    operands[vert] = m_graph[vert].interval;
+                else if (definitions[level]->m_isPair)
+                    RuleParser::parse_value(m_graph[vert].label, dic[m_graph[vert].label],
+                        &operands[vert].first, &operands[vert].second, definitions[level]);
+                else
+                    operands[vert] = std::make_pair(dic[m_graph[vert].label],
+                        dic[(m_graph[vert].label_end.empty()) ? m_graph[vert].label : m_graph[vert].label_end]);
+            }
+        }
+    }
 
-                // merge children paths
-                dfa_merge_paths(orgi_children, dest_children);
-                break;
+    // growth: each (specific, wildcard) pair of siblings becomes a state holding both transition
+    // sets, while specific states whose parents all have a wildcard are no longer needed
+    for (criterionid_t level = 0; level < n_levels; level++)
+    {
+        tradeoff[level].level = level;
+        tradeoff[level].growth = 0;
+        if (m_dic->m_deterministic_levels[level])
+            continue;
+
+        const bool last = (level + 1u == n_levels);
+        std::set<std::pair<vertex_id_t, vertex_id_t>> pairs;
+        std::set<vertex_id_t> specifics;
+        for (auto& value : m_vertexes[level])
+        {
+            for (auto& wildcard : value.second)
+            {
+                if (m_graph[wildcard].label != "*")
+                    continue;
+                for (auto& parent : m_graph[wildcard].parents)
+                {
+                    for (auto& child : m_graph[parent].children)
+                    {
+                        if (child == wildcard)
+                            continue;
+                        pairs.insert(std::make_pair(child, wildcard));
+                        specifics.insert(child);
+                    }
+                }
             }
         }
 
-        if (not existing_edge)
+        int32_t growth = 0;
+        for (auto& aux : pairs)
+            growth += (last) ? 1 : m_graph[aux.first].children.size() + m_graph[aux.second].children.size();
+        for (auto& specific : specifics)
         {
-            // append full path
-            dfa_append_path(orgi_children, dest_state);
+            bool orphan = true;
+            for (auto& parent : m_graph[specific].parents)
+                orphan = orphan && has_wildcard[parent];
+            if (orphan)
+                growth -= (last) ? 1 : m_graph[specific].children.size();
         }
+        tradeoff[level].growth = growth;
     }
+
+    // backtracks: rules evenly spread over the rule pack are replayed as queries
+    std::vector<uint64_t> backtracks(n_levels, 0);
+    std::vector<operand_t> query(n_levels);
+    operand_t aux_b;
+    const uint32_t step = std::max((uint32_t)1, n_rules / C_SAMPLE_QUERIES);
+    uint32_t n_queries = 0;
+    const ruleStore_s& rules = m_rulePack->m_rules;
+    for (uint32_t rule = 0; rule < n_rules; rule += step)
+    {
+        for (criterionid_t level = 0; level < n_levels; level++)
+        {
+            const criterionid_t criterion_id = m_dic->m_sorting_map[level];
+            RuleParser::parse_value(rules.get_value(rule, criterion_id),
+                                    m_dic->get_valueid_by_code(criterion_id, rules.get_code(rule, criterion_id)),
+                                    &query[level], &aux_b, definitions[level]);
+        }
+        count_backtracks(0, query, operands, &backtracks);
+        n_queries++;
+    }
+
+    for (auto& aux : tradeoff)
+    {
+        aux.backtracks = (double)backtracks[aux.level] / std::max((uint32_t)1, n_queries);
+        aux.gain = C_COST_BACKTRACK * aux.backtracks
+                 - C_COST_TRANSITIONS * aux.growth / std::max((uint32_t)1, n_rules);
+    }
+    return tradeoff;
 }
 
-void GraphHandler::dfa_append_path(const vertex_id_t& orgi_children, const vertex_id_t& dest_state)
+void GraphHandler::count_backtracks(const vertex_id_t& vertex_id,
+                                    const std::vector<operand_t>& query,
+                                    const std::vector<std::pair<operand_t, operand_t>>& operands,
+                                    std::vector<uint64_t>* backtracks)
 {
-    /*std::cout << "[" << m_graph[orgi_children].level << "] "
-              << m_graph[orgi_children].label
-              << m_graph[orgi_children].weight
-              << " into " << "[" << m_graph[dest_state].level << "] "
-              << m_graph[dest_state].label
-              << m_graph[dest_state].weight << std::endl;*/
-
-    vertex_id_t neo_child = boost::add_vertex(m_graph);
-    m_graph[neo_child].label  = m_graph[orgi_children].label;
-    m_graph[neo_child].level  = m_graph[orgi_children].level;
-    m_graph[neo_child].path   = m_graph[orgi_children].path;
-    m_graph[neo_child].weight = m_graph[orgi_children].weight; // only used for last level DFA filtering
-    
-    m_vertexes[m_graph[neo_child].level]
-        [m_dic->get_valueid_by_level(m_graph[neo_child].level, m_graph[neo_child].label)].insert(neo_child);
-    
-    m_graph[dest_state].children.insert(neo_child);
-    m_graph[neo_child].parents.insert(dest_state);
-
-    if (m_graph[orgi_children].level == m_vertexes.size() - 2)
-    {
-        m_graph[neo_child].children.insert(*m_graph[orgi_children].children.begin());
+    if (m_graph[vertex_id].children.empty())
         return;
+    const criterionid_t level = m_graph[*m_graph[vertex_id].children.begin()].level;
+    if (level >= query.size())
+        return; // content
+
+    bool specific = false;
+    bool wildcard = false;
+    for (auto& child : m_graph[vertex_id].children)
+    {
+        if (m_graph[child].label == "*")
+            wildcard = true;
+        else if (operands[child].first <= query[level] && query[level] <= operands[child].second)
+            specific = true;
     }
 
-    const auto list = m_graph[orgi_children].children;
-    for (auto& grand_children : list)
-        dfa_append_path(grand_children, neo_child);
+    // determinised levels: the specific states already hold the wildcard paths
+    const bool deterministic = m_dic->m_deterministic_levels[level];
+    if (specific && wildcard && !deterministic)
+        (*backtracks)[level]++;
+
+    for (auto& child : m_graph[vertex_id].children)
+    {
+        if (m_graph[child].label == "*")
+        {
+            if (!specific || !deterministic)
+                count_backtracks(child, query, operands, backtracks);
+        }
+        else if (operands[child].first <= query[level] && query[level] <= operands[child].second)
+            count_backtracks(child, query, operands, backtracks);
+    }
 }
 
 uint GraphHandler::print_stats()
@@ -348,7 +845,7 @@ uint GraphHandler::print_stats()
     uint n_edges_max = 0;
     uint n_bram_edges_max = 0;
     uint aux;
-    printf("origin  :     1 state ; %5lu transitions; %4lu max fan-out\n",
+    log_printf("origin  :     1 state ; %5lu transitions; %4lu max fan-out\n",
         m_graph[0].children.size(), m_graph[0].children.size());
     for (auto& level : m_vertexes)
     {
@@ -365,7 +862,7 @@ uint GraphHandler::print_stats()
                 n_edges_max = (aux > n_edges_max) ? aux : n_edges_max;
             }
         }
-        printf("level %2u: %5u states; %5u transitions; %4u max fan-out\n",
+        log_printf("level %2u: %5u states; %5u transitions; %4u max fan-out\n",
             level.first, n_nodes, n_edges, n_edges_max);
         n_bram_edges_max = (n_edges > n_bram_edges_max) ? n_edges : n_bram_edges_max;
     }
@@ -382,7 +879,8 @@ uint64_t GraphHandler::get_graph_hash()
             for (auto& vert : m_vertexes[level.first][value.first])
             {
                 h1 = std::hash<uint>{}(m_graph[vert].level);
-                h2 = std::hash<std::string>{}(m_graph[vert].label);
+                h2 = std::hash<std::string>{}(m_graph[vert].label + m_graph[vert].label_end)
+                   ^ (((uint64_t)m_graph[vert].interval.first << 16) | m_graph[vert].interval.second);
                 h3 = std::hash<std::string>{}(m_graph[vert].path);
                 
                 h4 = 0;
@@ -435,12 +933,31 @@ std::vector<uint> GraphHandler::get_transitions_per_level()
 void GraphHandler::export_graphviz(const std::string& filename)
 {
     std::fstream dot_file(filename, std::ios::out | std::ios::trunc);
-    boost::write_graphviz(dot_file, m_graph, boost::make_label_writer(get(&vertex_info::label, m_graph)));
+    export_graphviz(&dot_file);
 }
 
-void GraphHandler::export_memory(const std::string& filename)
+void GraphHandler::export_graphviz(std::ostream* dot_file)
+{
+    boost::write_graphviz(*dot_file, m_graph, boost::make_label_writer(get(&vertex_info::label, m_graph)));
+}
+
+void GraphHandler::export_memory(const std::string& filename,
+                                 const value_frequencies_t* frequencies,
+                                 const WildcardPolicy& policy,
+                                 const uint32_t& version)
 {
     std::fstream outfile(filename, std::ios::out | std::ios::trunc | std::ios::binary);
+    export_memory(&outfile, frequencies, policy, version);
+    outfile.close();
+}
+
+void GraphHandler::export_memory(std::ostream* outfile,
+                                 const value_frequencies_t* frequencies,
+                                 const WildcardPolicy& policy,
+                                 const uint32_t& version)
+{
+    m_value_sets.clear();
+    m_set_refs.clear();
 
     // Address pointers
     std::vector<uint> edges_per_level(m_vertexes.size());
@@ -453,6 +970,14 @@ void GraphHandler::export_memory(const std::string& filename)
         {
             for (auto& vert : m_vertexes[level->first][value.first])
             {
+                // results are the content ids of the dictionnary, also when some are missing
+                // (pruned rules or shards)
+                if (level->first == m_vertexes.size()-1)
+                {
+                    m_graph[vert].dump_pointer = value.first;
+                    n_edges++;
+                    continue;
+                }
                 m_graph[vert].dump_pointer = n_edges;
                 n_edges_max = m_graph[vert].children.size();
 
@@ -472,24 +997,16 @@ void GraphHandler::export_memory(const std::string& filename)
             m_graph[vert].dump_pointer = m_graph[*m_graph[vert].children.begin()].dump_pointer;
     }
 
-    uint64_t mem_int;
-    dictionnary_t dic;
+    const ValueTable* dic;
     const criterionDefinition_s* criterion_def;
-
-    // Automata ID (hash)
-    const uint64_t nfa_hash = get_graph_hash();
-    outfile.write((char*)&nfa_hash, sizeof(nfa_hash));
+    std::vector<std::vector<transition_s>> memories(1);
 
     ////// ORIGIN
-    mem_int = m_graph[0].children.size();
-    outfile.write((char*)&mem_int, sizeof(mem_int));
-
-    dic = m_dic->get_criterion_dic_by_level(0);
+    dic = &m_dic->get_criterion_dic_by_level(0);
     criterion_def = &(*std::next(m_rulePack->m_ruleType.m_criterionDefinition.begin(),
                                  m_dic->m_sorting_map[0]));
 
-    dump_binary_transition(&outfile, 0, &dic, criterion_def);
-    dump_binary_padding(&outfile, m_graph[0].children.size()+1);
+    get_transitions(0, dic, criterion_def, NULL, WildcardFirst, &memories[0]);
 
     ////// AND THE REST OF CRITERIA
     for (auto& level : m_vertexes)
@@ -497,35 +1014,290 @@ void GraphHandler::export_memory(const std::string& filename)
         if (level.second == m_vertexes[m_vertexes.size()-2])
             break;  // skip content
 
-        mem_int = edges_per_level[level.first];
-        outfile.write((char*)&mem_int, sizeof(mem_int));
+        memories.push_back(std::vector<transition_s>());
+        memories.back().reserve(edges_per_level[level.first]);
 
-        dic = m_dic->get_criterion_dic_by_level(level.first+1);
+        dic = &m_dic->get_criterion_dic_by_level(level.first+1);
         criterion_def = &(*std::next(m_rulePack->m_ruleType.m_criterionDefinition.begin(),
                                      m_dic->m_sorting_map[level.first+1]));
         for (auto& value : m_vertexes[level.first])
         {
             for (auto& vert : m_vertexes[level.first][value.first])
-                dump_binary_transition(&outfile, vert, &dic, criterion_def);
+                get_transitions(vert, dic, criterion_def, frequencies, policy, &memories.back());
         }
-        dump_binary_padding(&outfile, edges_per_level[level.first]+1);
     }
 
-    outfile.close();
+    // Automata ID (hash)
+    const uint64_t nfa_hash = get_graph_hash();
+    if (version != C_IMAGE_VERSION_FIXED)
+    {
+        dump_image(outfile, nfa_hash, version, C_IMAGE_LAYOUT_LEVELS, memories,
+                   frequencies == NULL || policy == WildcardFirst);
+        return;
+    }
+    outfile->write((char*)&nfa_hash, sizeof(nfa_hash));
+    if (!m_value_sets.empty())
+        log_printf("[!] IN-list transitions need a self-describing image (-v 2 or 3): they never match\n");
+
+    uint16_t memory_id = 0;
+    for (auto& memory : memories)
+    {
+        if (dump_fixed_memory(outfile, memory))
+            log_printf("[!] Memory %u exceeds the fixed widths (%u-bit operands, %u-bit pointers): "
+                       "export the packed image instead\n",
+                       memory_id, CFG_CRITERION_VALUE_WIDTH, CFG_TRANSITION_POINTER_WIDTH);
+        memory_id++;
+    }
+}
+
+bool GraphHandler::dump_fixed_memory(std::ostream* outfile,
+                                     const std::vector<transition_s>& memory,
+                                     const uint8_t& pointer_width)
+{
+    transition_t mem_int = memory.size();
+    outfile->write((char*)&mem_int, sizeof(mem_int));
+
+    bool overflow = false;
+    for (auto& transition : memory)
+    {
+        overflow |= transition.operand_a > MASK_OPERANDS || transition.operand_b > MASK_OPERANDS
+                 || transition.pointer > generate_mask(pointer_width);
+        mem_int = (transition_t)transition.last << SHIFT_LAST;
+        mem_int |= (transition.pointer & MASK_POINTER) << SHIFT_POINTER;
+        mem_int |= ((transition.pointer >> CFG_TRANSITION_POINTER_WIDTH) & MASK_POINTER_HIGH) << SHIFT_POINTER_HIGH;
+        mem_int |= (((transition_t)transition.operand_b) & MASK_OPERANDS) << SHIFT_OPERAND_B;
+        mem_int |= (((transition_t)transition.operand_a) & MASK_OPERANDS) << SHIFT_OPERAND_A;
+        outfile->write((char*)&mem_int, sizeof(mem_int));
+    }
+    dump_binary_padding(outfile, memory.size()+1);
+    return overflow;
 }
 
-void GraphHandler::dump_binary_transition(std::fstream* outfile,
-                                          const vertex_id_t& vertex_id,
-                                          dictionnary_t* dic,
-                                          const criterionDefinition_s* criterion_def)
+void GraphHandler::dump_image(std::ostream* outfile,
+                              const uint64_t& nfa_hash,
+                              uint32_t version,
+                              const uint8_t& layout,
+                              const std::vector<std::vector<transition_s>>& memories,
+                              const bool& wildcard_first)
+{
+    auto bit_width = [](uint64_t value) {
+        uint8_t width = 1;
+        while (value >> width)
+            width++;
+        return width;
+    };
+
+    // minimal widths of each memory
+    std::vector<image_memory_s> descriptors(memories.size());
+    for (size_t i = 0; i < memories.size(); i++)
+    {
+        operand_t max_operand = 0;
+        uint64_t  max_pointer = 0;
+        for (auto& transition : memories[i])
+        {
+            max_operand = std::max(max_operand, std::max(transition.operand_a, transition.operand_b));
+            max_pointer = std::max(max_pointer, transition.pointer);
+        }
+        descriptors[i].n_transitions = memories[i].size();
+        descriptors[i].operand_width = bit_width(max_operand);
+        descriptors[i].pointer_width = bit_width(max_pointer);
+        descriptors[i].slots_per_word = (sizeof(transition_t) * 8)
+            / (2 * descriptors[i].operand_width + descriptors[i].pointer_width + 1);
+        descriptors[i].reserved = 0;
+        if (version == C_IMAGE_VERSION_PACKED && descriptors[i].slots_per_word == 0)
+        {
+            log_printf("[!] Memory %lu does not fit packed into %lu-bit words: fixed widths are exported\n",
+                       i, sizeof(transition_t) * 8);
+            version = C_IMAGE_VERSION_DESCRIBED;
+        }
+    }
+
+    // payload (offsets relative to it until the header size is known)
+    std::ostringstream payload;
+    for (size_t i = 0; i < memories.size(); i++)
+    {
+        image_memory_s& descriptor = descriptors[i];
+        if (version == C_IMAGE_VERSION_DESCRIBED)
+        {
+            // the count word of the legacy image precedes the transitions
+            descriptor.offset = (uint64_t)payload.tellp() + sizeof(transition_t);
+            descriptor.operand_width = CFG_CRITERION_VALUE_WIDTH;
+            descriptor.pointer_width = (layout == C_IMAGE_LAYOUT_DEPTH_FIRST)
+                                     ? CFG_TRANSITION_POINTER_WIDTH + CFG_TRANSITION_POINTER_HIGH_WIDTH
+                                     : CFG_TRANSITION_POINTER_WIDTH;
+            descriptor.slots_per_word = 1;
+            if (dump_fixed_memory(&payload, memories[i], descriptor.pointer_width))
+                log_printf("[!] Memory %lu exceeds the fixed widths (%u-bit operands, %u-bit pointers): "
+                           "export the packed image instead\n",
+                           i, CFG_CRITERION_VALUE_WIDTH, descriptor.pointer_width);
+        }
+        else
+        {
+            // transitions fill the words from the least significant bit: operand_a, operand_b, pointer, last
+            descriptor.offset = payload.tellp();
+            const uint8_t width = 2 * descriptor.operand_width + descriptor.pointer_width + 1;
+            std::vector<transition_t> words(
+                (descriptor.n_transitions + descriptor.slots_per_word - 1) / descriptor.slots_per_word, 0);
+            uint32_t slot = 0;
+            for (auto& transition : memories[i])
+            {
+                const transition_t packed = (transition_t)transition.operand_a
+                    | ((transition_t)transition.operand_b << descriptor.operand_width)
+                    | (transition.pointer << (2 * descriptor.operand_width))
+                    | ((transition_t)transition.last << (2 * descriptor.operand_width + descriptor.pointer_width));
+                words[slot / descriptor.slots_per_word] |= packed << ((slot % descriptor.slots_per_word) * width);
+                slot++;
+            }
+            payload.write((char*)words.data(), words.size() * sizeof(transition_t));
+            dump_binary_padding(&payload, words.size());
+        }
+        descriptor.size = (uint64_t)payload.tellp() - descriptor.offset;
+    }
+
+    // value sets of the IN-list transitions: the bounds, then the members of every set
+    image_sets_s sets;
+    memset(&sets, 0, sizeof(sets));
+    if (!m_value_sets.empty())
+    {
+        std::vector<uint32_t> bounds(1, 0);
+        std::vector<operand_t> values;
+        for (auto& set : m_value_sets)
+        {
+            values.insert(values.end(), set.begin(), set.end());
+            bounds.push_back(values.size());
+        }
+        sets.offset = payload.tellp();
+        sets.n_sets = m_value_sets.size();
+        sets.n_values = values.size();
+        payload.write((char*)bounds.data(), bounds.size() * sizeof(uint32_t));
+        payload.write((char*)values.data(), values.size() * sizeof(operand_t));
+        const std::string padding((C_CACHELINE_SIZE - (payload.tellp() - (std::streamoff)sets.offset)
+                                   % C_CACHELINE_SIZE) % C_CACHELINE_SIZE, '\0');
+        payload.write(padding.data(), padding.size());
+        sets.size = (uint64_t)payload.tellp() - sets.offset;
+    }
+    const std::string raw_payload = payload.str();
+
+    // engine parameters of each level
+    std::vector<image_criterion_s> criteria;
+    for (criterionid_t level = 0; level < m_dic->m_sorting_map.size(); level++)
+        criteria.push_back(RuleParser::get_level_parameters(*m_rulePack, m_dic, level, wildcard_first));
+
+    image_header_s header;
+    memset(&header, 0, sizeof(header));
+    header.magic = C_IMAGE_MAGIC;
+    header.version = version;
+    header.header_size = sizeof(header)
+                       + criteria.size() * sizeof(image_criterion_s)
+                       + descriptors.size() * sizeof(image_memory_s)
+                       + ((m_value_sets.empty()) ? 0 : sizeof(image_sets_s));
+    header.header_size += (C_CACHELINE_SIZE - header.header_size % C_CACHELINE_SIZE) % C_CACHELINE_SIZE;
+    header.hash = nfa_hash;
+    header.checksum = image_checksum(raw_payload.data(), raw_payload.size());
+    header.n_criteria = criteria.size();
+    header.n_memories = descriptors.size();
+    header.layout = layout;
+    header.flags = (m_value_sets.empty()) ? 0 : C_IMAGE_FLAG_VALUE_SETS;
+    for (auto& descriptor : descriptors)
+        descriptor.offset += header.header_size;
+    sets.offset += header.header_size;
+
+    const size_t descriptors_size = sizeof(header)
+                                  + criteria.size() * sizeof(image_criterion_s)
+                                  + descriptors.size() * sizeof(image_memory_s)
+                                  + ((m_value_sets.empty()) ? 0 : sizeof(image_sets_s));
+    const char zero[C_CACHELINE_SIZE] = {0};
+    outfile->write((char*)&header, sizeof(header));
+    outfile->write((char*)criteria.data(), criteria.size() * sizeof(image_criterion_s));
+    outfile->write((char*)descriptors.data(), descriptors.size() * sizeof(image_memory_s));
+    if (!m_value_sets.empty())
+        outfile->write((char*)&sets, sizeof(sets));
+    outfile->write(zero, header.header_size - descriptors_size);
+    outfile->write(raw_payload.data(), raw_payload.size());
+}
+
+std::vector<vertex_id_t> GraphHandler::get_ordered_children(const vertex_id_t& vertex_id,
+                                                          const ValueTable* dic,
+                                                          const criterionDefinition_s* criterion_def,
+                                                          const value_frequencies_t* frequencies,
+                                                          const WildcardPolicy& policy)
+{
+    // children are value-sorted by default (vertex ids follow the dictionnary after consolidation)
+    std::vector<vertex_id_t> children(m_graph[vertex_id].children.begin(), m_graph[vertex_id].children.end());
+    if (frequencies != NULL && !criterion_def->m_isPair)
+    {
+        const std::vector<uint32_t>& hits = (*frequencies)[criterion_def->m_index];
+        auto hits_of = [&](const vertex_id_t& vert) {
+            const operand_t value_id = (*dic)[m_graph[vert].label];
+            return (value_id < hits.size()) ? hits[value_id] : 0;
+        };
+        std::stable_sort(children.begin(), children.end(),
+            [&](const vertex_id_t& a, const vertex_id_t& b) {
+                const bool wildcard_a = (m_graph[a].label == "*");
+                const bool wildcard_b = (m_graph[b].label == "*");
+                if (policy != WildcardByFrequency && wildcard_a != wildcard_b)
+                    return wildcard_a == (policy == WildcardFirst);
+                return hits_of(a) > hits_of(b);
+            });
+    }
+    else if (!children.empty()
+             && m_graph[children.front()].level < m_dic->m_disjoint_levels.size()
+             && m_dic->m_disjoint_levels[m_graph[children.front()].level])
+    {
+        // wildcard first, then the disjoint intervals in ascending order
+        std::sort(children.begin(), children.end(),
+            [&](const vertex_id_t& a, const vertex_id_t& b) {
+                const bool wildcard_a = (m_graph[a].label == "*");
+                const bool wildcard_b = (m_graph[b].label == "*");
+                if (wildcard_a != wildcard_b)
+                    return wildcard_a;
+                return m_graph[a].interval < m_graph[b].interval;
+            });
+    }
+
+    // IN-lists first: strict-match levels only stop at a value matched by equality
+    if (!children.empty() && m_dic->is_set_level(m_graph[children.front()].level))
+        std::stable_partition(children.begin(), children.end(),
+            [&](const vertex_id_t& vert) { return is_value_list(m_graph[vert].label); });
+    return children;
+}
+
+operand_t GraphHandler::get_set_reference(const criterionid_t& level, const std::string& value)
+{
+    std::vector<operand_t> members;
+    for (auto& member : split_value_list(value))
+        members.push_back(m_dic->get_valueid_by_level(level, member));
+    std::sort(members.begin(), members.end());
+
+    auto aux = m_set_refs.emplace(members, m_value_sets.size() + 1);
+    if (aux.second)
+    {
+        if (m_value_sets.size() >= std::numeric_limits<operand_t>::max())
+        {
+            m_set_refs.erase(aux.first);
+            throw std::length_error("more than " + std::to_string(m_value_sets.size())
+                                    + " value sets, IN-list references overflow");
+        }
+        m_value_sets.push_back(members);
+    }
+    return aux.first->second;
+}
+
+void GraphHandler::get_transitions(const vertex_id_t& vertex_id,
+                                   const ValueTable* dic,
+                                   const criterionDefinition_s* criterion_def,
+                                   const value_frequencies_t* frequencies,
+                                   const WildcardPolicy& policy,
+                                   std::vector<transition_s>* transitions)
 {
     size_t n_fanout = m_graph[vertex_id].children.size();
     size_t aux = 1;
-    transition_t mem_int;
     operand_t mem_opa;
     operand_t mem_opb;
 
-    for (auto& itr : m_graph[vertex_id].children)
+    const std::vector<vertex_id_t> children =
+        get_ordered_children(vertex_id, dic, criterion_def, frequencies, policy);
+    for (auto& itr : children)
     {
         RuleParser::parse_value(
                 m_graph[itr].label,
@@ -534,17 +1306,130 @@ void GraphHandler::dump_binary_transition(std::fstream* outfile,
                 &mem_opb,
                 criterion_def);
 
-        mem_int = (transition_t)(aux++ == n_fanout) << SHIFT_LAST;
-        mem_int |= (((transition_t)m_graph[itr].dump_pointer) & MASK_POINTER) << SHIFT_POINTER;
-        mem_int |= (((transition_t)mem_opb) & MASK_OPERANDS) << SHIFT_OPERAND_B;
-        mem_int |= (((transition_t)mem_opa) & MASK_OPERANDS) << SHIFT_OPERAND_A;
-        // std::cout << mem_int << " p=" << m_graph[itr].dump_pointer << " a=" << mem_opa
-        //           << " b=" << mem_opb << std::endl;
-        outfile->write((char*)&mem_int, sizeof(mem_int));
+        // coalesced levels only hold ranges (singletons included), matched as GEQ/LEQ pairs
+        if (m_graph[itr].level < m_dic->m_range_levels.size()
+            && m_dic->m_range_levels[m_graph[itr].level]
+            && m_graph[itr].label != "*")
+        {
+            mem_opb = (m_graph[itr].label_end.empty())
+                    ? mem_opa
+                    : (*dic)[m_graph[itr].label_end];
+        }
+        else if (m_graph[itr].level < m_dic->m_disjoint_levels.size()
+                 && m_dic->m_disjoint_levels[m_graph[itr].level]
+                 && m_graph[itr].label != "*")
+        {
+            mem_opa = m_graph[itr].interval.first;
+            mem_opb = m_graph[itr].interval.second;
+        }
+        else if (m_dic->is_set_level(m_graph[itr].level) && is_value_list(m_graph[itr].label))
+            mem_opb = get_set_reference(m_graph[itr].level, m_graph[itr].label);
+
+        transition_s transition;
+        transition.operand_a = mem_opa;
+        transition.operand_b = mem_opb;
+        transition.pointer = m_graph[itr].dump_pointer;
+        transition.last = (aux++ == n_fanout);
+        transitions->push_back(transition);
+    }
+}
+
+void GraphHandler::export_memory_depth_first(const std::string& filename,
+                                             const value_frequencies_t* frequencies,
+                                             const WildcardPolicy& policy,
+                                             const uint32_t& version)
+{
+    std::fstream outfile(filename, std::ios::out | std::ios::trunc | std::ios::binary);
+    export_memory_depth_first(&outfile, frequencies, policy, version);
+    outfile.close();
+}
+
+void GraphHandler::export_memory_depth_first(std::ostream* outfile,
+                                             const value_frequencies_t* frequencies,
+                                             const WildcardPolicy& policy,
+                                             const uint32_t& version)
+{
+    const criterionid_t content_level = m_vertexes.size() - 1;
+
+    // content pointers as in the level-major layout
+    for (auto& value : m_vertexes[content_level])
+    {
+        for (auto& vert : m_vertexes[content_level][value.first])
+            m_graph[vert].dump_pointer = value.first;
+    }
+    for (auto& value : m_vertexes[content_level-1])
+    {
+        for (auto& vert : m_vertexes[content_level-1][value.first])
+            m_graph[vert].dump_pointer = m_graph[*m_graph[vert].children.begin()].dump_pointer;
+    }
+
+    // the origin stays at offset 0 (looked up by the first criterion value)
+    uint64_t cursor = 0;
+    std::vector<vertex_id_t> blocks;
+    std::vector<bool> placed(boost::num_vertices(m_graph), false);
+    place_depth_first(0, &cursor, &blocks, &placed, frequencies, policy);
+
+    if (cursor > ((transition_t)1 << (CFG_TRANSITION_POINTER_WIDTH + CFG_TRANSITION_POINTER_HIGH_WIDTH)))
+        log_stream() << "[!] " << cursor << " transitions do not fit into the depth-first pointers\n";
+
+    const ValueTable* dic;
+    const criterionDefinition_s* criterion_def;
+    criterionid_t level;
+    std::vector<std::vector<transition_s>> memories(1);
+    memories[0].reserve(cursor);
+    for (auto& vert : blocks)
+    {
+        level = (vert == 0) ? 0 : m_graph[vert].level + 1;
+        dic = &m_dic->get_criterion_dic_by_level(level);
+        criterion_def = &(*std::next(m_rulePack->m_ruleType.m_criterionDefinition.begin(),
+                                     m_dic->m_sorting_map[level]));
+        get_transitions(vert, dic, criterion_def, (vert == 0) ? NULL : frequencies, policy, &memories[0]);
+    }
+
+    const uint64_t nfa_hash = get_graph_hash();
+    if (version != C_IMAGE_VERSION_FIXED)
+        dump_image(outfile, nfa_hash, version, C_IMAGE_LAYOUT_DEPTH_FIRST, memories,
+                   frequencies == NULL || policy == WildcardFirst);
+    else
+    {
+        outfile->write((char*)&nfa_hash, sizeof(nfa_hash));
+        if (!m_value_sets.empty())
+            log_printf("[!] IN-list transitions need a self-describing image (-v 2 or 3): they never match\n");
+        dump_fixed_memory(outfile, memories[0],
+                          CFG_TRANSITION_POINTER_WIDTH + CFG_TRANSITION_POINTER_HIGH_WIDTH);
+    }
+}
+
+void GraphHandler::place_depth_first(const vertex_id_t& vertex_id,
+                                     uint64_t* cursor,
+                                     std::vector<vertex_id_t>* blocks,
+                                     std::vector<bool>* placed,
+                                     const value_frequencies_t* frequencies,
+                                     const WildcardPolicy& policy)
+{
+    const criterionid_t level = (vertex_id == 0) ? 0 : m_graph[vertex_id].level + 1;
+    (*placed)[vertex_id] = true;
+    if (vertex_id != 0)
+        m_graph[vertex_id].dump_pointer = *cursor;
+    blocks->push_back(vertex_id);
+    *cursor += m_graph[vertex_id].children.size();
+
+    // states of the last criterion point to the content instead of a block
+    if (level + 1u >= m_vertexes.size() - 1)
+        return;
+
+    const ValueTable& dic = m_dic->get_criterion_dic_by_level(level);
+    const criterionDefinition_s* criterion_def =
+        &(*std::next(m_rulePack->m_ruleType.m_criterionDefinition.begin(), m_dic->m_sorting_map[level]));
+    for (auto& child : get_ordered_children(vertex_id, &dic, criterion_def,
+                                            (vertex_id == 0) ? NULL : frequencies, policy))
+    {
+        if (!(*placed)[child])
+            place_depth_first(child, cursor, blocks, placed, frequencies, policy);
     }
 }
 
-void GraphHandler::dump_binary_padding(std::fstream* outfile, const size_t& slices)
+void GraphHandler::dump_binary_padding(std::ostream* outfile, const size_t& slices)
 {
     transition_t mem_int = 0;
     size_t n_edges = slices % C_EDGES_PER_CACHE_LINE;
@@ -29,20 +29,49 @@
 namespace erbium {
 
 class Dictionnary;
+class ValueTable;
 
 class GraphHandler {
   public:
+    struct tradeoff_s
+    {
+        criterionid_t level;
+        int32_t  growth;     // estimated transitions added by determinising this level alone
+        double   backtracks; // wildcard branches avoided per query
+        double   gain;       // backtracks against growth, in the units of the sorting optimiser
+    };
 
     GraphHandler(const rulePack_s* rulepack, const Dictionnary* dic);
 
     // backward optimisation
     uint suffix_reduction();
 
+    // merges runs of sibling states with adjacent value ids and the same children into one range
+    // state, on the levels flagged by the dictionnary; returns the number of states removed
+    uint coalesce_ranges();
+
+    // splits the overlapping pair transitions of each state into disjoint elementary intervals
+    // leading to the union of the covered states, on the levels flagged by the dictionnary, so
+    // that at most one non-wildcard transition matches; returns the number of states added
+    uint split_intervals();
+
     // build transitions and states, eliminating orphans
     void consolidate_graph();
 
-    // fuses wildcard paths to non-wildcard paths
-    void make_deterministic();
+    // whether the states of a level can be merged by label (not on pair criteria nor IN-lists)
+    bool is_determinisable(const criterionid_t& level) const;
+
+    // fuses wildcard paths to non-wildcard paths, level by level (subset construction); once the
+    // number of states would exceed the budget (0 = unbounded), the remaining levels are left
+    // nondeterministic; returns the number of determinised levels, flagged in determinised if
+    // given (only the levels set in the mask, if any)
+    uint make_deterministic(const uint32_t& state_budget = 0,
+                            const std::vector<bool>* levels = NULL,
+                            std::vector<bool>* determinised = NULL);
+
+    // per level cost model of the determinisation, on rules replayed as queries (levels already
+    // determinised, as flagged by the dictionnary, add no transitions and avoid their backtracks)
+    std::vector<tradeoff_s> get_determinisation_tradeoff();
 
     // returns n_bram_edges_max
     uint print_stats();
@@ -61,26 +90,97 @@ class GraphHandler {
 
     // export dot file (for visualisation)
     void export_graphviz(const std::string& filename);
-
-    // export binary data for erbium engine
-    void export_memory(const std::string& filename);
+    void export_graphviz(std::ostream* dot_file);
+
+    // export binary data for erbium engine; with frequencies, each fan-out block of the simple
+    // criteria is laid out hottest first (value-sorted otherwise); versions above 1 describe the
+    // engine parameters and the memories in a header (see image_header_s); IN-list transitions
+    // referencing more value sets than the operands address throw std::length_error
+    void export_memory(const std::string& filename,
+                       const value_frequencies_t* frequencies = NULL,
+                       const WildcardPolicy& policy = WildcardFirst,
+                       const uint32_t& version = C_IMAGE_VERSION_FIXED);
+
+    // export the same transitions as a single memory in depth-first order (CPU engine only):
+    // each fan-out block follows its parent's block and pointers are absolute offsets
+    void export_memory_depth_first(const std::string& filename,
+                                   const value_frequencies_t* frequencies = NULL,
+                                   const WildcardPolicy& policy = WildcardFirst,
+                                   const uint32_t& version = C_IMAGE_VERSION_FIXED);
+
+    // same images written to a stream (e.g. the in-memory images of a bundle)
+    void export_memory(std::ostream* outfile,
+                       const value_frequencies_t* frequencies = NULL,
+                       const WildcardPolicy& policy = WildcardFirst,
+                       const uint32_t& version = C_IMAGE_VERSION_FIXED);
+    void export_memory_depth_first(std::ostream* outfile,
+                                   const value_frequencies_t* frequencies = NULL,
+                                   const WildcardPolicy& policy = WildcardFirst,
+                                   const uint32_t& version = C_IMAGE_VERSION_FIXED);
 
   private:
+    struct transition_s
+    {
+        operand_t operand_a;
+        operand_t operand_b;
+        uint64_t  pointer;
+        bool      last;
+    };
+
+    // relative weight of memory transitions (per rule) against visited transitions (per query)
+    const double C_COST_TRANSITIONS = 1.0;
+    // transitions worth of a backtrack into a wildcard branch (memory round trip)
+    const double C_COST_BACKTRACK = 3.0;
+    // number of rules replayed to estimate the backtracks
+    const uint32_t C_SAMPLE_QUERIES = 1024;
+
     vertexes_t   m_vertexes; // per level > per value_id > nodes list
     graph_t      m_graph;    // graph and NFA
     //
     const rulePack_s*  m_rulePack;
     const Dictionnary* m_dic;
-
-    // DFA-only
-    void dfa_merge_paths(const vertex_id_t& orgi_state, const vertex_id_t& dest_state);
-    void dfa_append_path(const vertex_id_t& orgi_state, const vertex_id_t& dest_state);
-
-    void dump_binary_transition(std::fstream* outfile,
-                                const vertex_id_t& vertex_id,
-                                dictionnary_t* dic,
-                                const criterionDefinition_s* criterion_def);
-    void dump_binary_padding(std::fstream* outfile, const size_t& slices);
+    // value sets of the IN-list transitions of the image being exported (ascending value ids)
+    std::vector<std::vector<operand_t>>          m_value_sets; // per reference - 1
+    std::map<std::vector<operand_t>, operand_t> m_set_refs;   // per value set > reference
+
+    // counts, per level, the states where both a specific and a wildcard transition match
+    void count_backtracks(const vertex_id_t& vertex_id,
+                          const std::vector<operand_t>& query,
+                          const std::vector<std::pair<operand_t, operand_t>>& operands,
+                          std::vector<uint64_t>* backtracks);
+
+    std::vector<vertex_id_t> get_ordered_children(const vertex_id_t& vertex_id,
+                                                  const ValueTable* dic,
+                                                  const criterionDefinition_s* criterion_def,
+                                                  const value_frequencies_t* frequencies,
+                                                  const WildcardPolicy& policy);
+    void place_depth_first(const vertex_id_t& vertex_id,
+                           uint64_t* cursor,
+                           std::vector<vertex_id_t>* blocks,
+                           std::vector<bool>* placed,
+                           const value_frequencies_t* frequencies,
+                           const WildcardPolicy& policy);
+    // reference (from 1) of the value set of an IN-list, shared by the lists of the same members;
+    // throws std::length_error once the references exceed the operands
+    operand_t get_set_reference(const criterionid_t& level, const std::string& value);
+    void get_transitions(const vertex_id_t& vertex_id,
+                         const ValueTable* dic,
+                         const criterionDefinition_s* criterion_def,
+                         const value_frequencies_t* frequencies,
+                         const WildcardPolicy& policy,
+                         std::vector<transition_s>* transitions);
+    // legacy fixed-width memory (count word, transitions, padding); true if a field overflows
+    bool dump_fixed_memory(std::ostream* outfile,
+                           const std::vector<transition_s>& memory,
+                           const uint8_t& pointer_width = CFG_TRANSITION_POINTER_WIDTH);
+    void dump_binary_padding(std::ostream* outfile, const size_t& slices);
+    // self-describing image (header, then the fixed or packed memories and the value sets)
+    void dump_image(std::ostream* outfile,
+                    const uint64_t& nfa_hash,
+                    uint32_t version,
+                    const uint8_t& layout,
+                    const std::vector<std::vector<transition_s>>& memories,
+                    const bool& wildcard_first);
 };
 
 } // namespace erbium
@@ -38,6 +38,38 @@ typedef uint16_t  operand_t;
 // raw cacheline size (must be consistent with kernel_<shell>.cpp and erbium_wrapper.vhd)
 const unsigned char C_CACHELINE_SIZE = 64; // in bytes
 
+// self-describing NFA image (must be consistent with definitions.h); only the fixed-width version
+// is uploaded, without its header (version 1 has none)
+const uint64_t C_IMAGE_MAGIC             = 0x000041464e425245; // "ERBNFA"
+const uint32_t C_IMAGE_VERSION_DESCRIBED = 3;
+const uint8_t  C_IMAGE_LAYOUT_LEVELS     = 0;
+
+struct image_header_s
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t hash;
+    uint64_t checksum;
+    uint16_t n_criteria;
+    uint16_t n_memories;
+    uint8_t  layout;
+    uint8_t  reserved[3];
+};
+struct image_criterion_s
+{
+    uint16_t criterion_id;
+    uint16_t functor;
+    uint32_t weight;
+    uint8_t  structure;
+    uint8_t  function_a;
+    uint8_t  function_b;
+    uint8_t  function_pair;
+    uint8_t  match_mode;
+    uint8_t  wildcard;
+    uint16_t reserved;
+};
+
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 //                                                                                                //
@@ -68,6 +100,44 @@ struct kernel_pkg_s {
 //                                                                                                //
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// 64-bit FNV-1a, the checksum of the image payload
+uint64_t image_checksum(const char* data, const size_t& size)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3;
+    return hash;
+}
+
+// validates the header of a self-describing image and prints its engine parameters
+bool check_nfa_header(const char* file_buffer, const uint32_t& file_size, uint32_t* header_size)
+{
+    const image_header_s* header = reinterpret_cast<const image_header_s*>(file_buffer);
+    if (header->version != C_IMAGE_VERSION_DESCRIBED || header->layout != C_IMAGE_LAYOUT_LEVELS
+        || header->header_size > file_size)
+    {
+        printf("[!] NFA image version %u (layout %u) cannot be uploaded: export it with erbium -v 3\n",
+               header->version, header->layout);
+        return false;
+    }
+    if (header->checksum != image_checksum(file_buffer + header->header_size, file_size - header->header_size))
+    {
+        printf("[!] NFA image checksum mismatch (corrupted file)\n");
+        return false;
+    }
+
+    const image_criterion_s* criteria =
+        reinterpret_cast<const image_criterion_s*>(file_buffer + sizeof(image_header_s));
+    printf("> NFA criteria: %u\n", header->n_criteria);
+    for (uint16_t level = 0; level < header->n_criteria; level++)
+        printf(">  level %2u: criterion=%u functor=%u weight=%u strct=%u fnctr=%u/%u/%u mode=%u wildcard=%u\n",
+               level, criteria[level].criterion_id, criteria[level].functor, criteria[level].weight,
+               criteria[level].structure, criteria[level].function_a, criteria[level].function_b,
+               criteria[level].function_pair, criteria[level].match_mode, criteria[level].wildcard);
+    *header_size = header->header_size;
+    return true;
+}
+
 bool load_nfa_from_file(const char* file_name,
     std::vector<uint64_t, aligned_allocator<uint64_t>>** nfa_data, uint32_t* raw_size, uint64_t* nfa_hash)
 {
@@ -75,18 +145,32 @@ bool load_nfa_from_file(const char* file_name,
     if(file.is_open())
     {
         file.seekg(0, std::ios::end);
-        *raw_size = ((uint32_t)file.tellg()) - sizeof(*nfa_hash);
+        const uint32_t file_size = file.tellg();
 
-        char* file_buffer = new char[*raw_size];
+        char* file_buffer = new char[file_size];
 
         file.seekg(0, std::ios::beg);
-        file.read(reinterpret_cast<char *>(nfa_hash), sizeof(*nfa_hash));
-        file.read(file_buffer, *raw_size);
+        file.read(file_buffer, file_size);
+        file.close();
+
+        // the payload follows the hash, or the header of self-describing images
+        uint32_t header_size = sizeof(*nfa_hash);
+        memcpy(nfa_hash, file_buffer, sizeof(*nfa_hash));
+        if (*nfa_hash == C_IMAGE_MAGIC)
+        {
+            if (!check_nfa_header(file_buffer, file_size, &header_size))
+            {
+                delete [] file_buffer;
+                *raw_size = 0;
+                return false;
+            }
+            *nfa_hash = reinterpret_cast<const image_header_s*>(file_buffer)->hash;
+        }
+        *raw_size = file_size - header_size;
 
         *nfa_data = new std::vector<uint64_t, aligned_allocator<uint64_t>>(*raw_size);
-        memcpy((*nfa_data)->data(), file_buffer, *raw_size);
+        memcpy((*nfa_data)->data(), file_buffer + header_size, *raw_size);
 
-        file.close();
         delete [] file_buffer;
         return true;
     }
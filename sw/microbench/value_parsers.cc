@@ -0,0 +1,192 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Micro-benchmarks of the value parsers (value_parsers.h) against the former std::string ones of
+// RuleParser, on random dates and flight ranges; both must agree on every value.
+//   usage: value_parsers [iterations]
+
+#include "../value_parsers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace erbium::parsers;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// FORMER PARSERS                                                                                 //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint16_t former_month_number(const std::string& month_code)
+{
+    std::map<std::string, uint16_t> months
+    {
+        { "JAN",  1 }, { "FEB",  2 }, { "MAR",  3 }, { "APR",  4 }, { "MAY",  5 }, { "JUN",  6 },
+        { "JUL",  7 }, { "AUG",  8 }, { "SEP",  9 }, { "OCT", 10 }, { "NOV", 11 }, { "DEC", 12 }
+    };
+    return months[month_code];
+}
+
+uint16_t former_date_check(const uint16_t& d, uint16_t m, uint16_t y)
+{
+    if (m < 3)
+        y--, m += 12;
+    const uint32_t interim = 365*y + y/4 - y/100 + y/400 + (153*m - 457)/5 + d - 306;
+    if (interim < C_DAY_FIRST)
+        return 1;
+    else if (interim > C_DAY_LAST)
+        return USHRT_MAX;
+    return interim - C_DAY_FIRST + 2;
+}
+
+void former_pair_of_dates(const std::string& value, uint16_t* operand_a, uint16_t* operand_b)
+{
+    *operand_a = former_date_check(atoi(value.substr( 0,  2).c_str()),
+                                   former_month_number(value.substr( 2,  3)),
+                                   atoi(value.substr( 5,  4).c_str()));
+    *operand_b = former_date_check(atoi(value.substr(10, 2).c_str()),
+                                   former_month_number(value.substr(12, 3)),
+                                   atoi(value.substr(15, 4).c_str()));
+}
+
+void former_pair_of_flights(std::string value_raw, uint16_t* operand_a, uint16_t* operand_b)
+{
+    std::replace(value_raw.begin(), value_raw.end(), '/', ' ');
+    char* p_end;
+    *operand_a = strtoul(value_raw.c_str(), &p_end, 10);
+    *operand_b = strtoul(p_end, &p_end, 10);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// HARNESS                                                                                        //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// average nanoseconds per value of a parser over all the values, for some iterations
+template <typename Parser>
+double measure(const std::vector<std::string>& values, const uint32_t& iterations,
+               std::vector<uint32_t>* results, Parser parser)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t it = 0; it < iterations; it++)
+        for (size_t i = 0; i < values.size(); i++)
+            (*results)[i] = parser(values[i]);
+    const auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations / values.size();
+}
+
+// prints the comparison of two parsers; returns the number of mismatching values
+uint32_t compare(const char* name, const std::vector<std::string>& values, const uint32_t& iterations,
+                 uint32_t (*former)(const std::string&), uint32_t (*table)(const std::string&))
+{
+    std::vector<uint32_t> results_former(values.size());
+    std::vector<uint32_t> results_table(values.size());
+    const double ns_former = measure(values, iterations, &results_former, former);
+    const double ns_table  = measure(values, iterations, &results_table, table);
+
+    uint32_t mismatches = 0;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        if (results_former[i] != results_table[i] && mismatches++ == 0)
+            printf("[!] %s of [%s]: %u (former) vs %u\n", name, values[i].c_str(),
+                   results_former[i], results_table[i]);
+    }
+    printf("> %-20s former %8.2f ns, table %6.2f ns (x%.1f), %u mismatches\n", name,
+           ns_former, ns_table, ns_former / ns_table, mismatches);
+    return mismatches;
+}
+
+// both operands in one word, so that they are compared at once
+uint32_t pack(const uint16_t& operand_a, const uint16_t& operand_b)
+{
+    return ((uint32_t)operand_b << 16) | operand_a;
+}
+
+// functor of a generated value
+uint16_t functor_of(const std::string& value)
+{
+    return (value.size() == 19) ? 212 : 412;
+}
+
+int main(int argc, char** argv)
+{
+    const uint32_t iterations = (argc > 1) ? atoi(argv[1]) : 16;
+    const uint32_t n_values = 1 << 16;
+    const char* months[12] = { "JAN", "FEB", "MAR", "APR", "MAY", "JUN",
+                               "JUL", "AUG", "SEP", "OCT", "NOV", "DEC" };
+
+    // dates around the operand range (some are clamped) and flight ranges
+    std::default_random_engine generator(42);
+    std::uniform_int_distribution<uint32_t> day(1, 28), month(0, 11), year(2000, 2035), flight(1, 9999);
+    std::vector<std::string> codes, dates, flights;
+    char buffer[32];
+    for (uint32_t i = 0; i < n_values; i++)
+    {
+        codes.push_back(months[month(generator)]);
+        const uint32_t d_a = day(generator), m_a = month(generator), y_a = year(generator);
+        const uint32_t d_b = day(generator), m_b = month(generator), y_b = year(generator);
+        snprintf(buffer, sizeof(buffer), "%02u%s%04u-%02u%s%04u", d_a, months[m_a], y_a, d_b, months[m_b], y_b);
+        dates.push_back(buffer);
+        const uint32_t f_a = flight(generator), f_b = flight(generator);
+        snprintf(buffer, sizeof(buffer), "%04u/%04u", std::min(f_a, f_b), std::max(f_a, f_b));
+        flights.push_back(buffer);
+    }
+
+    printf("# VALUE PARSERS (%u values, %u iterations)\n", n_values, iterations);
+    uint32_t mismatches = 0;
+    mismatches += compare("month_number", codes, iterations,
+        [](const std::string& v) -> uint32_t { return former_month_number(v); },
+        [](const std::string& v) -> uint32_t { return month_number(v.data()); });
+    mismatches += compare("parse_pair_of_dates", dates, iterations,
+        [](const std::string& v) -> uint32_t { uint16_t a, b; former_pair_of_dates(v, &a, &b); return pack(a, b); },
+        [](const std::string& v) -> uint32_t { uint16_t a = 0, b = 0; parse_pair_of_dates(v.data(), v.size(), &a, &b); return pack(a, b); });
+    mismatches += compare("parse_integer_range", flights, iterations,
+        [](const std::string& v) -> uint32_t { uint16_t a, b; former_pair_of_flights(v, &a, &b); return pack(a, b); },
+        [](const std::string& v) -> uint32_t { uint16_t a = 0, b = 0; parse_integer_range(v.data(), v.size(), &a, &b); return pack(a, b); });
+
+    // dispatch on the functor of each value, as RuleParser::parse_value
+    std::vector<std::string> mixed;
+    for (uint32_t i = 0; i < n_values; i++)
+        mixed.push_back((i % 2) ? dates[i] : flights[i]);
+    mismatches += compare("parse_value", mixed, iterations,
+        [](const std::string& v) -> uint32_t {
+            uint16_t a = 0, b = 0;
+            switch (functor_of(v))
+            {
+                case 212: former_pair_of_dates(v, &a, &b); break;
+                case 412: former_pair_of_flights(v, &a, &b); break;
+            }
+            return pack(a, b);
+        },
+        [](const std::string& v) -> uint32_t {
+            uint16_t a = 0, b = 0;
+            find_value_functor(functor_of(v))->parser(v.data(), v.size(), &a, &b);
+            return pack(a, b);
+        });
+
+    return (mismatches == 0) ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the 
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "nfa_estimator.h"
+#include "dictionnary.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace erbium {
+
+NfaEstimator::NfaEstimator(const rulePack_s& rulepack, const Dictionnary* dic)
+{
+    const criterionid_t n_criteria = rulepack.m_ruleType.m_criterionDefinition.size();
+    m_n_rules = rulepack.m_rules.size();
+    m_values.resize(n_criteria, std::vector<operand_t>(m_n_rules));
+    m_contents.resize(m_n_rules);
+
+    // value ids of the rule store columns
+    const ruleStore_s& rules = rulepack.m_rules;
+    for (criterionid_t criterion_id = 0; criterion_id < n_criteria; criterion_id++)
+    {
+        for (uint32_t rule_id = 0; rule_id < m_n_rules; rule_id++)
+            m_values[criterion_id][rule_id] =
+                dic->get_valueid_by_code(criterion_id, rules.get_code(rule_id, criterion_id));
+    }
+    for (uint32_t rule_id = 0; rule_id < m_n_rules; rule_id++)
+        m_contents[rule_id] = dic->get_valueid_by_code(n_criteria, rules.get_content_code(rule_id));
+}
+
+size_t NfaEstimator::signature_hash::operator()(const std::vector<uint32_t>& signature) const
+{
+    uint64_t result = signature.size();
+    for (auto& aux : signature)
+        result = (result ^ aux) * 0x100000001b3;
+    return result;
+}
+
+NfaEstimator::estimate_s NfaEstimator::estimate(const sorting_map_t& order) const
+{
+    estimate_s estimate;
+    const uint16_t n_levels = order.size();
+
+    ////// PREFIX TREE: state of each rule per level (as built by GraphHandler)
+    std::vector<std::vector<uint32_t>>  state_of(n_levels, std::vector<uint32_t>(m_n_rules));
+    std::vector<std::vector<operand_t>> value_of(n_levels);
+    std::unordered_map<uint64_t, uint32_t> states;
+
+    for (uint16_t level = 0; level < n_levels; level++)
+    {
+        const std::vector<operand_t>& column = m_values[order[level]];
+        states.clear();
+        states.reserve((level == 0) ? 64 : value_of[level - 1].size() * 2);
+        for (uint32_t rule_id = 0; rule_id < m_n_rules; rule_id++)
+        {
+            const uint64_t prefix = (level == 0) ? 0 : state_of[level - 1][rule_id];
+            const uint64_t key = (prefix << (sizeof(operand_t) * 8)) | column[rule_id];
+            auto aux = states.emplace(key, (uint32_t)states.size());
+            if (aux.second)
+                value_of[level].push_back(column[rule_id]);
+            state_of[level][rule_id] = aux.first->second;
+        }
+    }
+
+    ////// SUFFIX CLASSES: bottom-up, states with the same label and the same children are merged,
+    // which is exactly what GraphHandler::suffix_reduction converges to
+    std::vector<uint32_t> class_of; // per state of the level below > class id
+    std::vector<uint64_t> edges;    // <state, child class>
+    std::vector<uint32_t> signature;
+    std::unordered_map<std::vector<uint32_t>, uint32_t, signature_hash> classes;
+
+    // content states are shared among all the rules
+    std::vector<bool> used_content;
+    for (auto& content : m_contents)
+    {
+        if (content >= used_content.size())
+            used_content.resize(content + 1, false);
+        used_content[content] = true;
+    }
+    estimate.states_per_level.assign(n_levels + 1, 0);
+    estimate.transitions_per_level.assign(n_levels + 2, 0);
+    estimate.states_per_level[n_levels] = std::count(used_content.begin(), used_content.end(), true);
+
+    for (int16_t level = n_levels - 1; level >= 0; level--)
+    {
+        edges.resize(m_n_rules);
+        for (uint32_t rule_id = 0; rule_id < m_n_rules; rule_id++)
+        {
+            const uint64_t child = (level + 1 == n_levels)
+                                 ? m_contents[rule_id]
+                                 : class_of[state_of[level + 1][rule_id]];
+            edges[rule_id] = ((uint64_t)state_of[level][rule_id] << 32) | child;
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        classes.clear();
+        classes.reserve(value_of[level].size() * 2);
+        std::vector<uint32_t> next_class_of(value_of[level].size());
+        for (size_t i = 0; i < edges.size(); )
+        {
+            const uint32_t state = edges[i] >> 32;
+            signature.clear();
+            signature.push_back(value_of[level][state]);
+            for (; i < edges.size() && (edges[i] >> 32) == state; i++)
+                signature.push_back((uint32_t)edges[i]);
+
+            auto aux = classes.emplace(signature, (uint32_t)classes.size());
+            if (aux.second)
+                estimate.transitions_per_level[level + 1] += signature.size() - 1;
+            next_class_of[state] = aux.first->second;
+        }
+        estimate.states_per_level[level] = classes.size();
+        class_of.swap(next_class_of);
+    }
+
+    ////// ORIGIN
+    estimate.transitions_per_level[0] = (n_levels == 0) ? 0 : estimate.states_per_level[0];
+
+    estimate.n_states = 1;
+    for (auto& aux : estimate.states_per_level)
+        estimate.n_states += aux;
+    estimate.n_transitions = 0;
+    for (auto& aux : estimate.transitions_per_level)
+        estimate.n_transitions += aux;
+    return estimate;
+}
+
+void NfaEstimator::print_estimate(const estimate_s& estimate) const
+{
+    log_printf("origin  :     1 state ; %5u transitions\n", estimate.transitions_per_level[0]);
+    for (size_t level = 0; level < estimate.states_per_level.size(); level++)
+        log_printf("level %2lu: %5u states; %5u transitions\n",
+            level, estimate.states_per_level[level], estimate.transitions_per_level[level + 1]);
+}
+
+} // namespace erbium
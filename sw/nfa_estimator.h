@@ -0,0 +1,64 @@
+#ifndef ERBIUM_NFA_ESTIMATOR_H
+#define ERBIUM_NFA_ESTIMATOR_H
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the 
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <vector>
+
+#include "definitions.h"
+
+namespace erbium {
+
+class Dictionnary;
+
+class NfaEstimator
+{
+  public:
+    struct estimate_s
+    {
+        std::vector<uint> states_per_level;      // per criterion level (content last)
+        std::vector<uint> transitions_per_level; // same layout as GraphHandler::get_transitions_per_level
+        uint32_t n_states;                       // including origin
+        uint32_t n_transitions;
+    };
+
+    NfaEstimator(const rulePack_s& rulepack, const Dictionnary* dic);
+
+    // size of the suffix-reduced NFA for a (possibly partial) criteria order
+    estimate_s estimate(const sorting_map_t& order) const;
+
+    void print_estimate(const estimate_s& estimate) const;
+
+  private:
+    uint32_t m_n_rules;
+    std::vector<std::vector<operand_t>> m_values;   // per criterion_id > per rule > value_id
+    std::vector<operand_t>              m_contents; // per rule > content value_id
+
+    struct signature_hash
+    {
+        size_t operator()(const std::vector<uint32_t>& signature) const;
+    };
+};
+
+} // namespace erbium
+
+#endif // ERBIUM_NFA_ESTIMATOR_H
@@ -22,13 +22,19 @@
 
 #include "rule_parser.h"
 #include "dictionnary.h"
+#include "value_parsers.h"
 
 #include <string>
-#include <iostream> // std::cout
+#include <iostream> // std::endl
+#include <sstream>  // std::ostringstream
 #include <random>   // std::default_random_engine
+#include <numeric>  // std::iota
 
 namespace erbium {
 
+static_assert(parsers::C_DATE_OPERAND_WIDTH == CFG_CRITERION_VALUE_WIDTH,
+              "The date operands must span the criterion value width");
+
 void RuleParser::parse_value(const std::string& value_raw,
                              const operand_t& value_id,
                              operand_t* operand_a,
@@ -47,261 +53,274 @@ void RuleParser::parse_value(const std::string& value_raw,
     }
     else
     {
-        switch (criterion_def->m_functor)
+        const parsers::value_functor_s* functor = parsers::find_value_functor(criterion_def->m_functor);
+        if (functor == NULL || functor->parser == NULL)
+        {
+            log_stream() << "[!] Pair functor #" << criterion_def->m_functor;
+            log_stream() << " of value= " << value_raw << " is unknown\n";
+            *operand_a = 0;
+            *operand_b = 0;
+            return;
+        }
+        switch (functor->parser(value_raw.data(), value_raw.size(), operand_a, operand_b))
         {
-            case 212: // criterionType_pairofdates.xml
-                parse_pairOfDates(value_raw, operand_a, operand_b);
+            case parsers::PARSE_MALFORMED:
+                log_printf("[!] Failed parsing value [%s] as %s\n", value_raw.c_str(), functor->type);
+                *operand_a = 0;
+                *operand_b = 0;
                 break;
-            case 412: // criterionType_integerrange4-digits_412.xml
-                parse_pairOfFlights(value_raw, operand_a, operand_b);
+            case parsers::PARSE_CLAMPED:
+                log_printf("[!] Value [%s] is out of the range of %s, clamped\n", value_raw.c_str(), functor->type);
                 break;
             default:
-                std::cout << "[!] Pair functor #" << criterion_def->m_functor;
-                std::cout << " of value= " << value_raw << " is unknown\n";
-                *operand_a = 0;
-                *operand_b = 0;
+                break;
         }
     }
 }
 
-uint16_t RuleParser::get_month_number(const std::string& month_code)
-{
-    std::map<std::string, uint16_t> months
-    {
-        { "JAN",  1 },
-        { "FEB",  2 },
-        { "MAR",  3 },
-        { "APR",  4 },
-        { "MAY",  5 },
-        { "JUN",  6 },
-        { "JUL",  7 },
-        { "AUG",  8 },
-        { "SEP",  9 },
-        { "OCT", 10 },
-        { "NOV", 11 },
-        { "DEC", 12 }
-    };
-
-    return months[month_code];
-}
-
-uint32_t RuleParser::full_rata_die_day(const uint16_t& d, uint16_t m, uint16_t y)
+void RuleParser::export_benchmark_workload(const std::string& path,
+                                           const rulePack_s& rulepack,
+                                           const Dictionnary* dic,
+                                           const uint32_t& image_version)
 {
-    if (m < 3)
-        y--, m += 12;
-    return 365*y + y/4 - y/100 + y/400 + (153*m - 457)/5 + d - 306;
-}
-
-operand_t RuleParser::date_check(const uint16_t& d, uint16_t m, uint16_t y)
-{
-    // Rata Die day one is 0001-01-01
-
-    /*  0       wildcard '*': it matches anything
-     *  1       infinity down   e.g. 1st Jan 1990
-     *  2       start date      e.g. 1st Jan 2006
-     *  ...
-     *  2^14-2  end date        e.g. 6th Nov 2050
-     *  2^14-1  infinity up     e.g. 1st Jan 9999
-     * 
-     *  16,381 days period
-     */
-    // const uint32_t JANFIRST1990  =  726468; // 1st Jan 1990 - infinity down
-    // const uint32_t JANFIRST2006  =  732312; // 1st Jan 2006 - start date
-    // const uint32_t NOVNINETH2050 =  748692; // 6th Nov 2050 - end date
-    // const uint32_t JANFIRST9999  = 3651695; // 1st Jan 9999 - infinity up
-    const uint32_t JANFIRST1990  =  726468; // 1st Jan 1990 - infinity down
-    const uint32_t JANFIRST2006  =  732312; // 1st Jan 2006 - start date
-    const uint32_t NOVNINETH2050 = JANFIRST2006 + (1 << CFG_CRITERION_VALUE_WIDTH) - 2; // end date
-    const uint32_t JANFIRST9999  = 3651695; // 1st Jan 9999 - infinity up
-    // using 1st Jan 2006 as start day, the end day is:
-    //   - 13 bits: 2 Jun 2028
-    //   - 14 bits: 6 Nov 2050
-    uint32_t interim = full_rata_die_day(d, m, y);
-
-    if (interim == JANFIRST1990)
-    {
-        return 1;
-    }
-    else if (interim < JANFIRST2006)
-    {
-        printf("[!] Minimal date is Jan 1st 2006, got: m=%d d=%d y=%d\n", m, d, y);
-        return 1;
-    }
-    else if (interim == JANFIRST9999)
-    {
-        return USHRT_MAX;
-    }
-    else if (interim > NOVNINETH2050)
-    {
-        printf("[!] Maximal date is Nov 6th 2050, got: m=%d d=%d y=%d\n", m, d, y);
-        return USHRT_MAX;
-    }
-    else
-        return interim - JANFIRST2006 + 2;
-}
-
-void RuleParser::parse_pairOfDates(const std::string& value, operand_t* operand_a, operand_t* operand_b)
-{
-    if (value.length() != 19)
-    {
-        printf("[!] Failed parsing value [%s] as a pair of dates\n", value.c_str());
-        *operand_a = 0;
-        *operand_b = 0;
-        return;
-    }
-
-    *operand_a = date_check(atoi(value.substr( 0,  2).c_str()),
-                            get_month_number(value.substr( 2,  3)),
-                            atoi(value.substr( 5,  4).c_str()));
-    *operand_b = date_check(atoi(value.substr(10, 2).c_str()),
-                            get_month_number(value.substr(12, 3)),
-                            atoi(value.substr(15, 4).c_str()));
-}
-
-void RuleParser::parse_pairOfFlights(std::string value_raw, operand_t* operand_a, operand_t* operand_b)
-{
-    std::replace(value_raw.begin(), value_raw.end(), '/', ' ');
-    char* p_end;
-    *operand_a = strtoul(value_raw.c_str(), &p_end, 10);
-    *operand_b = strtoul(p_end, &p_end, 10);
+    std::fstream filecsv(path + "benchmark.csv", std::ios::out | std::ios::trunc);
+    std::fstream benchfile(path + "benchmark.bin", std::ios::out | std::ios::trunc | std::ios::binary);
+    export_benchmark_workload(&filecsv, &benchfile, rulepack, dic, image_version);
+    filecsv.close();
+    benchfile.close();
 }
 
-void RuleParser::export_benchmark_workload(const std::string& path, const rulePack_s& rulepack, const Dictionnary* dic)
+void RuleParser::export_benchmark_workload(std::ostream* filecsv,
+                                           std::ostream* benchfile,
+                                           const rulePack_s& rulepack,
+                                           const Dictionnary* dic,
+                                           const uint32_t& image_version)
 {
-    // generate .csv and .aux
-    std::fstream fileaux = RuleParser::dump_csv_raw_workload(path + "benchmark", rulepack, dic);
-    std::fstream benchfile(path + "benchmark.bin", std::ios::out | std::ios::trunc | std::ios::binary);
-
     // first data corresponds to query size + benchmark size
     uint32_t query_size = rulepack.m_ruleType.m_criterionDefinition.size() * sizeof(operand_t);
     query_size = query_size / C_CACHELINE_SIZE + ((query_size % C_CACHELINE_SIZE) ? 1 : 0);
     query_size = query_size * C_CACHELINE_SIZE;
     uint32_t benchmark_size = rulepack.m_rules.size();
 
-    benchfile.write(reinterpret_cast<char *>(&query_size), sizeof(query_size));
-    benchfile.write(reinterpret_cast<char *>(&benchmark_size), sizeof(benchmark_size));
-
-    // append benchmark.aux
-    fileaux.seekg(0, std::ios::beg);
-    benchfile << fileaux.rdbuf();
+    benchfile->write(reinterpret_cast<char *>(&query_size), sizeof(query_size));
+    benchfile->write(reinterpret_cast<char *>(&benchmark_size), sizeof(benchmark_size));
 
-    fileaux.close();
-    benchfile.close();
-    remove(((std::string)(path + "benchmark.aux")).c_str());
+    // then the queries
+    RuleParser::dump_csv_raw_workload(filecsv, benchfile, rulepack, dic,
+        (image_version == C_IMAGE_VERSION_PACKED) ? USHRT_MAX : MASK_OPERANDS);
 }
 
-std::fstream RuleParser::dump_csv_raw_workload(const std::string& filename, const rulePack_s& rulepack, const Dictionnary* dic)
+void RuleParser::dump_csv_raw_workload(std::ostream* filecsv,
+                                       std::ostream* benchfile,
+                                       const rulePack_s& rulepack,
+                                       const Dictionnary* dic,
+                                       const operand_t& operand_mask)
 {
-    std::fstream filecsv(filename + ".csv", std::ios::out | std::ios::trunc);
-    std::fstream fileaux(filename + ".aux", std::ios::out | std::ios::in | std::ios::trunc | std::ios::binary);
-
     const uint SLICES_PER_LINE = C_CACHELINE_SIZE / sizeof(operand_t);
     uint padding_slices = (rulepack.m_ruleType.m_criterionDefinition.size()) % SLICES_PER_LINE;
     padding_slices = (padding_slices == 0) ? 0 : SLICES_PER_LINE - padding_slices;
 
     operand_t mem_opa;
     operand_t mem_opb;
-    const criterion_s* aux_criterion;
     const criterionDefinition_s* aux_definition;
 
     // export csv header
-    filecsv << "ID,WEIGHT";
+    *filecsv << "ID,WEIGHT";
     for (auto& aux : dic->m_sorting_map)
     {
-        filecsv << ",";
-        filecsv << std::next(rulepack.m_ruleType.m_criterionDefinition.begin(), aux)->m_code;
+        *filecsv << ",";
+        *filecsv << std::next(rulepack.m_ruleType.m_criterionDefinition.begin(), aux)->m_code;
     }
-    filecsv << ",CONTENT" << std::endl;
+    *filecsv << ",CONTENT" << std::endl;
 
 
     // shuffle rules so benchmark has no similar consecutive queries
-    std::vector<rule_s> the_rules(rulepack.m_rules.begin(), rulepack.m_rules.end());
+    const ruleStore_s& rules = rulepack.m_rules;
+    std::vector<uint32_t> the_rules(rules.size());
+    std::iota(the_rules.begin(), the_rules.end(), 0);
     std::shuffle(the_rules.begin(), the_rules.end(), std::default_random_engine(0));
 
     for (auto& rule : the_rules)
     {
-        filecsv << rule.m_ruleId << "," << rule.m_weight;
+        *filecsv << rules.m_ruleIds[rule] << "," << rules.m_weights[rule];
         for (auto& ord : dic->m_sorting_map)
         {
-            aux_criterion  = &(*std::next(rule.m_criteria.begin(), ord));
             aux_definition = &(*std::next(rulepack.m_ruleType.m_criterionDefinition.begin(), ord));
 
+            // an IN-list is queried by its first member
+            const std::string& value = rules.get_value(rule, ord);
+            if (is_value_list(value))
+            {
+                const std::string member = value.substr(0, value.find(C_VALUE_LIST_SEPARATOR));
+                mem_opa = dic->get_valueid_by_sort(ord, member) & operand_mask;
+                benchfile->write((char*)&mem_opa, sizeof(mem_opa));
+                *filecsv << "," << member;
+                continue;
+            }
+
             RuleParser::parse_value(
-                    aux_criterion->m_value,
-                    dic->get_valueid_by_sort(ord, aux_criterion->m_value),
+                    value,
+                    dic->get_valueid_by_code(ord, rules.get_code(rule, ord)),
                     &mem_opa,
                     &mem_opb,
                     aux_definition);
-            mem_opa = mem_opa & MASK_OPERANDS;
-            fileaux.write((char*)&mem_opa, sizeof(mem_opa));
-            filecsv << "," << aux_criterion->m_value;
+            mem_opa = mem_opa & operand_mask;
+            benchfile->write((char*)&mem_opa, sizeof(mem_opa));
+            *filecsv << "," << value;
         }
-        filecsv << "," << rule.m_content << std::endl;
+        *filecsv << "," << rules.get_content(rule) << std::endl;
 
         // padding
         mem_opa = 0;
         for (uint pad = padding_slices; pad != 0; pad--)
-            fileaux.write((char*)&mem_opa, sizeof(mem_opa));
+            benchfile->write((char*)&mem_opa, sizeof(mem_opa));
     }
+}
 
-    filecsv.close();
-    return fileaux;
+image_criterion_s RuleParser::get_level_parameters(const rulePack_s& rulepack,
+                                                   const Dictionnary* dic,
+                                                   const criterionid_t& level,
+                                                   const bool& wildcard_first)
+{
+    const criterionDefinition_s* criterion_def =
+        &(*std::next(rulepack.m_ruleType.m_criterionDefinition.begin(), dic->m_sorting_map[level]));
+
+    image_criterion_s parameters;
+    parameters.criterion_id = criterion_def->m_index;
+    parameters.functor      = criterion_def->m_functor;
+    parameters.weight       = criterion_def->m_weight;
+    parameters.structure    = (criterion_def->m_isPair) ? STRCT_PAIR : STRCT_SIMPLE;
+    parameters.wildcard     = !criterion_def->m_isMandatory;
+    parameters.reserved     = 0;
+
+    // pair criteria have a value parser, simple ones match dictionnary ids
+    const parsers::value_functor_s* functor = parsers::find_value_functor(criterion_def->m_functor);
+    if (functor == NULL)
+    {
+        log_stream() << "[!] functor #" << criterion_def->m_functor << " is unknown\n";
+        parameters.function_a    = FNCTR_SIMP_NOP;
+        parameters.function_b    = FNCTR_SIMP_NOP;
+        parameters.function_pair = FNCTR_PAIR_NOP;
+        parameters.match_mode    = MODE_FULL_ITERATION;
+    }
+    else if (functor->parser == NULL)
+    {
+        parameters.function_a    = FNCTR_SIMP_EQU;
+        parameters.function_b    = FNCTR_SIMP_NOP;
+        parameters.function_pair = FNCTR_PAIR_NOP;
+        parameters.match_mode    = MODE_STRICT_MATCH;
+    }
+    else
+    {
+        parameters.function_a    = FNCTR_SIMP_GEQ;
+        parameters.function_b    = FNCTR_SIMP_LEQ;
+        parameters.function_pair = FNCTR_PAIR_AND;
+        parameters.match_mode    = MODE_FULL_ITERATION;
+    }
+
+    // equality transitions coalesced into [first, last] ranges of value ids
+    if (level < dic->m_range_levels.size() && dic->m_range_levels[level])
+    {
+        parameters.structure     = STRCT_PAIR;
+        parameters.function_a    = FNCTR_SIMP_GEQ;
+        parameters.function_b    = FNCTR_SIMP_LEQ;
+        parameters.function_pair = FNCTR_PAIR_AND;
+        parameters.match_mode    = MODE_FULL_ITERATION;
+    }
+
+    // pair transitions split into disjoint intervals: at most one non-wildcard match
+    if (level < dic->m_disjoint_levels.size() && dic->m_disjoint_levels[level])
+        parameters.match_mode = MODE_STRICT_MATCH;
+
+    // hybrid images: one transition per value on determinised levels, whereas the level below
+    // a determinised one may hold the same value several times
+    if (level < dic->m_deterministic_levels.size() && dic->m_deterministic_levels[level])
+        parameters.match_mode = MODE_STRICT_MATCH;
+    else if (level > 0 && dic->m_deterministic_levels[level-1])
+        parameters.match_mode = MODE_FULL_ITERATION;
+
+    // hottest-first layouts (erbium -l 2 and 3) may put the wildcard of a simple level after its
+    // specific transitions, where a strict-match scan would have stopped
+    if (!wildcard_first && !criterion_def->m_isPair && level > 0)
+        parameters.match_mode = MODE_FULL_ITERATION;
+
+    // IN-lists: operand_b references a value set of the image; any number of sets may match, so
+    // they lead the fan-out blocks and never stop a strict-match scan
+    if (!criterion_def->m_isPair && dic->is_set_level(level))
+        parameters.function_b = FNCTR_SIMP_IN;
+
+    return parameters;
 }
 
-void RuleParser::export_vhdl_parameters(
+bool RuleParser::export_vhdl_parameters(
     const std::string& filename,
     const rulePack_s& rulepack,
     const Dictionnary* dic,
-    const std::vector<uint> edges_per_level)
+    const std::vector<uint> edges_per_level,
+    const bool& wildcard_first)
 {
+    std::ostringstream buffer;
+    if (!export_vhdl_parameters(&buffer, rulepack, dic, edges_per_level, wildcard_first))
+        return false;
     std::fstream outfile(filename, std::ios::out | std::ios::trunc);
+    outfile << buffer.str();
+    outfile.close();
+    return true;
+}
 
-    outfile << "library ieee;\nuse ieee.numeric_std.all;\nuse ieee.std_logic_1164.all;\n\n"
-            << "library erbium;\nuse erbium.engine_pkg.all;\nuse erbium.core_pkg.all;\n\n"
-            << "package cfg_criteria is\n"
-            << "    type CORE_PARAM_ARRAY is array (0 to CFG_ENGINE_NCRITERIA - 1) of core_parameters_type;\n\n";
-
-    const criterionDefinition_s* criterion_def;
-    char buffer[1024];
-    std::string func_a, func_b, func_pair, match_mode;
-    criterionid_t the_level = 0;
-    for (auto& ord : dic->m_sorting_map)
+bool RuleParser::export_vhdl_parameters(
+    std::ostream* stream,
+    const rulePack_s& rulepack,
+    const Dictionnary* dic,
+    const std::vector<uint> edges_per_level,
+    const bool& wildcard_first)
+{
+    // names of the enumerations of core_pkg.vhd
+    const char* structures[] = {"STRCT_SIMPLE", "STRCT_PAIR"};
+    const char* pair_functions[] = {"FNCTR_PAIR_NOP", "FNCTR_PAIR_AND", "FNCTR_PAIR_OR",
+                                    "FNCTR_PAIR_XOR", "FNCTR_PAIR_NAND", "FNCTR_PAIR_NOR"};
+    const char* simp_functions[] = {"FNCTR_SIMP_NOP", "FNCTR_SIMP_EQU", "FNCTR_SIMP_NEQ", "FNCTR_SIMP_GRT",
+                                    "FNCTR_SIMP_GEQ", "FNCTR_SIMP_LES", "FNCTR_SIMP_LEQ", "FNCTR_SIMP_IN"};
+    const char* match_modes[] = {"MODE_STRICT_MATCH", "MODE_FULL_ITERATION"};
+
+    std::vector<uint> ram_depths;
+    for (criterionid_t level = 0; level < dic->m_sorting_map.size(); level++)
     {
-        criterion_def = &(*std::next(rulepack.m_ruleType.m_criterionDefinition.begin(), ord));
-
-        switch(criterion_def->m_functor)
+        if (get_level_parameters(rulepack, dic, level, wildcard_first).function_b == FNCTR_SIMP_IN)
         {
-            case  60 : // criterionType_alphanumstring3-3.xml
-            case  67 : // criterionType_alphanumstring2-2.xml
-            case 273 : // criterionType_alphastring2-2.xml
-            case 316 : // criterionType_alphanumstring1-3.xml
-            case 408 : // criterionType_integer0-9999_408.xml
-                func_a     = "FNCTR_SIMP_EQU";
-                func_b     = "FNCTR_SIMP_NOP";
-                func_pair  = "FNCTR_PAIR_NOP";
-                match_mode = "MODE_STRICT_MATCH";
-                break;
-            case 212 : // criterionType_pairofdates.xml
-            case 412 : // criterionType_integerrange4-digits_412.xml
-                func_a     = "FNCTR_SIMP_GEQ";
-                func_b     = "FNCTR_SIMP_LEQ";
-                func_pair  = "FNCTR_PAIR_AND";
-                match_mode = "MODE_FULL_ITERATION";
-                break;
-            default:
-                std::cout << "[!] functor #" << criterion_def->m_functor << " is unknown\n";
-                func_a     = "FNCTR_SIMP_NOP";
-                func_b     = "FNCTR_SIMP_NOP";
-                func_pair  = "FNCTR_PAIR_NOP";
-                match_mode = "MODE_FULL_ITERATION";
+            log_printf("[!] Level %u holds value sets, whose IN function is not in core_pkg.vhd: "
+                       "no VHDL parameters exported\n", level);
+            return false;
         }
-        uint ram_depth = 1 << ((uint)ceil(log2(edges_per_level[the_level])));
+
+        uint ram_depth = 1 << ((uint)ceil(log2(edges_per_level[level])));
 
         // arbitrary minimum value
         ram_depth = (ram_depth < 32) ? 32 : ram_depth;
 
         // ensure that there are enough bits allocated to the addresses
-        assert(ram_depth <= CFG_MEM_MAX_DEPTH);
+        if (ram_depth > CFG_MEM_MAX_DEPTH)
+        {
+            log_printf("[!] Level %u needs a memory depth of %u (%u transitions), above the maximum of the "
+                       "engine (%u): no VHDL parameters exported\n",
+                       level, ram_depth, edges_per_level[level], CFG_MEM_MAX_DEPTH);
+            return false;
+        }
+        ram_depths.push_back(ram_depth);
+    }
+
+    std::ostream& outfile = *stream;
+    outfile << "library ieee;\nuse ieee.numeric_std.all;\nuse ieee.std_logic_1164.all;\n\n"
+            << "library erbium;\nuse erbium.engine_pkg.all;\nuse erbium.core_pkg.all;\n\n"
+            << "package cfg_criteria is\n"
+            << "    type CORE_PARAM_ARRAY is array (0 to CFG_ENGINE_NCRITERIA - 1) of core_parameters_type;\n\n";
+
+    char buffer[1024];
+    criterionid_t the_level;
+    for (the_level = 0; the_level < dic->m_sorting_map.size(); the_level++)
+    {
+        const image_criterion_s parameters = get_level_parameters(rulepack, dic, the_level, wildcard_first);
+        const uint ram_depth = ram_depths[the_level];
 
         // std::cout << "edges_per_level[" << the_level << "] = " << edges_per_level[the_level] << std::endl;
         sprintf(buffer, "    constant CORE_PARAM_%u : core_parameters_type := (\n"
@@ -318,16 +337,15 @@ void RuleParser::export_vhdl_parameters(
             the_level,
             ram_depth,
             std::max((uint)3, ram_depth / 4096 + 2),
-            (criterion_def->m_isPair) ? "STRCT_PAIR" : "STRCT_SIMPLE",
-            func_a.c_str(),
-            func_b.c_str(),
-            func_pair.c_str(),
-            match_mode.c_str(),
-            criterion_def->m_weight,
-            !criterion_def->m_isMandatory);
-
-        outfile << buffer;        
-        the_level++;
+            structures[parameters.structure],
+            simp_functions[parameters.function_a],
+            simp_functions[parameters.function_b],
+            pair_functions[parameters.function_pair],
+            match_modes[parameters.match_mode],
+            parameters.weight,
+            parameters.wildcard);
+
+        outfile << buffer;
     }
     outfile << "    constant CFG_CORE_PARAM_ARRAY : CORE_PARAM_ARRAY := (\n";
     for (the_level = 0; the_level < rulepack.m_ruleType.m_criterionDefinition.size(); the_level++)
@@ -340,8 +358,7 @@ void RuleParser::export_vhdl_parameters(
     }
 
     outfile << "\n\nend cfg_criteria;\n\npackage body cfg_criteria is\n\nend cfg_criteria;";
-
-    outfile.close();
+    return true;
 }
 
 } // namespace erbium
\ No newline at end of file
@@ -41,26 +41,46 @@ class RuleParser {
                             operand_t* operand_b,
                             const criterionDefinition_s* criterion_def);
 
-    // export benchmark workload based on rules
-    static void export_benchmark_workload(const std::string& path, const rulePack_s& rulepack, const Dictionnary* dic);
-
-    // export criteria parameters for core.vhd
-    static void export_vhdl_parameters(const std::string& filename,
+    // export benchmark workload based on rules (operands are truncated to the fixed width of the
+    // hardware, unless for packed images)
+    static void export_benchmark_workload(const std::string& path,
+                                          const rulePack_s& rulepack,
+                                          const Dictionnary* dic,
+                                          const uint32_t& image_version = C_IMAGE_VERSION_FIXED);
+    static void export_benchmark_workload(std::ostream* filecsv,
+                                          std::ostream* benchfile,
+                                          const rulePack_s& rulepack,
+                                          const Dictionnary* dic,
+                                          const uint32_t& image_version = C_IMAGE_VERSION_FIXED);
+
+    // engine parameters of a level (functions, match mode, weight), as configured in core.vhd;
+    // strict-match levels need the wildcard ahead of the specific transitions of a fan-out block
+    static image_criterion_s get_level_parameters(const rulePack_s& rulepack,
+                                                  const Dictionnary* dic,
+                                                  const criterionid_t& level,
+                                                  const bool& wildcard_first = true);
+
+    // export criteria parameters for core.vhd; nothing is exported (false) when a level does not
+    // fit into the memory units of the engine (CFG_MEM_MAX_DEPTH) or holds value sets (-u)
+    static bool export_vhdl_parameters(const std::string& filename,
+                                       const rulePack_s& rulepack,
+                                       const Dictionnary* dic,
+                                       const std::vector<uint> edges_per_level,
+                                       const bool& wildcard_first = true);
+    static bool export_vhdl_parameters(std::ostream* stream,
                                        const rulePack_s& rulepack,
                                        const Dictionnary* dic,
-                                       const std::vector<uint> edges_per_level);
+                                       const std::vector<uint> edges_per_level,
+                                       const bool& wildcard_first = true);
 
   private:
     RuleParser();
 
-    static uint16_t get_month_number(const std::string& month_code);
-    static uint32_t full_rata_die_day(const uint16_t& d, uint16_t m, uint16_t y);
-    static operand_t date_check(const uint16_t& d, uint16_t m, uint16_t y);
-
-    static void parse_pairOfDates(const std::string& value, operand_t* operand_a, operand_t* operand_b);
-    static void parse_pairOfFlights(std::string value_raw, operand_t* operand_a, operand_t* operand_b);
-
-    static std::fstream dump_csv_raw_workload(const std::string& filename, const rulePack_s& rulepack, const Dictionnary* dic);
+    static void dump_csv_raw_workload(std::ostream* filecsv,
+                                      std::ostream* benchfile,
+                                      const rulePack_s& rulepack,
+                                      const Dictionnary* dic,
+                                      const operand_t& operand_mask);
 };
 
 } // namespace erbium
@@ -0,0 +1,174 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the 
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "snapshot.h"
+
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace erbium {
+
+snapshot_source_s snapshot_source_s::of(const std::string& filename)
+{
+    snapshot_source_s source = {0, 0};
+    struct stat file_stat;
+    if (stat(filename.c_str(), &file_stat) == 0)
+    {
+        source.size = file_stat.st_size;
+        source.mtime = file_stat.st_mtime;
+    }
+    return source;
+}
+
+void SnapshotWriter::put(const std::string& value)
+{
+    put<uint64_t>(value.size());
+    m_payload.append(value);
+}
+
+void SnapshotWriter::put(const std::vector<std::string>& values)
+{
+    put<uint64_t>(values.size());
+    for (auto& value : values)
+        put(value);
+}
+
+void SnapshotWriter::patch(const size_t& offset, const uint64_t& value)
+{
+    m_payload.replace(offset, sizeof(value), reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+bool SnapshotWriter::save(const std::string& filename,
+                          const snapshot_source_s& rules,
+                          const snapshot_source_s& ruletype) const
+{
+    snapshot_header_s header;
+    memset(&header, 0, sizeof(header));
+    header.magic = C_SNAPSHOT_MAGIC;
+    header.version = C_SNAPSHOT_VERSION;
+    header.header_size = sizeof(header);
+    header.payload_size = m_payload.size();
+    header.checksum = image_checksum(m_payload.data(), m_payload.size());
+    header.rules = rules;
+    header.ruletype = ruletype;
+
+    std::ofstream outfile(filename, std::ios::out | std::ios::trunc | std::ios::binary);
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outfile.write(m_payload.data(), m_payload.size());
+    outfile.close();
+    return !outfile.fail();
+}
+
+bool SnapshotReader::open(const std::string& filename)
+{
+    close();
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(snapshot_header_s))
+    {
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+    m_mapping_size = file_stat.st_size;
+    m_mapping = mmap(NULL, m_mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m_mapping == MAP_FAILED)
+    {
+        m_mapping = NULL;
+        log_printf("[!] Failed to map snapshot %s\n", filename.c_str());
+        return false;
+    }
+    madvise(m_mapping, m_mapping_size, MADV_SEQUENTIAL);
+
+    memcpy(&m_header, m_mapping, sizeof(m_header));
+    if (m_header.magic != C_SNAPSHOT_MAGIC)
+        log_printf("[!] %s is not an erbium snapshot\n", filename.c_str());
+    else if (m_header.version != C_SNAPSHOT_VERSION)
+        log_printf("[!] Snapshot %s has version %u (expected %u)\n",
+            filename.c_str(), m_header.version, C_SNAPSHOT_VERSION);
+    else if (m_header.header_size < sizeof(m_header)
+             || m_header.payload_size != m_mapping_size - m_header.header_size)
+        log_printf("[!] Snapshot %s is truncated\n", filename.c_str());
+    else
+    {
+        m_data = (const char*)m_mapping + m_header.header_size;
+        m_size = m_header.payload_size;
+        if (image_checksum(m_data, m_size) == m_header.checksum)
+            return true;
+        log_printf("[!] Snapshot %s fails its checksum\n", filename.c_str());
+    }
+    close();
+    return false;
+}
+
+void SnapshotReader::close()
+{
+    if (m_mapping != NULL)
+        munmap(m_mapping, m_mapping_size);
+    m_mapping = NULL;
+    m_mapping_size = 0;
+    m_data = NULL;
+    m_size = 0;
+    m_cursor = 0;
+    m_failed = false;
+}
+
+bool SnapshotReader::take(const uint64_t& size)
+{
+    if (m_failed || size > m_size - m_cursor)
+    {
+        m_failed = true;
+        return false;
+    }
+    m_cursor += size;
+    return true;
+}
+
+void SnapshotReader::get(std::string* value)
+{
+    uint64_t size;
+    get(&size);
+    if (!take(size))
+    {
+        value->clear();
+        return;
+    }
+    value->assign(m_data + m_cursor - size, size);
+}
+
+void SnapshotReader::get(std::vector<std::string>* values)
+{
+    uint64_t count;
+    get(&count);
+    values->clear();
+    for (uint64_t i = 0; i < count && !m_failed; i++)
+    {
+        values->emplace_back();
+        get(&values->back());
+    }
+}
+
+} // namespace erbium
@@ -0,0 +1,158 @@
+#ifndef ERBIUM_SNAPSHOT_H
+#define ERBIUM_SNAPSHOT_H
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the 
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <type_traits>
+
+#include "definitions.h"
+
+namespace erbium {
+
+// binary snapshot of parsed rule packs (and of their initial dictionnaries), mapped in memory on
+// load so that later compiles skip the XML and CSV parsing: a header, then every field in
+// declaration order, vectors and strings being prefixed by their element count
+const uint32_t C_SNAPSHOT_MAGIC   = 0x53425245; // "ERBS"
+const uint16_t C_SNAPSHOT_VERSION = 1;
+
+// size and modification time of a source file, to tell a stale snapshot (zeros when unknown)
+struct snapshot_source_s
+{
+    uint64_t size;
+    int64_t  mtime;
+
+    static snapshot_source_s of(const std::string& filename);
+    bool known() const { return size != 0 || mtime != 0; }
+    bool operator == (const snapshot_source_s& other) const
+        { return size == other.size && mtime == other.mtime; }
+};
+
+struct snapshot_header_s
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;    // in bytes, the payload follows
+    uint64_t payload_size;   // in bytes
+    uint64_t checksum;       // image_checksum of the payload
+    snapshot_source_s rules;    // source files of the first rule pack
+    snapshot_source_s ruletype;
+};
+static_assert(sizeof(snapshot_header_s) == 56, "Snapshot header must keep its on-disk layout.");
+
+class SnapshotWriter
+{
+  public:
+    template <typename T>
+    void put(const T& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain fields are written as is.");
+        m_payload.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    template <typename T>
+    void put(const std::vector<T>& values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain fields are written as is.");
+        put<uint64_t>(values.size());
+        m_payload.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+    void put(const std::string& value);
+    void put(const std::vector<std::string>& values);
+
+    // current payload size, to patch a section length afterwards
+    size_t tell() const { return m_payload.size(); }
+    void patch(const size_t& offset, const uint64_t& value);
+
+    // writes the header and the payload; false on failure
+    bool save(const std::string& filename,
+              const snapshot_source_s& rules,
+              const snapshot_source_s& ruletype) const;
+
+  private:
+    std::string m_payload;
+};
+
+class SnapshotReader
+{
+  public:
+    SnapshotReader() : m_data(NULL), m_size(0), m_cursor(0), m_failed(false),
+                       m_mapping(NULL), m_mapping_size(0) {}
+    ~SnapshotReader() { close(); }
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+    // maps the file and checks its header and checksum; false (with a message) otherwise
+    bool open(const std::string& filename);
+    void close();
+
+    template <typename T>
+    void get(T* value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain fields are read as is.");
+        if (!take(sizeof(T)))
+        {
+            memset(value, 0, sizeof(T));
+            return;
+        }
+        memcpy(value, m_data + m_cursor - sizeof(T), sizeof(T));
+    }
+    template <typename T>
+    void get(std::vector<T>* values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain fields are read as is.");
+        uint64_t count;
+        get(&count);
+        if (m_failed || count > (m_size - m_cursor) / sizeof(T) || !take(count * sizeof(T)))
+        {
+            m_failed = true;
+            values->clear();
+            return;
+        }
+        values->resize(count);
+        memcpy(values->data(), m_data + m_cursor - count * sizeof(T), count * sizeof(T));
+    }
+    void get(std::string* value);
+    void get(std::vector<std::string>* values);
+    void skip(const uint64_t& size) { take(size); }
+
+    // false once a field was read beyond the payload
+    bool good() const { return !m_failed; }
+    bool at_end() const { return m_cursor == m_size; }
+    const snapshot_header_s& header() const { return m_header; }
+
+  private:
+    const char*       m_data;   // payload (within the mapping)
+    size_t            m_size;   // payload size
+    size_t            m_cursor;
+    bool              m_failed;
+    void*             m_mapping;
+    size_t            m_mapping_size;
+    snapshot_header_s m_header;
+
+    bool take(const uint64_t& size);
+};
+
+} // namespace erbium
+
+#endif // ERBIUM_SNAPSHOT_H
@@ -0,0 +1,513 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the 
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "sorting_optimiser.h"
+#include "dictionnary.h"
+#include "rule_parser.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>                  // file read/write
+#include <sstream>
+#include <iostream>                 // std::endl
+#include <random>                   // std::mt19937
+#include <unordered_map>
+#include <omp.h>                    // openmp
+
+namespace erbium {
+
+SortingOptimiser::SortingOptimiser(const rulePack_s& rulepack, const Dictionnary* dic) :
+    m_estimator(rulepack, dic)
+{
+    m_n_rules = rulepack.m_rules.size();
+    m_n_criteria = rulepack.m_ruleType.m_criterionDefinition.size();
+    m_values.resize(m_n_criteria, std::vector<operand_t>(m_n_rules));
+    m_operands.resize(m_n_criteria);
+    m_definitions.resize(m_n_criteria);
+    m_mandatory.resize(m_n_criteria, false);
+
+    for (auto& aux : rulepack.m_ruleType.m_criterionDefinition)
+    {
+        m_definitions[aux.m_index] = &aux;
+        m_mandatory[aux.m_index] = aux.m_isMandatory;
+    }
+
+    // value ids of the rule store columns
+    const ruleStore_s& rules = rulepack.m_rules;
+    uint32_t rule_id;
+    operand_t value_id;
+    for (criterionid_t criterion = 0; criterion < m_n_criteria; criterion++)
+    {
+        // operands as dumped into the NFA transitions, parsed once per pooled value
+        std::vector<bool> parsed(rules.m_pools[criterion].size(), false);
+        for (rule_id = 0; rule_id < m_n_rules; rule_id++)
+        {
+            const operand_t code = rules.get_code(rule_id, criterion);
+            value_id = dic->get_valueid_by_code(criterion, code);
+            m_values[criterion][rule_id] = value_id;
+            if (parsed[code])
+                continue;
+            parsed[code] = true;
+
+            if (value_id >= m_operands[criterion].size())
+                m_operands[criterion].resize(value_id + 1);
+            RuleParser::parse_value(rules.m_pools[criterion][code], value_id,
+                                    &m_operands[criterion][value_id].first,
+                                    &m_operands[criterion][value_id].second,
+                                    m_definitions[criterion]);
+        }
+    }
+
+    // rules evenly spread over the rule pack are replayed as queries (as in benchmark.bin)
+    const uint32_t step = std::max((uint32_t)1, m_n_rules / C_SAMPLE_QUERIES);
+    for (rule_id = 0; rule_id < m_n_rules; rule_id += step)
+    {
+        std::vector<operand_t> query(m_n_criteria);
+        for (criterionid_t criterion = 0; criterion < m_n_criteria; criterion++)
+            query[criterion] = m_operands[criterion][m_values[criterion][rule_id]].first & MASK_OPERANDS;
+        m_queries.push_back(query);
+    }
+}
+
+bool SortingOptimiser::load_workload(const std::string& filename, const rulePack_s& rulepack)
+{
+    std::ifstream benchfile(filename, std::ios::in | std::ios::binary);
+    if (!benchfile.is_open())
+        return false;
+
+    uint32_t query_size;
+    uint32_t benchmark_size;
+    benchfile.read(reinterpret_cast<char *>(&query_size), sizeof(query_size));
+    benchfile.read(reinterpret_cast<char *>(&benchmark_size), sizeof(benchmark_size));
+    if (!benchfile || query_size < m_n_criteria * sizeof(operand_t))
+        return false;
+
+    // column order: "ID,WEIGHT,<criterion codes>,CONTENT"
+    sorting_map_t columns;
+    std::ifstream filecsv(filename.substr(0, filename.rfind('.')) + ".csv");
+    std::string line;
+    std::string cell;
+    if (std::getline(filecsv, line))
+    {
+        std::stringstream header(line);
+        ruleType_s ruletype = rulepack.m_ruleType;
+        int criterion_id;
+        while (std::getline(header, cell, ','))
+        {
+            criterion_id = ruletype.get_criterion_id(cell);
+            if (criterion_id >= 0)
+                columns.push_back(criterion_id);
+        }
+    }
+    if (columns.size() != m_n_criteria)
+    {
+        log_printf("[!] No column order found for %s, assuming criterion id order\n", filename.c_str());
+        columns.clear();
+        for (criterionid_t criterion = 0; criterion < m_n_criteria; criterion++)
+            columns.push_back(criterion);
+    }
+
+    // queries evenly spread over the workload
+    const uint32_t step = std::max((uint32_t)1, benchmark_size / C_SAMPLE_QUERIES);
+    std::vector<operand_t> raw_query(query_size / sizeof(operand_t));
+    m_queries.clear();
+    for (uint32_t query_id = 0; query_id < benchmark_size; query_id += step)
+    {
+        benchfile.seekg(2 * sizeof(uint32_t) + (uint64_t)query_id * query_size, std::ios::beg);
+        benchfile.read(reinterpret_cast<char *>(raw_query.data()), query_size);
+        if (!benchfile)
+            break;
+
+        std::vector<operand_t> query(m_n_criteria);
+        for (criterionid_t pos = 0; pos < m_n_criteria; pos++)
+            query[columns[pos]] = raw_query[pos];
+        m_queries.push_back(query);
+    }
+    return !m_queries.empty();
+}
+
+bool SortingOptimiser::match(const criterionid_t& criterion,
+                             const operand_t& value_id,
+                             const operand_t& query) const
+{
+    // same semantics as the engine matcher (wildcards are encoded as 0 when enabled)
+    const operand_t operand_a = m_operands[criterion][value_id].first & MASK_OPERANDS;
+    const operand_t operand_b = m_operands[criterion][value_id].second & MASK_OPERANDS;
+    const bool wildcard = !m_mandatory[criterion];
+
+    if (!m_definitions[criterion]->m_isPair)
+        return (query == operand_a) || (wildcard && operand_a == 0);
+
+    return ((query >= operand_a) || (wildcard && operand_a == 0))
+        && ((query <= operand_b) || (wildcard && operand_b == 0));
+}
+
+bool SortingOptimiser::is_wildcard(const criterionid_t& criterion, const operand_t& value_id) const
+{
+    return !m_mandatory[criterion] && (m_operands[criterion][value_id].first & MASK_OPERANDS) == 0;
+}
+
+void SortingOptimiser::build_prefix_tree(const sorting_map_t& order, prefix_tree_s* tree) const
+{
+    const uint16_t n_levels = order.size();
+
+    // per level > per state > parent state and value_id
+    std::vector<std::vector<uint32_t>> parent_of(n_levels);
+    tree->value_of.assign(n_levels, std::vector<operand_t>());
+    std::vector<uint32_t> prefix(m_n_rules, 0); // current state of each rule
+    std::unordered_map<uint64_t, uint32_t> states;
+    uint32_t n_parents = 1;
+
+    for (uint16_t level = 0; level < n_levels; level++)
+    {
+        const std::vector<operand_t>& column = m_values[order[level]];
+        states.clear();
+        states.reserve(n_parents * 2);
+        for (uint32_t rule_id = 0; rule_id < m_n_rules; rule_id++)
+        {
+            const uint64_t key = ((uint64_t)prefix[rule_id] << (sizeof(operand_t) * 8)) | column[rule_id];
+            auto aux = states.emplace(key, (uint32_t)states.size());
+            if (aux.second)
+            {
+                parent_of[level].push_back(prefix[rule_id]);
+                tree->value_of[level].push_back(column[rule_id]);
+            }
+            prefix[rule_id] = aux.first->second;
+        }
+        n_parents = states.size();
+    }
+
+    // children of each state, grouped by parent (CSR)
+    tree->first_child.assign(n_levels, std::vector<uint32_t>());
+    tree->children.assign(n_levels, std::vector<uint32_t>());
+    uint32_t n_states = 1;
+    for (uint16_t level = 0; level < n_levels; level++)
+    {
+        std::vector<uint32_t>& first_child = tree->first_child[level];
+        first_child.assign(n_states + 1, 0);
+        for (auto& parent : parent_of[level])
+            first_child[parent + 1]++;
+        for (uint32_t i = 0; i < n_states; i++)
+            first_child[i + 1] += first_child[i];
+
+        std::vector<uint32_t> fill(first_child.begin(), first_child.end() - 1);
+        tree->children[level].resize(parent_of[level].size());
+        for (uint32_t child = 0; child < parent_of[level].size(); child++)
+            tree->children[level][fill[parent_of[level][child]]++] = child;
+        n_states = parent_of[level].size();
+    }
+}
+
+SortingOptimiser::cost_s SortingOptimiser::evaluate(const sorting_map_t& order) const
+{
+    cost_s cost;
+    const uint16_t n_levels = order.size();
+
+    prefix_tree_s tree;
+    build_prefix_tree(order, &tree);
+    const auto& value_of = tree.value_of;
+    const auto& first_child = tree.first_child;
+    const auto& children = tree.children;
+    for (uint16_t level = 0; level < n_levels; level++)
+        cost.transitions_per_level.push_back(value_of[level].size());
+
+    // replay the queries: every transition of an active state is scanned
+    std::vector<uint64_t> n_visited(m_queries.size(), 0);
+    std::vector<std::pair<uint16_t, uint32_t>> stack; // <level, state>
+    for (uint32_t query_id = 0; query_id < m_queries.size(); query_id++)
+    {
+        stack.push_back(std::make_pair(0, 0));
+        while (!stack.empty())
+        {
+            const uint16_t level = stack.back().first;
+            const uint32_t state = stack.back().second;
+            stack.pop_back();
+
+            const criterionid_t criterion = order[level];
+            const operand_t query = m_queries[query_id][criterion];
+            n_visited[query_id] += first_child[level][state + 1] - first_child[level][state];
+            if (level + 1 == n_levels)
+                continue;
+
+            for (uint32_t i = first_child[level][state]; i < first_child[level][state + 1]; i++)
+            {
+                if (match(criterion, value_of[level][children[level][i]], query))
+                    stack.push_back(std::make_pair(level + 1, children[level][i]));
+            }
+        }
+    }
+
+    cost.visited = 0;
+    cost.visited_p99 = 0;
+    if (!n_visited.empty())
+    {
+        for (auto& aux : n_visited)
+            cost.visited += aux;
+        cost.visited /= n_visited.size();
+
+        std::sort(n_visited.begin(), n_visited.end());
+        cost.visited_p99 = n_visited[(n_visited.size() - 1) * 99 / 100];
+    }
+
+    // memory of a complete order is the suffix-reduced NFA; partial orders keep the prefix tree
+    if (n_levels == m_n_criteria)
+    {
+        const auto estimate = m_estimator.estimate(order);
+        cost.transitions_per_level.assign(estimate.transitions_per_level.begin(),
+                                          estimate.transitions_per_level.begin() + n_levels);
+    }
+
+    // memory constraints
+    uint64_t n_transitions = 0;
+    cost.max_transitions = 0;
+    cost.infeasible_levels = 0;
+    for (auto& transitions : cost.transitions_per_level)
+    {
+        n_transitions += transitions;
+        cost.max_transitions = std::max(cost.max_transitions, transitions);
+        if (transitions > CFG_MEM_MAX_DEPTH)
+            cost.infeasible_levels++;
+    }
+
+    cost.total = cost.visited
+               + C_COST_TAIL * cost.visited_p99
+               + C_COST_TRANSITIONS * n_transitions / std::max((uint32_t)1, m_n_rules)
+               + C_COST_INFEASIBLE * cost.infeasible_levels;
+    return cost;
+}
+
+double SortingOptimiser::cost_of(const sorting_map_t& order) const
+{
+    return evaluate(order).total;
+}
+
+bool SortingOptimiser::is_valid(const sorting_map_t& order) const
+{
+    // the first criterion is looked up by value, so it cannot hold wildcards
+    bool has_mandatory = false;
+    for (auto aux : m_mandatory)
+        has_mandatory = has_mandatory || aux;
+    return order.empty() || !has_mandatory || m_mandatory[order[0]];
+}
+
+sorting_map_t SortingOptimiser::optimise(const uint32_t& iterations, const uint32_t& seed)
+{
+    ////// GREEDY: append the criterion with the lowest partial cost
+    sorting_map_t order;
+    std::vector<bool> used(m_n_criteria, false);
+    for (uint16_t pos = 0; pos < m_n_criteria; pos++)
+    {
+        std::vector<double> candidates(m_n_criteria, INFINITY);
+
+        #pragma omp parallel for
+        for (criterionid_t criterion = 0; criterion < m_n_criteria; criterion++)
+        {
+            if (used[criterion])
+                continue;
+            sorting_map_t aux = order;
+            aux.push_back(criterion);
+            if (is_valid(aux))
+                candidates[criterion] = cost_of(aux);
+        }
+
+        criterionid_t best = 0;
+        for (criterionid_t criterion = 1; criterion < m_n_criteria; criterion++)
+        {
+            if (candidates[criterion] < candidates[best])
+                best = criterion;
+        }
+        order.push_back(best);
+        used[best] = true;
+    }
+
+    double current_cost = cost_of(order);
+    log_stream() << "greedy cost: " << current_cost << std::endl;
+
+    ////// SIMULATED ANNEALING: swap two positions
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<uint16_t> position(0, m_n_criteria - 1);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    sorting_map_t best_order = order;
+    double best_cost = current_cost;
+    double temperature = 0.1 * current_cost;
+    const double cooling = (iterations == 0) ? 1 : pow(1e-3, 1.0 / iterations);
+
+    for (uint32_t it = 0; it < iterations && m_n_criteria > 1; it++, temperature *= cooling)
+    {
+        const uint16_t a = position(rng);
+        const uint16_t b = position(rng);
+        if (a == b)
+            continue;
+
+        std::swap(order[a], order[b]);
+        if (!is_valid(order))
+        {
+            std::swap(order[a], order[b]);
+            continue;
+        }
+
+        const double cost = cost_of(order);
+        if (cost < current_cost || chance(rng) < exp((current_cost - cost) / temperature))
+        {
+            current_cost = cost;
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_order = order;
+            }
+        }
+        else
+            std::swap(order[a], order[b]);
+    }
+    log_stream() << "annealing cost: " << best_cost << " (" << iterations << " iterations)" << std::endl;
+
+    return best_order;
+}
+
+value_frequencies_t SortingOptimiser::get_value_frequencies() const
+{
+    value_frequencies_t frequencies(m_n_criteria);
+    std::vector<uint32_t> hits_per_operand(MASK_OPERANDS + 1);
+
+    for (criterionid_t criterion = 0; criterion < m_n_criteria; criterion++)
+    {
+        frequencies[criterion].assign(m_operands[criterion].size(), 0);
+
+        // pair criteria are fully iterated, their layout does not matter
+        if (m_definitions[criterion]->m_isPair)
+            continue;
+
+        std::fill(hits_per_operand.begin(), hits_per_operand.end(), 0);
+        for (auto& query : m_queries)
+            hits_per_operand[query[criterion] & MASK_OPERANDS]++;
+
+        for (operand_t value_id = 0; value_id < m_operands[criterion].size(); value_id++)
+        {
+            if (is_wildcard(criterion, value_id))
+                frequencies[criterion][value_id] = m_queries.size();
+            else
+                frequencies[criterion][value_id] =
+                    hits_per_operand[m_operands[criterion][value_id].first & MASK_OPERANDS];
+        }
+    }
+    return frequencies;
+}
+
+double SortingOptimiser::get_scanned_transitions(const sorting_map_t& order,
+                                                 const value_frequencies_t* frequencies,
+                                                 const WildcardPolicy& policy) const
+{
+    const uint16_t n_levels = order.size();
+    prefix_tree_s tree;
+    build_prefix_tree(order, &tree);
+
+    // lay out each fan-out block as the memory dump would (the origin is looked up by value)
+    for (uint16_t level = 1; level < n_levels; level++)
+    {
+        const criterionid_t criterion = order[level];
+        const auto& value_of = tree.value_of[level];
+        auto hotter = [&](const uint32_t& a, const uint32_t& b) {
+            const operand_t va = value_of[a];
+            const operand_t vb = value_of[b];
+            if (frequencies == NULL || m_definitions[criterion]->m_isPair)
+                return va < vb;
+            if (policy != WildcardByFrequency && is_wildcard(criterion, va) != is_wildcard(criterion, vb))
+                return is_wildcard(criterion, va) == (policy == WildcardFirst);
+            if ((*frequencies)[criterion][va] != (*frequencies)[criterion][vb])
+                return (*frequencies)[criterion][va] > (*frequencies)[criterion][vb];
+            return va < vb;
+        };
+        for (uint32_t state = 0; state + 1 < tree.first_child[level].size(); state++)
+            std::sort(tree.children[level].begin() + tree.first_child[level][state],
+                      tree.children[level].begin() + tree.first_child[level][state + 1],
+                      hotter);
+    }
+
+    // strict match stops at the first specific match (and, on value-sorted blocks, as soon as the
+    // operand exceeds the query); a wildcard edge has to be scanned before stopping
+    uint64_t n_scanned = 0;
+    std::vector<std::pair<uint16_t, uint32_t>> stack; // <level, state>
+    for (auto& query : m_queries)
+    {
+        stack.push_back(std::make_pair(0, 0));
+        while (!stack.empty())
+        {
+            const uint16_t level = stack.back().first;
+            const uint32_t state = stack.back().second;
+            stack.pop_back();
+
+            const criterionid_t criterion = order[level];
+            const operand_t value = query[criterion];
+            const uint32_t first = tree.first_child[level][state];
+            const uint32_t last = tree.first_child[level][state + 1];
+
+            bool has_wildcard = false;
+            for (uint32_t i = first; i < last && !has_wildcard; i++)
+                has_wildcard = is_wildcard(criterion, tree.value_of[level][tree.children[level][i]]);
+
+            bool stopped = (level == 0);
+            bool found = false;
+            bool seen_wildcard = false;
+            if (level == 0)
+                n_scanned++;
+            for (uint32_t i = first; i < last; i++)
+            {
+                const uint32_t child = tree.children[level][i];
+                const operand_t value_id = tree.value_of[level][child];
+                const bool wildcard = is_wildcard(criterion, value_id);
+                const bool matched = match(criterion, value_id, value);
+
+                if (matched && level + 1 < n_levels)
+                    stack.push_back(std::make_pair(level + 1, child));
+                if (stopped)
+                    continue;
+
+                n_scanned++;
+                if (m_definitions[criterion]->m_isPair)
+                    continue;
+                seen_wildcard = seen_wildcard || wildcard;
+                found = found || (matched && !wildcard);
+                if (found && (seen_wildcard || !has_wildcard))
+                    stopped = true;
+                else if (frequencies == NULL && !wildcard
+                         && (m_operands[criterion][value_id].first & MASK_OPERANDS) > value)
+                    stopped = true;
+            }
+        }
+    }
+    return (m_queries.empty()) ? 0 : (double)n_scanned / m_queries.size();
+}
+
+void SortingOptimiser::print_cost(const cost_s& cost) const
+{
+    criterionid_t level = 0;
+    for (auto& transitions : cost.transitions_per_level)
+        log_printf("level %2u: %7u transitions\n", level++, transitions);
+    log_printf("max transitions per level: %u (%u levels above %u)\n",
+        cost.max_transitions, cost.infeasible_levels, CFG_MEM_MAX_DEPTH);
+    log_printf("visited transitions per query: %.2f average; %.0f p99 (%lu queries)\n",
+        cost.visited, cost.visited_p99, m_queries.size());
+    log_printf("total cost: %.2f\n", cost.total);
+}
+
+} // namespace erbium
@@ -0,0 +1,105 @@
+#ifndef ERBIUM_SORTING_OPTIMISER_H
+#define ERBIUM_SORTING_OPTIMISER_H
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the 
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <vector>
+
+#include "definitions.h"
+#include "nfa_estimator.h"
+
+namespace erbium {
+
+class Dictionnary;
+
+class SortingOptimiser
+{
+  public:
+    struct cost_s
+    {
+        std::vector<uint> transitions_per_level; // memory transitions per criterion level (suffix-reduced once complete)
+        uint   max_transitions;                  // largest per-level memory
+        uint   infeasible_levels;                // levels exceeding CFG_MEM_MAX_DEPTH
+        double visited;                          // average transitions visited per query
+        double visited_p99;                      // 99th percentile of visited transitions
+        double total;                            // weighted cost to be minimised
+    };
+
+    SortingOptimiser(const rulePack_s& rulepack, const Dictionnary* dic);
+
+    // replaces the replayed rules by encoded queries from a benchmark.bin file; the column order
+    // is taken from the companion benchmark.csv header (criterion id order if absent)
+    bool load_workload(const std::string& filename, const rulePack_s& rulepack);
+
+    // cost model of a (possibly partial) criteria order
+    cost_s evaluate(const sorting_map_t& order) const;
+
+    // greedy construction refined by simulated annealing over position swaps
+    sorting_map_t optimise(const uint32_t& iterations, const uint32_t& seed = 0);
+
+    void print_cost(const cost_s& cost) const;
+
+    // per value hits of the replayed queries (simple criteria only; wildcards match every query)
+    value_frequencies_t get_value_frequencies() const;
+
+    // average transitions scanned per query by strict-match levels, for value-sorted fan-out
+    // blocks (frequencies = NULL) or for blocks laid out hottest first
+    double get_scanned_transitions(const sorting_map_t& order,
+                                   const value_frequencies_t* frequencies = NULL,
+                                   const WildcardPolicy& policy = WildcardFirst) const;
+
+  private:
+    struct prefix_tree_s
+    {
+        std::vector<std::vector<operand_t>> value_of;    // per level > per state > value_id
+        std::vector<std::vector<uint32_t>>  first_child; // per level > per parent state (CSR)
+        std::vector<std::vector<uint32_t>>  children;    // per level > children grouped by parent
+    };
+
+    // relative weight of memory transitions (per rule) against visited transitions (per query)
+    const double C_COST_TRANSITIONS = 1.0;
+    // relative weight of the tail (p99) against the average visited transitions
+    const double C_COST_TAIL = 1.0;
+    // penalty for each level not fitting into one memory unit
+    const double C_COST_INFEASIBLE  = 1e9;
+    // number of queries replayed to estimate the visited transitions
+    const uint32_t C_SAMPLE_QUERIES = 1024;
+
+    NfaEstimator m_estimator;
+    uint32_t m_n_rules;
+    uint16_t m_n_criteria;
+    std::vector<std::vector<operand_t>> m_values;   // per criterion_id > per rule > value_id
+    std::vector<std::vector<std::pair<operand_t, operand_t>>> m_operands; // per criterion_id > per value_id > (a, b)
+    std::vector<const criterionDefinition_s*> m_definitions;
+    std::vector<bool>                   m_mandatory;
+    std::vector<std::vector<operand_t>> m_queries;  // per query > per criterion_id > operand
+
+    void build_prefix_tree(const sorting_map_t& order, prefix_tree_s* tree) const;
+    double cost_of(const sorting_map_t& order) const;
+    bool is_wildcard(const criterionid_t& criterion, const operand_t& value_id) const;
+    bool match(const criterionid_t& criterion, const operand_t& value_id, const operand_t& query) const;
+    bool is_valid(const sorting_map_t& order) const;
+};
+
+} // namespace erbium
+
+#endif // ERBIUM_SORTING_OPTIMISER_H
@@ -0,0 +1,226 @@
+#ifndef ERBIUM_VALUE_PARSERS_H
+#define ERBIUM_VALUE_PARSERS_H
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ERBium - Business Rule Engine Hardware Accelerator
+//  Copyright (C) 2020 Fabio Maschi - Systems Group, ETH Zurich
+
+//  This program is free software: you can redistribute it and/or modify it under the terms of the
+//  GNU Affero General Public License as published by the Free Software Foundation, either version 3
+//  of the License, or (at your option) any later version.
+
+//  This software is provided by the copyright holders and contributors "AS IS" and any express or
+//  implied warranties, including, but not limited to, the implied warranties of merchantability and
+//  fitness for a particular purpose are disclaimed. In no event shall the copyright holder or
+//  contributors be liable for any direct, indirect, incidental, special, exemplary, or
+//  consequential damages (including, but not limited to, procurement of substitute goods or
+//  services; loss of use, data, or profits; or business interruption) however caused and on any
+//  theory of liability, whether in contract, strict liability, or tort (including negligence or
+//  otherwise) arising in any way out of the use of this software, even if advised of the
+//  possibility of such damage. See the GNU Affero General Public License for more details.
+
+//  You should have received a copy of the GNU Affero General Public License along with this
+//  program. If not, see <http://www.gnu.org/licenses/agpl-3.0.en.html>.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Raw values of the pair criteria (dates, flight ranges) to their operands. Header-only and C++11,
+// as it is shared by the NFA compiler (RuleParser) and the query encoder of the CPU engine: the
+// parsers neither allocate nor look anything up but constexpr tables.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace erbium {
+namespace parsers {
+
+enum parse_status_e {
+    PARSE_OK,
+    PARSE_CLAMPED,  // out of the operand range, saturated
+    PARSE_MALFORMED // operands are left untouched
+};
+
+// operands of a raw value (e.g. both bounds of a pair of dates)
+typedef parse_status_e (*value_parser_t)(const char* value, const size_t& length,
+                                         uint16_t* operand_a, uint16_t* operand_b);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// DATES                                                                                          //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*  0       wildcard '*': it matches anything
+ *  1       infinity down   e.g. 1st Jan 1990
+ *  2       start date      e.g. 1st Jan 2006
+ *  ...
+ *  2^W-2   end date        13 bits: 2nd Jun 2028, 14 bits: 6th Nov 2050
+ *  2^W-1   infinity up     e.g. 1st Jan 9999 (any operand past the width, once truncated)
+ */
+const uint16_t C_DATE_OPERAND_WIDTH = 13; // CFG_CRITERION_VALUE_WIDTH, in bits
+
+// full Rata Die days (day one is 0001-01-01)
+const uint32_t C_DAY_INFINITY_DOWN =  726468; // 1st Jan 1990
+const uint32_t C_DAY_FIRST         =  732312; // 1st Jan 2006
+const uint32_t C_DAY_LAST          = C_DAY_FIRST + (1 << C_DATE_OPERAND_WIDTH) - 2;
+const uint32_t C_DAY_INFINITY_UP   = 3651695; // 1st Jan 9999
+
+// years starting in March, so that the leap day is the last one
+constexpr uint32_t rata_die_march(const uint32_t d, const uint32_t m, const uint32_t y)
+{
+    return 365*y + y/4 - y/100 + y/400 + (153*m - 457)/5 + d - 306;
+}
+
+constexpr uint32_t full_rata_die_day(const uint32_t d, const uint32_t m, const uint32_t y)
+{
+    return rata_die_march(d, m + 12 * (m < 3), y - (m < 3));
+}
+
+static_assert(full_rata_die_day(1, 1, 1990) == C_DAY_INFINITY_DOWN, "Rata Die of 1st Jan 1990");
+static_assert(full_rata_die_day(1, 1, 2006) == C_DAY_FIRST,         "Rata Die of 1st Jan 2006");
+static_assert(full_rata_die_day(1, 1, 9999) == C_DAY_INFINITY_UP,   "Rata Die of 1st Jan 9999");
+
+// three letters, little-endian
+constexpr uint32_t month_key(const char* code)
+{
+    return (uint32_t)(uint8_t)code[0] | ((uint32_t)(uint8_t)code[1] << 8) | ((uint32_t)(uint8_t)code[2] << 16);
+}
+
+// slot of a month key in C_MONTH_SLOTS (multiplicative hash, collision-free on the 12 codes)
+constexpr uint32_t month_slot(const uint32_t key)
+{
+    return (uint32_t)(key * 0x67d0u) >> 28;
+}
+
+// key of each month number (0: none)
+constexpr uint32_t C_MONTH_KEYS[13] = {
+    0,
+    month_key("JAN"), month_key("FEB"), month_key("MAR"), month_key("APR"),
+    month_key("MAY"), month_key("JUN"), month_key("JUL"), month_key("AUG"),
+    month_key("SEP"), month_key("OCT"), month_key("NOV"), month_key("DEC")
+};
+
+// month number of each slot (0: none)
+constexpr uint8_t C_MONTH_SLOTS[16] = {
+    11, 0, 10, 5, 12, 3, 4, 0, 9, 0, 0, 1, 6, 2, 8, 7
+};
+
+constexpr bool month_slots_check(const uint32_t month)
+{
+    return month > 12 || (C_MONTH_SLOTS[month_slot(C_MONTH_KEYS[month])] == month && month_slots_check(month + 1));
+}
+
+static_assert(month_slots_check(1), "C_MONTH_SLOTS must map every month code to its number");
+
+// JAN..DEC to 1..12, anything else to 0
+inline uint16_t month_number(const char* code)
+{
+    const uint32_t key = month_key(code);
+    const uint16_t month = C_MONTH_SLOTS[month_slot(key)];
+    return (C_MONTH_KEYS[month] == key) ? month : 0;
+}
+
+// operand of a full Rata Die day
+inline parse_status_e day_operand(const uint32_t& day, uint16_t* operand)
+{
+    const bool below = (day < C_DAY_FIRST);
+    const bool above = (day > C_DAY_LAST);
+    *operand = (below) ? 1 : (above) ? UINT16_MAX : day - C_DAY_FIRST + 2;
+    return ((below && day != C_DAY_INFINITY_DOWN) || (above && day != C_DAY_INFINITY_UP))
+        ? PARSE_CLAMPED : PARSE_OK;
+}
+
+// positions of the day and year digits in DDMMMYYYY
+constexpr uint8_t C_DATE_DIGITS[6] = { 0, 1, 5, 6, 7, 8 };
+
+// DDMMMYYYY (e.g. 08AUG2008)
+inline parse_status_e parse_date(const char* value, uint16_t* operand)
+{
+    uint32_t digits[6];
+    uint32_t invalid = 0;
+    for (uint32_t i = 0; i < 6; i++)
+    {
+        digits[i] = (uint8_t)value[C_DATE_DIGITS[i]] - '0';
+        invalid |= (digits[i] > 9);
+    }
+    const uint32_t m = month_number(value + 2);
+    if (invalid || m == 0)
+        return PARSE_MALFORMED;
+
+    const uint32_t d = digits[0] * 10 + digits[1];
+    const uint32_t y = digits[2] * 1000 + digits[3] * 100 + digits[4] * 10 + digits[5];
+    return day_operand(full_rata_die_day(d, m, y), operand);
+}
+
+// DDMMMYYYY-DDMMMYYYY (e.g. 08AUG2008-16SEP2012), or a single date as a one-day pair
+inline parse_status_e parse_pair_of_dates(const char* value, const size_t& length,
+                                          uint16_t* operand_a, uint16_t* operand_b)
+{
+    if (length != 9 && length != 19)
+        return PARSE_MALFORMED;
+    uint16_t first, last;
+    const parse_status_e status_a = parse_date(value, &first);
+    const parse_status_e status_b = (length == 9) ? status_a : parse_date(value + 10, &last);
+    if (status_a == PARSE_MALFORMED || status_b == PARSE_MALFORMED)
+        return PARSE_MALFORMED;
+    *operand_a = first;
+    *operand_b = (length == 9) ? first : last;
+    return (status_a > status_b) ? status_a : status_b;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// INTEGER RANGES                                                                                 //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// NNNN/NNNN (e.g. a 1000/1999 range of flight numbers), or a single number with 0 as second one
+inline parse_status_e parse_integer_range(const char* value, const size_t& length,
+                                          uint16_t* operand_a, uint16_t* operand_b)
+{
+    uint32_t numbers[2] = {0, 0};
+    size_t i = 0;
+    for (uint32_t n = 0; n < 2; n++)
+    {
+        while (i < length && (value[i] == '/' || value[i] == ' '))
+            i++;
+        const size_t first = i;
+        for (uint32_t digit; i < length && (digit = (uint8_t)value[i] - '0') < 10; i++)
+            numbers[n] = numbers[n] * 10 + digit;
+        if (n == 0 && i == first)
+            return PARSE_MALFORMED;
+    }
+    if (i != length)
+        return PARSE_MALFORMED;
+    *operand_a = numbers[0];
+    *operand_b = numbers[1];
+    return PARSE_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// FUNCTOR REGISTRY                                                                               //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct value_functor_s {
+    uint16_t       functor; // m_functor of the rule type
+    const char*    type;    // criterionType_<type>.xml
+    value_parser_t parser;  // of the pair criteria (NULL: the operand is the dictionnary id)
+};
+
+constexpr value_functor_s C_VALUE_FUNCTORS[] = {
+    {  60, "alphanumstring3-3",        NULL },
+    {  67, "alphanumstring2-2",        NULL },
+    { 212, "pairofdates",              &parse_pair_of_dates },
+    { 273, "alphastring2-2",           NULL },
+    { 316, "alphanumstring1-3",        NULL },
+    { 408, "integer0-9999_408",        NULL },
+    { 412, "integerrange4-digits_412", &parse_integer_range }
+};
+
+// entry of a functor, NULL if unknown
+inline const value_functor_s* find_value_functor(const uint16_t& functor)
+{
+    for (const value_functor_s& entry : C_VALUE_FUNCTORS)
+        if (entry.functor == functor)
+            return &entry;
+    return NULL;
+}
+
+} // namespace parsers
+} // namespace erbium
+
+#endif // ERBIUM_VALUE_PARSERS_H